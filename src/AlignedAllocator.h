@@ -0,0 +1,94 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef ALIGNEDALLOCATOR_H_INCLUDED
+#define ALIGNEDALLOCATOR_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+static constexpr auto CACHE_LINE_SIZE = size_t{64};
+
+// Allocator for buffers that should start on a cache line, so SIMD loads
+// don't straddle lines and buffers of different threads don't share one.
+template <typename T, size_t Alignment = CACHE_LINE_SIZE>
+class AlignedAllocator {
+    static_assert((Alignment & (Alignment - 1)) == 0,
+                  "Alignment must be a power of two");
+public:
+    using value_type = T;
+    template <typename U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(const size_t n) {
+        // Over-allocate and keep the pointer malloc gave us right before
+        // the aligned block.
+        const auto raw = std::malloc(n * sizeof(T) + Alignment + sizeof(void*));
+        if (raw == nullptr) {
+            throw std::bad_alloc();
+        }
+        auto addr = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*);
+        addr = (addr + Alignment - 1) & ~std::uintptr_t{Alignment - 1};
+        reinterpret_cast<void**>(addr)[-1] = raw;
+        return reinterpret_cast<T*>(addr);
+    }
+
+    void deallocate(T* const p, const size_t) {
+        if (p != nullptr) {
+            std::free(reinterpret_cast<void**>(p)[-1]);
+        }
+    }
+};
+
+template <typename T, typename U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {
+    return true;
+}
+
+template <typename T, typename U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&,
+                const AlignedAllocator<U, Alignment>&) {
+    return false;
+}
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+#endif
@@ -0,0 +1,71 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+#include "CPUFeatures.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPUFEATURES_CPUID
+#endif
+
+CPUFeatures::Isa CPUFeatures::detect_isa() {
+#ifdef CPUFEATURES_CPUID
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return Isa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return Isa::AVX2;
+    }
+#endif
+    return Isa::SCALAR;
+}
+
+bool CPUFeatures::is_supported(const Isa isa) {
+    static const auto best = detect_isa();
+    return isa <= best;
+}
+
+std::vector<CPUFeatures::Isa> CPUFeatures::supported_isas() {
+    auto isas = std::vector<Isa>{};
+    for (const auto isa : {Isa::SCALAR, Isa::AVX2, Isa::AVX512}) {
+        if (is_supported(isa)) {
+            isas.push_back(isa);
+        }
+    }
+    return isas;
+}
+
+const char* CPUFeatures::isa_name(const Isa isa) {
+    switch (isa) {
+        case Isa::AVX512: return "AVX-512";
+        case Isa::AVX2: return "AVX2";
+        default: return "scalar";
+    }
+}
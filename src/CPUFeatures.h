@@ -0,0 +1,55 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef CPUFEATURES_H_INCLUDED
+#define CPUFEATURES_H_INCLUDED
+
+#include "config.h"
+
+#include <vector>
+
+// The instruction sets the hand vectorized CPU code is built for.  The
+// kernels are compiled for them through function target attributes and
+// picked at runtime, so one binary runs on every x86 CPU.  Other
+// compilers and CPUs only get the scalar code.
+namespace CPUFeatures {
+    // Ordered so that every instruction set includes the ones before it.
+    enum class Isa {
+        SCALAR, AVX2, AVX512
+    };
+
+    // Best instruction set this CPU can run, detected with CPUID.
+    Isa detect_isa();
+    bool is_supported(const Isa isa);
+    // All the instruction sets this CPU can run, scalar first.
+    std::vector<Isa> supported_isas();
+    const char* isa_name(const Isa isa);
+}
+
+#endif
@@ -0,0 +1,331 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#ifdef __APPLE__
+#include <Accelerate/Accelerate.h>
+#endif
+#ifdef USE_MKL
+#include <mkl.h>
+#endif
+#ifdef USE_OPENBLAS
+#include <cblas.h>
+#endif
+#ifndef USE_BLAS
+#include <Eigen/Dense>
+#endif
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+
+#include "CPUGemm.h"
+#include "Network.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEMM_SIMD
+#define GEMM_INLINE inline __attribute__((always_inline))
+#include <immintrin.h>
+#endif
+
+#ifndef USE_BLAS
+// Eigen helpers
+template <typename T>
+using EigenMatrixMap =
+    Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
+template <typename T>
+using ConstEigenMatrixMap =
+    Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
+#endif
+
+using namespace CPUGemm;
+using CPUFeatures::Isa;
+
+namespace {
+    void sgemm_scalar(const Weights& weights,
+                      const float* const V,
+                      float* const M,
+                      const int batch_size,
+                      const int tile_begin, const int tile_end) {
+        const auto C = weights.channels;
+        const auto K = weights.outputs;
+        const auto Pb = WINOGRAD_P * batch_size;
+
+        for (auto b = tile_begin; b < tile_end; b++) {
+            const auto offset_u = b * K * C;
+            const auto offset_v = b * C * Pb;
+            const auto offset_m = b * K * Pb;
+#ifdef USE_BLAS
+            cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+                        K, Pb, C,
+                        1.0f,
+                        weights.data.get() + offset_u, K,
+                        V + offset_v, Pb,
+                        0.0f,
+                        M + offset_m, Pb);
+#else
+            auto C_mat = EigenMatrixMap<float>(M + offset_m, Pb, K);
+            C_mat.noalias() =
+               ConstEigenMatrixMap<float>(V + offset_v, Pb, C)
+                * ConstEigenMatrixMap<float>(weights.data.get() + offset_u,
+                                             K, C).transpose();
+#endif
+        }
+    }
+
+#ifdef GEMM_SIMD
+    // Output channels per panel.  A panel keeps one accumulator vector
+    // per output channel in registers.
+    constexpr auto AVX2_ROWS = 8;
+    constexpr auto AVX512_ROWS = 16;
+
+    using PanelKernel = void (*)(const float* U, const float* V, float* M,
+                                 int C, int Pb, int rows);
+
+    // One panel of output channels over all columns, a vector of columns
+    // at a time.  Like the output transform, the last vector is shifted
+    // back to overlap the previous one rather than being partially
+    // filled.  Only the first rows channels of the panel are stored.
+    //
+    // CHANNELS > 0 instantiates the kernel for a CHANNELS x CHANNELS
+    // tower convolution, with the channel loop and the panel height
+    // known at compile time.  0 takes both from the arguments.
+    template <int ROWS, int CHANNELS>
+    __attribute__((target("avx2,fma")))
+    void gemm_panel_avx2(const float* const U,
+                         const float* const V,
+                         float* const M,
+                         const int C, const int Pb, const int rows) {
+        constexpr auto lanes = 8;
+        for (auto next = 0; next < Pb; next += lanes) {
+            const auto p0 = std::min(next, Pb - lanes);
+            __m256 acc[ROWS];
+            for (auto r = 0; r < ROWS; r++) {
+                acc[r] = _mm256_setzero_ps();
+            }
+            for (auto c = 0; c < (CHANNELS > 0 ? CHANNELS : C); c++) {
+                const auto v = _mm256_loadu_ps(V + c * Pb + p0);
+                for (auto r = 0; r < ROWS; r++) {
+                    acc[r] = _mm256_fmadd_ps(
+                        _mm256_broadcast_ss(U + c * ROWS + r), v, acc[r]);
+                }
+            }
+            // Constant indices keep acc in registers
+            for (auto r = 0; r < ROWS; r++) {
+                if (CHANNELS > 0 || r < rows) {
+                    _mm256_storeu_ps(M + r * Pb + p0, acc[r]);
+                }
+            }
+        }
+    }
+
+    template <int ROWS, int CHANNELS>
+    __attribute__((target("avx512f")))
+    void gemm_panel_avx512(const float* const U,
+                           const float* const V,
+                           float* const M,
+                           const int C, const int Pb, const int rows) {
+        constexpr auto lanes = 16;
+        for (auto next = 0; next < Pb; next += lanes) {
+            const auto p0 = std::min(next, Pb - lanes);
+            __m512 acc[ROWS];
+            for (auto r = 0; r < ROWS; r++) {
+                acc[r] = _mm512_setzero_ps();
+            }
+            for (auto c = 0; c < (CHANNELS > 0 ? CHANNELS : C); c++) {
+                const auto v = _mm512_loadu_ps(V + c * Pb + p0);
+                for (auto r = 0; r < ROWS; r++) {
+                    acc[r] = _mm512_fmadd_ps(
+                        _mm512_set1_ps(U[c * ROWS + r]), v, acc[r]);
+                }
+            }
+            // Constant indices keep acc in registers
+            for (auto r = 0; r < ROWS; r++) {
+                if (CHANNELS > 0 || r < rows) {
+                    _mm512_storeu_ps(M + r * Pb + p0, acc[r]);
+                }
+            }
+        }
+    }
+
+    template <int ROWS, int CHANNELS, PanelKernel PANEL>
+    GEMM_INLINE void sgemm_panels(const Weights& weights,
+                                  const float* const V,
+                                  float* const M,
+                                  const int batch_size,
+                                  const int tile_begin, const int tile_end) {
+        static_assert(CHANNELS % ROWS == 0, "Panels must be full");
+        const auto C = CHANNELS > 0 ? CHANNELS : weights.channels;
+        const auto K = CHANNELS > 0 ? CHANNELS : weights.outputs;
+        const auto Kp = (K + ROWS - 1) / ROWS * ROWS;
+        const auto Pb = WINOGRAD_P * batch_size;
+        static_assert(WINOGRAD_P >= 16, "Columns must fill a vector");
+
+        for (auto t = tile_begin; t < tile_end; t++) {
+            const auto U_t = weights.data.get() + t * Kp * C;
+            const auto V_t = V + t * C * Pb;
+            const auto M_t = M + t * K * Pb;
+            for (auto k0 = 0; k0 < K; k0 += ROWS) {
+                PANEL(U_t + k0 * C, V_t, M_t + k0 * Pb,
+                      C, Pb, std::min(ROWS, K - k0));
+            }
+        }
+    }
+
+    template <int CHANNELS>
+    __attribute__((target("avx2,fma")))
+    void sgemm_avx2(const Weights& weights, const float* V, float* M,
+                    int batch_size, int tile_begin, int tile_end) {
+        sgemm_panels<AVX2_ROWS, CHANNELS,
+                     gemm_panel_avx2<AVX2_ROWS, CHANNELS>>(
+            weights, V, M, batch_size, tile_begin, tile_end);
+    }
+
+    template <int CHANNELS>
+    __attribute__((target("avx512f")))
+    void sgemm_avx512(const Weights& weights, const float* V, float* M,
+                      int batch_size, int tile_begin, int tile_end) {
+        sgemm_panels<AVX512_ROWS, CHANNELS,
+                     gemm_panel_avx512<AVX512_ROWS, CHANNELS>>(
+            weights, V, M, batch_size, tile_begin, tile_end);
+    }
+
+    template <int CHANNELS>
+    Weights::Kernel simd_kernel(const Isa isa) {
+        return isa == Isa::AVX512 ? sgemm_avx512<CHANNELS>
+                                  : sgemm_avx2<CHANNELS>;
+    }
+#endif
+
+    // Tower widths that get kernels instantiated for their shape.  Of the
+    // common network sizes 128x6, 192x15, 256x20 and 256x40 only 192
+    // channels measurably gains.  At -O3 the generic kernels are as fast
+    // for 128 and 256 channels, and faster with AVX2.
+    constexpr int SPECIALIZED_CHANNELS[] = {192};
+
+    Weights::Kernel select_kernel(const Isa isa, const int C, const int K,
+                                  const bool specialize) {
+#ifdef GEMM_SIMD
+        if (isa != Isa::SCALAR) {
+            if (specialize && C == K) {
+                switch (C) {
+                    case 192: return simd_kernel<192>(isa);
+                }
+            }
+            return simd_kernel<0>(isa);
+        }
+#else
+        (void)C;
+        (void)K;
+        (void)specialize;
+#endif
+        return sgemm_scalar;
+    }
+
+    int panel_rows(const Isa isa) {
+        switch (isa) {
+#ifdef GEMM_SIMD
+            case Isa::AVX512: return AVX512_ROWS;
+            case Isa::AVX2: return AVX2_ROWS;
+#endif
+            default: return 1;
+        }
+    }
+}
+
+bool CPUGemm::is_specialized(const int channels) {
+    return std::find(std::begin(SPECIALIZED_CHANNELS),
+                     std::end(SPECIALIZED_CHANNELS),
+                     channels) != std::end(SPECIALIZED_CHANNELS);
+}
+
+size_t CPUGemm::packed_size(const Isa isa, const int C, const int K) {
+    const auto rows = panel_rows(isa);
+    const auto Kp = (K + rows - 1) / rows * rows;
+    return size_t(WINOGRAD_TILE) * Kp * C;
+}
+
+void CPUGemm::pack_into(const Isa isa, const std::vector<float>& U,
+                        const int C, const int K, float* const out) {
+    assert(U.size() == size_t(WINOGRAD_TILE) * C * K);
+    assert(reinterpret_cast<std::uintptr_t>(out) % CACHE_LINE_SIZE == 0);
+    if (isa == Isa::SCALAR) {
+        std::copy(begin(U), end(U), out);
+        return;
+    }
+
+    const auto rows = panel_rows(isa);
+    const auto Kp = (K + rows - 1) / rows * rows;
+    std::fill(out, out + packed_size(isa, C, K), 0.0f);
+    for (auto t = 0; t < WINOGRAD_TILE; t++) {
+        for (auto k = 0; k < K; k++) {
+            const auto panel = k / rows;
+            const auto r = k % rows;
+            for (auto c = 0; c < C; c++) {
+                out[((t * Kp + panel * rows) * C + c * rows) + r] =
+                    U[(t * C + c) * K + k];
+            }
+        }
+    }
+}
+
+Weights CPUGemm::wrap(const Isa isa, const int C, const int K,
+                      std::shared_ptr<const float> data,
+                      const bool specialize) {
+    auto result = Weights{};
+    result.isa = isa;
+    result.channels = C;
+    result.outputs = K;
+    result.rows = panel_rows(isa);
+    result.kernel = select_kernel(isa, C, K, specialize);
+    result.data = std::move(data);
+    return result;
+}
+
+Weights CPUGemm::pack(const Isa isa, const std::vector<float>& U,
+                      const int C, const int K, const bool specialize) {
+    auto storage =
+        std::make_shared<AlignedVector<float>>(packed_size(isa, C, K));
+    pack_into(isa, U, C, K, storage->data());
+    // Alias the vector's contents, keeping the vector alive.
+    const auto data = storage->data();
+    return wrap(isa, C, K, std::shared_ptr<const float>(std::move(storage),
+                                                        data),
+                specialize);
+}
+
+void CPUGemm::sgemm(const Weights& weights,
+                    const float* const V,
+                    float* const M,
+                    const int batch_size,
+                    const int tile_begin, const int tile_end) {
+    assert(CPUFeatures::is_supported(weights.isa));
+    weights.kernel(weights, V, M, batch_size, tile_begin, tile_end);
+}
@@ -0,0 +1,97 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef CPUGEMM_H_INCLUDED
+#define CPUGEMM_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "AlignedAllocator.h"
+#include "CPUFeatures.h"
+
+// Winograd GEMMs M = transpose(U).V of the CPU pipe.  The transformed
+// weights U are constant, so rather than letting BLAS or Eigen pack them
+// into panels on every call, they are packed once when the weights are
+// pushed, in the layout of a small SIMD micro-kernel.
+namespace CPUGemm {
+    struct Weights {
+        using Kernel = void (*)(const Weights& weights,
+                                const float* V, float* M,
+                                int batch_size, int tile_begin, int tile_end);
+
+        // Instruction set whose kernel the weights are packed for
+        CPUFeatures::Isa isa{CPUFeatures::Isa::SCALAR};
+        int channels{0};
+        int outputs{0};
+        // Output channels per panel
+        int rows{0};
+        // Panels of rows output channels, padded with zeros,
+        // [WINOGRAD_TILE][outputs / rows][channels][rows].  For the
+        // scalar instruction set U as is, [WINOGRAD_TILE][C][K], for
+        // BLAS or Eigen.  Either owned by the weights or a view of a
+        // buffer shared with other layers or processes.
+        std::shared_ptr<const float> data;
+        // Picked by pack for the instruction set and shape
+        Kernel kernel{nullptr};
+    };
+
+    // U is [WINOGRAD_TILE][C][K] as produced by winograd_transform_f.
+    // Tower convolutions of the widths that gain from it get a kernel
+    // compiled for their shape unless specialize is false.
+    Weights pack(const CPUFeatures::Isa isa, const std::vector<float>& U,
+                 const int C, const int K, const bool specialize = true);
+
+    // The steps of pack, for callers that place the packed data
+    // themselves: packed_size floats written by pack_into to a cache
+    // line aligned buffer, which wrap turns into Weights.
+    size_t packed_size(const CPUFeatures::Isa isa, const int C, const int K);
+    void pack_into(const CPUFeatures::Isa isa, const std::vector<float>& U,
+                   const int C, const int K, float* const out);
+    Weights wrap(const CPUFeatures::Isa isa, const int C, const int K,
+                 std::shared_ptr<const float> data,
+                 const bool specialize = true);
+
+    // Whether channels x channels convolutions have specialized kernels.
+    bool is_specialized(const int channels);
+
+    // GEMMs of Winograd tiles [tile_begin, tile_end).  V is laid out as
+    // [WINOGRAD_TILE][C][WINOGRAD_P * batch_size], M as
+    // [WINOGRAD_TILE][K][WINOGRAD_P * batch_size].
+    void sgemm(const Weights& weights,
+               const float* const V,
+               float* const M,
+               const int batch_size,
+               const int tile_begin, const int tile_end);
+}
+
+#endif
@@ -0,0 +1,515 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include "CPUInt8.h"
+#include "Network.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define INT8_SIMD
+#define INT8_INLINE inline __attribute__((always_inline))
+#include <immintrin.h>
+#if defined(__clang__) ? (__clang_major__ >= 6) : (__GNUC__ >= 8)
+#define INT8_VNNI
+#endif
+#else
+#define INT8_INLINE inline
+#endif
+
+using namespace CPUInt8;
+
+namespace {
+    // OpenCL.h has a Layer of its own at global scope.
+    using CPUInt8::Layer;
+
+    constexpr auto TABLE_MAGIC = "leelaz-int8";
+    constexpr auto TABLE_VERSION = 2;
+
+    // Inputs are stored as q + INPUT_OFFSET with q in [-127, 127].
+    constexpr auto INPUT_OFFSET = 128;
+    // Keeps the sum of two input * weight products below 2^15.
+    constexpr auto MAX_WEIGHT = 63;
+
+    // Columns computed per kernel call.  The quantized inputs are padded
+    // to a multiple of this.
+    constexpr auto COLUMN_BLOCK = 16;
+
+    int padded_columns(const int batch_size) {
+        const auto Pb = WINOGRAD_P * batch_size;
+        return (Pb + COLUMN_BLOCK - 1) / COLUMN_BLOCK * COLUMN_BLOCK;
+    }
+
+    using BlockKernel = void (*)(const std::int32_t* W,
+                                 const std::int32_t* offsets,
+                                 const float* scales,
+                                 const std::uint32_t* Vq,
+                                 float* M,
+                                 int C4, int Pb, int Pq, int p0);
+
+    INT8_INLINE void store_columns(float* const M,
+                                   const std::int32_t* const sums,
+                                   const std::int32_t offset, const float scale,
+                                   const int Pb, const int p0) {
+        const auto n = std::min(COLUMN_BLOCK, Pb - p0);
+        for (auto p = 0; p < n; p++) {
+            M[p0 + p] = float(sums[p] - offset) * scale;
+        }
+    }
+
+    template <int ROWS>
+    void gemm_block_scalar(const std::int32_t* const W,
+                           const std::int32_t* const offsets,
+                           const float* const scales,
+                           const std::uint32_t* const Vq,
+                           float* const M,
+                           const int C4, const int Pb, const int Pq,
+                           const int p0) {
+        for (auto r = 0; r < ROWS; r++) {
+            std::int32_t sums[COLUMN_BLOCK];
+            for (auto p = 0; p < COLUMN_BLOCK; p++) {
+                auto acc = std::int32_t{0};
+                for (auto g = 0; g < C4; g++) {
+                    const auto w = W[r * C4 + g];
+                    const auto v = Vq[g * Pq + p0 + p];
+                    for (auto j = 0; j < 4; j++) {
+                        acc += std::int32_t{std::int8_t(w >> (8 * j))}
+                               * std::int32_t{std::uint8_t(v >> (8 * j))};
+                    }
+                }
+                sums[p] = acc;
+            }
+            store_columns(M + r * Pb, sums, offsets[r], scales[r], Pb, p0);
+        }
+    }
+
+    // Packs four channels of one tile into every word of Vq, columns
+    // past Pb and channels past C are set to the offset (zero).
+    INT8_INLINE void quantize_inputs(const float* const V_t,
+                                     std::uint32_t* const Vq,
+                                     const int C, const int Pb, const int Pq,
+                                     const float scale) {
+        const auto quantize = [](const float val, const float s) {
+            // Clamp, then round half up on the offset value.
+            const auto x = std::min(std::max(val * s, -127.0f), 127.0f);
+            return std::uint32_t(x + (INPUT_OFFSET + 0.5f));
+        };
+        const auto C4 = (C + 3) / 4;
+        for (auto g = 0; g < C4; g++) {
+            const float* rows[4];
+            float scales[4];
+            for (auto j = 0; j < 4; j++) {
+                const auto c = 4 * g + j;
+                rows[j] = V_t + std::min(c, C - 1) * Pb;
+                scales[j] = c < C ? scale : 0.0f;
+            }
+            const auto out = Vq + g * Pq;
+            for (auto p = 0; p < Pb; p++) {
+                out[p] = quantize(rows[0][p], scales[0])
+                       | quantize(rows[1][p], scales[1]) << 8
+                       | quantize(rows[2][p], scales[2]) << 16
+                       | quantize(rows[3][p], scales[3]) << 24;
+            }
+            for (auto p = Pb; p < Pq; p++) {
+                out[p] = 0x80808080u;
+            }
+        }
+    }
+
+    template <int ROWS, BlockKernel BLOCK, BlockKernel BLOCK1>
+    INT8_INLINE void sgemm_tiles(const Layer& layer,
+                                 const float* const V,
+                                 std::uint32_t* const Vq,
+                                 float* const M,
+                                 const int batch_size,
+                                 const int tile_begin, const int tile_end) {
+        const auto C = layer.channels;
+        const auto K = layer.outputs;
+        const auto C4 = (C + 3) / 4;
+        const auto Pb = WINOGRAD_P * batch_size;
+        const auto Pq = padded_columns(batch_size);
+
+        for (auto t = tile_begin; t < tile_end; t++) {
+            quantize_inputs(V + t * C * Pb, Vq, C, Pb, Pq,
+                            layer.input_scales[t]);
+
+            const auto W_t = layer.weights.data() + t * K * C4;
+            const auto O_t = layer.offsets.data() + t * K;
+            const auto S_t = layer.scales.data() + t * K;
+            const auto M_t = M + t * K * Pb;
+            for (auto p0 = 0; p0 < Pb; p0 += COLUMN_BLOCK) {
+                auto k = 0;
+                for (; k + ROWS <= K; k += ROWS) {
+                    BLOCK(W_t + k * C4, O_t + k, S_t + k, Vq, M_t + k * Pb,
+                          C4, Pb, Pq, p0);
+                }
+                for (; k < K; k++) {
+                    BLOCK1(W_t + k * C4, O_t + k, S_t + k, Vq, M_t + k * Pb,
+                           C4, Pb, Pq, p0);
+                }
+            }
+        }
+    }
+
+    void sgemm_scalar(const Layer& layer, const float* V, std::uint32_t* Vq,
+                      float* M, int batch_size,
+                      int tile_begin, int tile_end) {
+        sgemm_tiles<1, gemm_block_scalar<1>, gemm_block_scalar<1>>(
+            layer, V, Vq, M, batch_size, tile_begin, tile_end);
+    }
+
+#ifdef INT8_SIMD
+    // pmaddubsw multiplies the unsigned input bytes with the signed weight
+    // bytes and adds neighbouring pairs, pmaddwd with ones adds the pairs
+    // of pairs, so every 32 bit lane gets the dot product of one word.
+    template <int ROWS>
+    __attribute__((target("avx2")))
+    void gemm_block_avx2(const std::int32_t* const W,
+                         const std::int32_t* const offsets,
+                         const float* const scales,
+                         const std::uint32_t* const Vq,
+                         float* const M,
+                         const int C4, const int Pb, const int Pq,
+                         const int p0) {
+        const auto ones = _mm256_set1_epi16(1);
+        __m256i acc[ROWS][2];
+        for (auto r = 0; r < ROWS; r++) {
+            acc[r][0] = _mm256_setzero_si256();
+            acc[r][1] = _mm256_setzero_si256();
+        }
+        for (auto g = 0; g < C4; g++) {
+            const auto src = Vq + g * Pq + p0;
+            const auto v0 = _mm256_loadu_si256((const __m256i*)src);
+            const auto v1 = _mm256_loadu_si256((const __m256i*)(src + 8));
+            for (auto r = 0; r < ROWS; r++) {
+                const auto w = _mm256_set1_epi32(W[r * C4 + g]);
+                acc[r][0] = _mm256_add_epi32(acc[r][0],
+                    _mm256_madd_epi16(_mm256_maddubs_epi16(v0, w), ones));
+                acc[r][1] = _mm256_add_epi32(acc[r][1],
+                    _mm256_madd_epi16(_mm256_maddubs_epi16(v1, w), ones));
+            }
+        }
+        for (auto r = 0; r < ROWS; r++) {
+            std::int32_t sums[COLUMN_BLOCK];
+            _mm256_storeu_si256((__m256i*)sums, acc[r][0]);
+            _mm256_storeu_si256((__m256i*)(sums + 8), acc[r][1]);
+            store_columns(M + r * Pb, sums, offsets[r], scales[r], Pb, p0);
+        }
+    }
+
+    template <int ROWS>
+    __attribute__((target("avx512f,avx512bw")))
+    void gemm_block_avx512(const std::int32_t* const W,
+                           const std::int32_t* const offsets,
+                           const float* const scales,
+                           const std::uint32_t* const Vq,
+                           float* const M,
+                           const int C4, const int Pb, const int Pq,
+                           const int p0) {
+        const auto ones = _mm512_set1_epi16(1);
+        __m512i acc[ROWS];
+        for (auto r = 0; r < ROWS; r++) {
+            acc[r] = _mm512_setzero_si512();
+        }
+        for (auto g = 0; g < C4; g++) {
+            const auto v = _mm512_loadu_si512(Vq + g * Pq + p0);
+            for (auto r = 0; r < ROWS; r++) {
+                const auto w = _mm512_set1_epi32(W[r * C4 + g]);
+                acc[r] = _mm512_add_epi32(acc[r],
+                    _mm512_madd_epi16(_mm512_maddubs_epi16(v, w), ones));
+            }
+        }
+        for (auto r = 0; r < ROWS; r++) {
+            std::int32_t sums[COLUMN_BLOCK];
+            _mm512_storeu_si512(sums, acc[r]);
+            store_columns(M + r * Pb, sums, offsets[r], scales[r], Pb, p0);
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void sgemm_avx2(const Layer& layer, const float* V, std::uint32_t* Vq,
+                    float* M, int batch_size,
+                    int tile_begin, int tile_end) {
+        sgemm_tiles<4, gemm_block_avx2<4>, gemm_block_avx2<1>>(
+            layer, V, Vq, M, batch_size, tile_begin, tile_end);
+    }
+
+    __attribute__((target("avx512f,avx512bw")))
+    void sgemm_avx512(const Layer& layer, const float* V, std::uint32_t* Vq,
+                      float* M, int batch_size,
+                      int tile_begin, int tile_end) {
+        sgemm_tiles<8, gemm_block_avx512<8>, gemm_block_avx512<1>>(
+            layer, V, Vq, M, batch_size, tile_begin, tile_end);
+    }
+
+#ifdef INT8_VNNI
+    // vpdpbusd does the multiply, pair and quad sums and accumulation of
+    // the AVX-512 kernel in one instruction.
+    template <int ROWS>
+    __attribute__((target("avx512f,avx512bw,avx512vnni")))
+    void gemm_block_vnni(const std::int32_t* const W,
+                         const std::int32_t* const offsets,
+                         const float* const scales,
+                         const std::uint32_t* const Vq,
+                         float* const M,
+                         const int C4, const int Pb, const int Pq,
+                         const int p0) {
+        __m512i acc[ROWS];
+        for (auto r = 0; r < ROWS; r++) {
+            acc[r] = _mm512_setzero_si512();
+        }
+        for (auto g = 0; g < C4; g++) {
+            const auto v = _mm512_loadu_si512(Vq + g * Pq + p0);
+            for (auto r = 0; r < ROWS; r++) {
+                acc[r] = _mm512_dpbusd_epi32(acc[r], v,
+                                             _mm512_set1_epi32(W[r * C4 + g]));
+            }
+        }
+        for (auto r = 0; r < ROWS; r++) {
+            std::int32_t sums[COLUMN_BLOCK];
+            _mm512_storeu_si512(sums, acc[r]);
+            store_columns(M + r * Pb, sums, offsets[r], scales[r], Pb, p0);
+        }
+    }
+
+    __attribute__((target("avx512f,avx512bw,avx512vnni")))
+    void sgemm_vnni(const Layer& layer, const float* V, std::uint32_t* Vq,
+                    float* M, int batch_size,
+                    int tile_begin, int tile_end) {
+        sgemm_tiles<8, gemm_block_vnni<8>, gemm_block_vnni<1>>(
+            layer, V, Vq, M, batch_size, tile_begin, tile_end);
+    }
+#endif
+#endif
+
+    enum class Kernel {
+        SCALAR, AVX2, AVX512, VNNI
+    };
+
+    Kernel select_kernel(const CPUFeatures::Isa isa) {
+#ifdef INT8_SIMD
+        if (isa >= CPUFeatures::Isa::AVX512
+            && __builtin_cpu_supports("avx512bw")) {
+#ifdef INT8_VNNI
+            if (__builtin_cpu_supports("avx512vnni")) {
+                return Kernel::VNNI;
+            }
+#endif
+            return Kernel::AVX512;
+        }
+        if (isa >= CPUFeatures::Isa::AVX2) {
+            return Kernel::AVX2;
+        }
+#else
+        (void)isa;
+#endif
+        return Kernel::SCALAR;
+    }
+}
+
+Table::Table(const size_t layers)
+    : m_ranges(layers, std::vector<float>(WINOGRAD_TILE, 0.0f)),
+      m_channels(layers, 0) {
+}
+
+size_t Table::layers() const {
+    return m_ranges.size();
+}
+
+int Table::channels(const size_t layer) const {
+    return m_channels[layer];
+}
+
+bool Table::fits(const std::vector<std::vector<float>>& conv_weights,
+                 const int outputs) const {
+    if (conv_weights.size() != layers()) {
+        return false;
+    }
+    for (auto layer = size_t{0}; layer < layers(); layer++) {
+        if (conv_weights[layer].size()
+            != size_t(WINOGRAD_TILE) * m_channels[layer] * outputs) {
+            return false;
+        }
+    }
+    return true;
+}
+
+float Table::range(const size_t layer, const int tile) const {
+    return m_ranges[layer][tile];
+}
+
+void Table::record(const size_t layer, const float* const V,
+                   const int C, const int batch_size) {
+    assert(m_channels[layer] == 0 || m_channels[layer] == C);
+    m_channels[layer] = C;
+    const auto tile_size = C * WINOGRAD_P * batch_size;
+    for (auto t = 0; t < WINOGRAD_TILE; t++) {
+        const auto first = V + t * tile_size;
+        auto range = m_ranges[layer][t];
+        std::for_each(first, first + tile_size, [&range](const float v) {
+            range = std::max(range, std::abs(v));
+        });
+        m_ranges[layer][t] = range;
+    }
+}
+
+bool Table::save(const std::string& filename) const {
+    auto out = std::ofstream{filename};
+    if (!out) {
+        return false;
+    }
+    out << TABLE_MAGIC << " " << TABLE_VERSION << "\n";
+    out << m_ranges.size() << " " << WINOGRAD_TILE << "\n";
+    out.precision(9);
+    for (auto layer = size_t{0}; layer < layers(); layer++) {
+        out << m_channels[layer];
+        for (auto t = 0; t < WINOGRAD_TILE; t++) {
+            out << " " << m_ranges[layer][t];
+        }
+        out << "\n";
+    }
+    return bool(out);
+}
+
+std::shared_ptr<Table> Table::load(const std::string& filename) {
+    auto in = std::ifstream{filename};
+    auto magic = std::string{};
+    auto version = 0;
+    auto layers = size_t{0};
+    auto tiles = 0;
+    if (!(in >> magic >> version >> layers >> tiles)
+        || magic != TABLE_MAGIC || version != TABLE_VERSION
+        || tiles != WINOGRAD_TILE) {
+        return nullptr;
+    }
+    auto table = std::make_shared<Table>(layers);
+    for (auto layer = size_t{0}; layer < layers; layer++) {
+        auto& channels = table->m_channels[layer];
+        if (!(in >> channels) || channels < 0) {
+            return nullptr;
+        }
+        for (auto& range : table->m_ranges[layer]) {
+            if (!(in >> range) || !std::isfinite(range) || range < 0.0f) {
+                return nullptr;
+            }
+        }
+    }
+    return table;
+}
+
+CPUInt8::Layer CPUInt8::quantize(const std::vector<float>& U,
+                                 const int C, const int K,
+                                 const Table& table, const size_t layer) {
+    assert(U.size() == size_t(WINOGRAD_TILE) * C * K);
+    const auto C4 = (C + 3) / 4;
+    auto result = Layer{};
+    result.channels = C;
+    result.outputs = K;
+    result.weights.resize(WINOGRAD_TILE * K * C4);
+    result.offsets.resize(WINOGRAD_TILE * K);
+    result.scales.resize(WINOGRAD_TILE * K);
+    result.input_scales.resize(WINOGRAD_TILE);
+
+    for (auto t = 0; t < WINOGRAD_TILE; t++) {
+        const auto range = table.range(layer, t);
+        const auto input_scale = range > 0.0f ? 127.0f / range : 1.0f;
+        result.input_scales[t] = input_scale;
+
+        for (auto k = 0; k < K; k++) {
+            auto wmax = 0.0f;
+            for (auto c = 0; c < C; c++) {
+                wmax = std::max(wmax, std::abs(U[(t * C + c) * K + k]));
+            }
+            const auto weight_scale = wmax > 0.0f ? MAX_WEIGHT / wmax : 1.0f;
+
+            auto bytes = std::vector<std::int8_t>(4 * C4, 0);
+            auto sum = std::int32_t{0};
+            for (auto c = 0; c < C; c++) {
+                const auto w = std::round(U[(t * C + c) * K + k] * weight_scale);
+                bytes[c] = static_cast<std::int8_t>(w);
+                sum += bytes[c];
+            }
+            std::memcpy(&result.weights[(t * K + k) * C4], bytes.data(),
+                        bytes.size());
+            result.offsets[t * K + k] = sum * INPUT_OFFSET;
+            result.scales[t * K + k] = 1.0f / (weight_scale * input_scale);
+        }
+    }
+    return result;
+}
+
+size_t CPUInt8::scratch_size(const int C, const int batch_size) {
+    return size_t((C + 3) / 4) * padded_columns(batch_size);
+}
+
+void CPUInt8::sgemm(const CPUFeatures::Isa isa,
+                    const Layer& layer,
+                    const float* const V,
+                    std::uint32_t* const Vq,
+                    float* const M,
+                    const int batch_size,
+                    const int tile_begin, const int tile_end) {
+    switch (select_kernel(isa)) {
+#ifdef INT8_SIMD
+#ifdef INT8_VNNI
+        case Kernel::VNNI:
+            sgemm_vnni(layer, V, Vq, M, batch_size,
+                       tile_begin, tile_end);
+            break;
+#endif
+        case Kernel::AVX512:
+            sgemm_avx512(layer, V, Vq, M, batch_size,
+                         tile_begin, tile_end);
+            break;
+        case Kernel::AVX2:
+            sgemm_avx2(layer, V, Vq, M, batch_size,
+                       tile_begin, tile_end);
+            break;
+#endif
+        default:
+            sgemm_scalar(layer, V, Vq, M, batch_size,
+                         tile_begin, tile_end);
+            break;
+    }
+}
+
+const char* CPUInt8::kernel_name(const CPUFeatures::Isa isa) {
+    switch (select_kernel(isa)) {
+        case Kernel::VNNI: return "AVX-512 VNNI";
+        case Kernel::AVX512: return "AVX-512";
+        case Kernel::AVX2: return "AVX2";
+        default: return "scalar";
+    }
+}
@@ -0,0 +1,116 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef CPUINT8_H_INCLUDED
+#define CPUINT8_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CPUFeatures.h"
+
+// Int8 Winograd GEMMs for the residual tower of the CPU pipe.  The
+// transformed weights U are quantized per (tile, output channel), the
+// transformed inputs V per (layer, tile) with ranges calibrated on real
+// positions, and the products are accumulated in int32 before being
+// scaled back to the float M that the output transform expects.
+//
+// Inputs are stored as unsigned bytes with an offset of 128 and weights
+// as 7 bit signed bytes, so pairs of products fit the 16 bit
+// intermediates of pmaddubsw and every kernel gives the same result.
+namespace CPUInt8 {
+    // Largest |V| seen for every convolution and Winograd tile, and
+    // the input channels of every convolution.
+    class Table {
+    public:
+        explicit Table(const size_t layers);
+
+        size_t layers() const;
+        int channels(const size_t layer) const;
+        // Whether the table was recorded on convolutions of this shape,
+        // each U being [WINOGRAD_TILE][C][outputs].
+        bool fits(const std::vector<std::vector<float>>& conv_weights,
+                  const int outputs) const;
+        float range(const size_t layer, const int tile) const;
+        // Widen the ranges of layer to cover V, laid out like in
+        // CPUPipe::winograd_convolve3.  Not thread safe.
+        void record(const size_t layer, const float* const V,
+                    const int C, const int batch_size);
+
+        bool save(const std::string& filename) const;
+        // Returns nullptr if the file can't be read.
+        static std::shared_ptr<Table> load(const std::string& filename);
+
+    private:
+        // [layer][WINOGRAD_TILE]
+        std::vector<std::vector<float>> m_ranges;
+        // [layer], 0 until the layer is recorded
+        std::vector<int> m_channels;
+    };
+
+    struct Layer {
+        int channels{0};
+        int outputs{0};
+        // Four input channels per word, [WINOGRAD_TILE][K][(C + 3) / 4]
+        std::vector<std::int32_t> weights;
+        // Sum of the weights times the input offset, [WINOGRAD_TILE][K]
+        std::vector<std::int32_t> offsets;
+        // Turns int32 sums back into floats, [WINOGRAD_TILE][K]
+        std::vector<float> scales;
+        // Multiplier that maps V onto [-127, 127], [WINOGRAD_TILE]
+        std::vector<float> input_scales;
+    };
+
+    // U is [WINOGRAD_TILE][C][K] as produced by winograd_transform_f.
+    Layer quantize(const std::vector<float>& U, const int C, const int K,
+                   const Table& table, const size_t layer);
+
+    // Words of scratch space sgemm needs for the quantized inputs.
+    size_t scratch_size(const int C, const int batch_size);
+
+    // Same contract as CPUGemm::sgemm, for Winograd tiles
+    // [tile_begin, tile_end).  Vq must hold scratch_size() words and
+    // cannot be shared by concurrent calls.  The AVX-512 kernel needs
+    // AVX-512BW and uses VNNI when the CPU has it.
+    void sgemm(const CPUFeatures::Isa isa,
+               const Layer& layer,
+               const float* const V,
+               std::uint32_t* const Vq,
+               float* const M,
+               const int batch_size,
+               const int tile_begin, const int tile_end);
+
+    const char* kernel_name(const CPUFeatures::Isa isa);
+}
+
+#endif
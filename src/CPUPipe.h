@@ -31,48 +31,103 @@
 #define CPUPIPE_H_INCLUDED
 #include "config.h"
 
-#include <vector>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
+#include "AlignedAllocator.h"
+#include "CPUFeatures.h"
+#include "CPUGemm.h"
+#include "CPUInt8.h"
+#include "CPUWinograd.h"
 #include "ForwardPipe.h"
+#include "WorkerTeam.h"
 
 class CPUPipe : public ForwardPipe {
 public:
+    CPUPipe() = default;
+    // Runs the residual tower GEMMs in int8 with the activation ranges
+    // in int8_table.
+    explicit CPUPipe(std::shared_ptr<const CPUInt8::Table> int8_table);
+
     virtual void initialize(const int channels);
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val);
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const int batch_size);
 
     virtual void push_weights(unsigned int filter_size,
                               unsigned int channels,
                               unsigned int outputs,
                               std::shared_ptr<const ForwardPipeWeights> weights);
-private:
-    void winograd_transform_in(const std::vector<float>& in,
-                               std::vector<float>& V,
-                               const int C);
 
-    void winograd_sgemm(const std::vector<float>& U,
-                        const std::vector<float>& V,
-                        std::vector<float>& M,
-                        const int C, const int K);
+    // Record the Winograd input ranges of every convolution into table
+    // while evaluating in fp32.  Pass nullptr to stop recording.
+    void set_int8_calibration(std::shared_ptr<CPUInt8::Table> table);
 
-    void winograd_transform_out(const std::vector<float>& M,
-                                std::vector<float>& Y,
-                                const int K);
+    // Number of times any thread had to allocate or grow its workspace.
+    // Stays constant once every thread has evaluated its largest batch.
+    static size_t workspace_allocations();
+private:
+    // Buffers of one forward pass.  Every thread keeps its own set, sized
+    // from the network shape on its first eval and reused afterwards.
+    struct Workspace {
+        AlignedVector<float> V;
+        AlignedVector<float> M;
+        AlignedVector<std::uint32_t> Vq;
+        AlignedVector<float> conv_out;
+        AlignedVector<float> conv_in;
+        AlignedVector<float> res;
+        // im2col buffer of the head convolutions
+        AlignedVector<float> col;
+    };
+    Workspace& get_workspace(const int batch_size);
+    template <typename T>
+    static void reserve(AlignedVector<T>& buffer, const size_t size);
+
+    // Convolution number layer of the tower, 0 being the input
+    // convolution.
+    void winograd_convolve3(const size_t layer,
+                            const int outputs,
+                            const float* const input,
+                            const float* const eltwise,
+                            float* const V,
+                            std::uint32_t* const Vq,
+                            float* const M,
+                            float* const output,
+                            const int batch_size);
+
+    // Pack the tower into a file mapping shared with other processes,
+    // named after weights.m_shared_name.  Returns false if that fails.
+    bool share_conv_weights(const ForwardPipeWeights& weights,
+                            const int outputs);
+
+    static std::atomic<size_t> s_workspace_allocations;
+
+    int m_input_channels;
 
-    void winograd_convolve3(const int outputs,
-                            const std::vector<float>& input,
-                            const std::vector<float>& U,
-                            std::vector<float>& V,
-                            std::vector<float>& M,
-                            std::vector<float>& output);
+    // Instruction set used for the Winograd transforms
+    CPUFeatures::Isa m_isa{CPUFeatures::Isa::SCALAR};
 
+    // Threads that share each forward pass, cfg_eval_threads of them
+    std::unique_ptr<Utils::WorkerTeam> m_team;
 
-    int m_input_channels;
+    // Input + residual block tower, the GEMM weights packed for m_isa
+    std::vector<CPUGemm::Weights> m_conv_weights;
+    std::vector<std::vector<float>> m_batchnorm_means;
+    std::vector<std::vector<float>> m_batchnorm_stddevs;
 
-    // Input + residual block tower
-    std::shared_ptr<const ForwardPipeWeights> m_weights;
+    // Int8 residual tower, indexed like m_conv_weights, which has empty
+    // entries for the int8 layers.  The input convolution stays in fp32
+    // and has an empty entry here.
+    std::shared_ptr<const CPUInt8::Table> m_int8_table;
+    std::vector<CPUInt8::Layer> m_int8_layers;
+    std::shared_ptr<CPUInt8::Table> m_int8_calibration;
 
     std::vector<float> m_conv_pol_w;
     std::vector<float> m_conv_val_w;
@@ -0,0 +1,202 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "CPUScheduler.h"
+#include "GTP.h"
+#include "Network.h"
+
+CPUScheduler::CPUScheduler(std::shared_ptr<const CPUInt8::Table> int8_table)
+    : m_pipe(int8_table) {
+}
+
+void CPUScheduler::initialize(const int channels) {
+    m_pipe.initialize(channels);
+
+    // Every worker runs complete batches on the CPU, so there is no point
+    // in having more of them than can be kept busy by the search threads.
+    const auto num_worker_threads =
+        std::max(cfg_num_threads / cfg_batch_size, 1u);
+    for (auto i = unsigned{0}; i < num_worker_threads; i++) {
+        auto t = std::thread(&CPUScheduler::batch_worker, this);
+        m_worker_threads.push_back(std::move(t));
+    }
+}
+
+CPUScheduler::~CPUScheduler() {
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_running = false;
+    }
+    m_cv.notify_all();
+    for (auto & x : m_worker_threads) {
+        x.join();
+    }
+}
+
+void CPUScheduler::push_weights(
+    unsigned int filter_size,
+    unsigned int channels,
+    unsigned int outputs,
+    std::shared_ptr<const ForwardPipeWeights> weights) {
+
+    m_pipe.push_weights(filter_size, channels, outputs, weights);
+}
+
+void CPUScheduler::forward(const std::vector<float>& input,
+                           std::vector<float>& output_pol,
+                           std::vector<float>& output_val) {
+    auto entry = std::make_shared<ForwardQueueEntry>(input, output_pol, output_val);
+    std::unique_lock<std::mutex> lk(entry->mutex);
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_forward_queue.push_back(entry);
+
+        if (m_single_eval_in_progress.load()) {
+            m_waittime += 2;
+        }
+    }
+    m_cv.notify_one();
+    entry->cv.wait(lk, [&entry] () { return entry->done; });
+}
+
+void CPUScheduler::forward_batch(const std::vector<float>& input,
+                                 std::vector<float>& output_pol,
+                                 std::vector<float>& output_val,
+                                 const int batch_size) {
+    m_pipe.forward_batch(input, output_pol, output_val, batch_size);
+}
+
+void CPUScheduler::batch_worker() {
+    constexpr auto in_size = Network::INPUT_CHANNELS * NUM_INTERSECTIONS;
+    constexpr auto out_pol_size = Network::OUTPUTS_POLICY * NUM_INTERSECTIONS;
+    constexpr auto out_val_size = Network::OUTPUTS_VALUE * NUM_INTERSECTIONS;
+
+    // Same batch scheduling heuristic as OpenCLScheduler::batch_worker:
+    // wait up to m_waittime milliseconds for a full batch, and fall back
+    // to a single eval if the batch can't be formed in time.  m_waittime
+    // shrinks on every timeout and grows when evals queue up behind a
+    // single eval.
+    auto pickup_task = [this] () {
+        std::list<std::shared_ptr<ForwardQueueEntry>> inputs;
+        size_t count = 0;
+
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while (true) {
+            if (!m_running) return inputs;
+
+            count = m_forward_queue.size();
+            if (count >= cfg_batch_size) {
+                count = cfg_batch_size;
+                break;
+            }
+
+            bool timeout = !m_cv.wait_for(
+                lk,
+                std::chrono::milliseconds(m_waittime),
+                [this] () {
+                    return !m_running || m_forward_queue.size() >= cfg_batch_size;
+                }
+            );
+
+            if (!m_forward_queue.empty()) {
+                if (timeout && m_single_eval_in_progress.exchange(true) == false) {
+                    // Waited long enough but couldn't form a batch.
+                    // Check if there is any other single eval in progress, and if not,
+                    // do one from this thread.
+                    if (m_waittime > 1) {
+                        m_waittime--;
+                    }
+                    count = 1;
+                    break;
+                }
+            }
+        }
+        // Move 'count' evals from shared queue to local list.
+        auto end = begin(m_forward_queue);
+        std::advance(end, count);
+        std::move(begin(m_forward_queue), end, std::back_inserter(inputs));
+        m_forward_queue.erase(begin(m_forward_queue), end);
+
+        return inputs;
+    };
+
+    auto batch_input = std::vector<float>();
+    auto batch_output_pol = std::vector<float>();
+    auto batch_output_val = std::vector<float>();
+
+    while (true) {
+        auto inputs = pickup_task();
+        auto count = inputs.size();
+
+        if (!m_running) {
+            return;
+        }
+
+        // prepare input for forward() call
+        batch_input.resize(in_size * count);
+        batch_output_pol.resize(out_pol_size * count);
+        batch_output_val.resize(out_val_size * count);
+
+        auto index = size_t{0};
+        for (auto & x : inputs) {
+            std::unique_lock<std::mutex> lk(x->mutex);
+            std::copy(begin(x->in), end(x->in), begin(batch_input) + in_size * index);
+            index++;
+        }
+
+        // run the NN evaluation
+        m_pipe.forward_batch(batch_input, batch_output_pol, batch_output_val, count);
+
+        // Get output and copy back
+        index = 0;
+        for (auto & x : inputs) {
+            {
+                std::unique_lock<std::mutex> lk(x->mutex);
+                std::copy(begin(batch_output_pol) + out_pol_size * index,
+                          begin(batch_output_pol) + out_pol_size * (index + 1),
+                          begin(x->out_p));
+                std::copy(begin(batch_output_val) + out_val_size * index,
+                          begin(batch_output_val) + out_val_size * (index + 1),
+                          begin(x->out_v));
+                x->done = true;
+            }
+            x->cv.notify_all();
+            index++;
+        }
+
+        if (count == 1) {
+            m_single_eval_in_progress = false;
+        }
+    }
+}
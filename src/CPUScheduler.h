@@ -0,0 +1,100 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef CPUSCHEDULER_H_INCLUDED
+#define CPUSCHEDULER_H_INCLUDED
+#include "config.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "CPUPipe.h"
+#include "ForwardPipe.h"
+
+// Collects positions from the search threads and evaluates them in
+// batches of up to cfg_batch_size through a single CPUPipe, so the
+// Winograd GEMMs are WINOGRAD_P * batch wide instead of WINOGRAD_P.
+class CPUScheduler : public ForwardPipe {
+    class ForwardQueueEntry {
+    public:
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done{false};
+        const std::vector<float>& in;
+        std::vector<float>& out_p;
+        std::vector<float>& out_v;
+        ForwardQueueEntry(const std::vector<float>& input,
+                          std::vector<float>& output_pol,
+                          std::vector<float>& output_val)
+        : in(input), out_p(output_pol), out_v(output_val)
+          {}
+    };
+public:
+    CPUScheduler() = default;
+    explicit CPUScheduler(std::shared_ptr<const CPUInt8::Table> int8_table);
+    virtual ~CPUScheduler();
+
+    virtual void initialize(const int channels);
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+    // Runs the batch on the calling thread, without waiting for the
+    // batch workers.
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const int batch_size);
+    virtual void push_weights(unsigned int filter_size,
+                              unsigned int channels,
+                              unsigned int outputs,
+                              std::shared_ptr<const ForwardPipeWeights> weights);
+private:
+    bool m_running = true;
+    CPUPipe m_pipe;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    // start with 10 milliseconds : lock protected
+    int m_waittime{10};
+
+    // set to true when single (non-batch) eval is in progress
+    std::atomic<bool> m_single_eval_in_progress{false};
+
+    std::list<std::shared_ptr<ForwardQueueEntry>> m_forward_queue;
+    std::list<std::thread> m_worker_threads;
+
+    void batch_worker();
+};
+
+#endif
@@ -0,0 +1,526 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstring>
+
+#include "CPUWinograd.h"
+#include "Network.h"
+
+using CPUFeatures::Isa;
+using CPUFeatures::is_supported;
+
+// The SIMD kernels are written with GCC vector extensions.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WINOGRAD_SIMD
+#define WINOGRAD_INLINE inline __attribute__((always_inline))
+#else
+#define WINOGRAD_INLINE inline
+#endif
+
+// multiple vector [i0..i5] by Bt and produce [o0..o5]
+// const auto Bt = std::array<float, WINOGRAD_TILE>
+//           {1.0f,  0.0f,     -5.0f/2.0f,  0.0f,      1.0f, 0.0f,
+//            0.0f, -SQ2,      -2.0f,       SQ2/2.0f,  1.0f, 0.0f,
+//            0.0f,  SQ2,      -2.0f,      -SQ2/2.0f,  1.0f, 0.0f,
+//            0.0f, -SQ2/2.0f, -1.0f/2.0f,  SQ2,       1.0f, 0.0f,
+//            0.0f,  SQ2/2.0f, -1.0f/2.0f, -SQ2,       1.0f, 0.0f,
+//            0.0f,  1.0f,      0.0f,      -5.0f/2.0f, 0.0f, 1.0f};
+template <typename T>
+WINOGRAD_INLINE void multiply_bt(
+    T & o0, T & o1, T & o2, T & o3, T & o4, T & o5,
+    const T& i0, const T& i1, const T& i2,
+    const T& i3, const T& i4, const T& i5
+) {
+    auto i3m1 = i1 * -SQ2 + i3 * (SQ2 / 2.0f);
+    auto i4m2 = i2 * -2.0f + i4 * 1.0f;
+
+    o0 = i0 + i2 * (-5.0f/2.0f) + i4;
+    o1 = i3m1 + i4m2;
+    o2 = -i3m1 + i4m2;
+
+    auto i3m1_2 = i3 * (SQ2) + i1 * (-SQ2/2.0f);
+    auto i4m2_2 = i2 * (-1.0f/2.0f) + i4;
+
+    o3 = i3m1_2 + i4m2_2;
+    o4 = -i3m1_2 + i4m2_2;
+
+    o5 = i1 + i3 * (-5.0f/2.0f) + i5;
+}
+
+// multiple vector [i0..i5] by At and produce [o0..o3]
+// const auto At = std::array<float, WINOGRAD_ALPHA * WINOGRAD_M>
+//       {1.0f, 1.0f,      1.0f,       1.0f,      1.0f,     0.0f,
+//        0.0f, SQ2/2.0f, -SQ2/2.0f,   SQ2,      -SQ2,      0.0f,
+//        0.0f, 1.0f/2.0f, 1.0f/2.0f,  2.0f,      2.0f,     0.0f,
+//        0.0f, SQ2/4.0f, -SQ2/4.0f,   2.0f*SQ2, -2.0f*SQ2, 1.0f};
+template <typename T>
+WINOGRAD_INLINE void multiply_at(
+    T & o0, T & o1, T & o2, T & o3,
+    const T& i0, const T& i1, const T& i2,
+    const T& i3, const T& i4, const T& i5
+) {
+    auto t1p2 = (i1 + i2) * (1.0f / 2.0f);
+    auto t1m2 = (i1 - i2) * (SQ2/4.0f);
+    auto t3p4 = i3 + i4;
+    auto t3m4 = (i3 - i4) * (SQ2);
+
+    o0 = i0 + t1p2 + t1p2 + t3p4;
+    o1 = t1m2 + t1m2 + t3m4;
+    o2 = t1p2 + t3p4 + t3p4;
+    o3 = t1m2 + t3m4 + t3m4 + i5;
+}
+
+static void transform_in_scalar(const float* const in,
+                                float* const V,
+                                const int C, const int batch_size,
+                                const int c_begin, const int c_end) {
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = WINOGRAD_WTILES;
+    constexpr auto P = WINOGRAD_P;
+
+    // Tiles of all positions in the batch are laid out next to each other,
+    // so the GEMM sees a single P * batch_size wide matrix per channel.
+    const auto Pb = P * batch_size;
+
+    constexpr auto Wpad = 2 + WINOGRAD_M * WTILES;
+
+    constexpr auto buffersize = 32;
+
+    std::array<std::array<float, Wpad>, Wpad> in_pad{0.0f};
+
+    std::array<float, buffersize * WINOGRAD_ALPHA * WINOGRAD_ALPHA> buffer;
+    auto buffer_offset = 0;
+    auto buffer_entries = 0;
+
+    for (auto ch = c_begin; ch < c_end; ch++) {
+        for (auto batch = 0; batch < batch_size; batch++) {
+            for (auto yin = 0; yin < H; yin++) {
+                for (auto xin = 0; xin < W; xin++) {
+                    in_pad[yin + 1][xin + 1] =
+                        in[(batch*C + ch)*(W*H) + yin*W + xin];
+                }
+            }
+            for (auto block_y = 0; block_y < WTILES; block_y++) {
+                // Tiles overlap by 2
+                const auto yin = WINOGRAD_M * block_y;
+                for (auto block_x = 0; block_x < WTILES; block_x++) {
+                    const auto xin = WINOGRAD_M * block_x;
+#define DECL_T1(XX) \
+                    float T1_##XX##_0, T1_##XX##_1, T1_##XX##_2, T1_##XX##_3, T1_##XX##_4, T1_##XX##_5;
+                    DECL_T1(0)
+                    DECL_T1(1)
+                    DECL_T1(2)
+                    DECL_T1(3)
+                    DECL_T1(4)
+                    DECL_T1(5)
+
+                    // Calculates transpose(B).x.B
+#define MULTIPLY_BT(XX) \
+                    multiply_bt( \
+                        T1_0_##XX, T1_1_##XX, T1_2_##XX, T1_3_##XX, T1_4_##XX, T1_5_##XX, \
+                        in_pad[yin + 0][xin + XX], \
+                        in_pad[yin + 1][xin + XX], \
+                        in_pad[yin + 2][xin + XX], \
+                        in_pad[yin + 3][xin + XX], \
+                        in_pad[yin + 4][xin + XX], \
+                        in_pad[yin + 5][xin + XX] \
+                    );
+                    MULTIPLY_BT(0)
+                    MULTIPLY_BT(1)
+                    MULTIPLY_BT(2)
+                    MULTIPLY_BT(3)
+                    MULTIPLY_BT(4)
+                    MULTIPLY_BT(5)
+
+#define MULTIPLY_B(XX) \
+                    multiply_bt( \
+                        buffer[buffersize * (XX * WINOGRAD_ALPHA + 0) + buffer_entries], \
+                        buffer[buffersize * (XX * WINOGRAD_ALPHA + 1) + buffer_entries], \
+                        buffer[buffersize * (XX * WINOGRAD_ALPHA + 2) + buffer_entries], \
+                        buffer[buffersize * (XX * WINOGRAD_ALPHA + 3) + buffer_entries], \
+                        buffer[buffersize * (XX * WINOGRAD_ALPHA + 4) + buffer_entries], \
+                        buffer[buffersize * (XX * WINOGRAD_ALPHA + 5) + buffer_entries], \
+                        T1_##XX##_0, T1_##XX##_1, T1_##XX##_2, T1_##XX##_3, T1_##XX##_4, T1_##XX##_5 \
+                    );
+                    MULTIPLY_B(0)
+                    MULTIPLY_B(1)
+                    MULTIPLY_B(2)
+                    MULTIPLY_B(3)
+                    MULTIPLY_B(4)
+                    MULTIPLY_B(5)
+
+                    if (buffer_entries == 0) {
+                        buffer_offset = ch * Pb + batch * P
+                                        + block_y * WTILES + block_x;
+                    }
+                    buffer_entries++;
+
+                    if (buffer_entries >= buffersize ||
+                        (ch == c_end - 1 && batch == batch_size - 1
+                         && block_x == WTILES - 1 && block_y == WTILES - 1)) {
+
+                        for (auto i = 0; i < WINOGRAD_ALPHA * WINOGRAD_ALPHA; i++) {
+                            for (auto entry = 0; entry < buffer_entries; entry++) {
+                                V[i*C*Pb + buffer_offset + entry] = buffer[i*buffersize + entry];
+                            }
+                        }
+                        buffer_entries = 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void transform_out_scalar(const float* const M,
+                                 float* const Y,
+                                 const int K, const int batch_size,
+                                 const int k_begin, const int k_end,
+                                 const float* const means,
+                                 const float* const stddevs,
+                                 const float* const eltwise) {
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = WINOGRAD_WTILES;
+    constexpr auto P = WINOGRAD_P;
+    const auto Pb = P * batch_size;
+
+    for (auto batch = 0; batch < batch_size; batch++) {
+        for (auto k = k_begin; k < k_end; k++) {
+            const auto mean = means[k];
+            const auto scale_stddev = stddevs[k];
+            for (auto block_x = 0; block_x < WTILES; block_x++) {
+                const auto x = WINOGRAD_M * block_x;
+                for (auto block_y = 0; block_y < WTILES; block_y++) {
+                    const auto y = WINOGRAD_M * block_y;
+
+                    const auto b = batch * P + block_y * WTILES + block_x;
+                    using WinogradTile =
+                        std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
+                    WinogradTile temp_m;
+                    for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
+                        for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
+                            temp_m[xi][nu] =
+                                M[(xi*WINOGRAD_ALPHA + nu)*K*Pb + k*Pb + b];
+                        }
+                    }
+                    std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_M> temp;
+                    std::array<std::array<float, WINOGRAD_M>, WINOGRAD_M> o;
+
+                    // Calculates transpose(A).temp_m.A
+                    for (auto j = 0; j < WINOGRAD_ALPHA; j++){
+                        multiply_at(
+                            temp[0][j], temp[1][j], temp[2][j], temp[3][j],
+                            temp_m[0][j], temp_m[1][j], temp_m[2][j], temp_m[3][j], temp_m[4][j], temp_m[5][j]
+                        );
+                    }
+
+                    for (auto i = 0; i < WINOGRAD_M; i++){
+                        multiply_at(
+                            o[i][0], o[i][1], o[i][2], o[i][3],
+                            temp[i][0], temp[i][1], temp[i][2], temp[i][3], temp[i][4], temp[i][5]
+                        );
+                    }
+
+                    const auto y_ind = (batch * K + k) * H * W + y * W + x;
+                    for (auto i = 0; i < WINOGRAD_M; i++) {
+                        for (auto j = 0; j < WINOGRAD_M; j++) {
+                            if (y + i < H && x + j < W) {
+                                const auto idx = y_ind + i * W + j;
+                                auto val = scale_stddev * (o[i][j] - mean);
+                                if (eltwise != nullptr) {
+                                    val += eltwise[idx];
+                                }
+                                Y[idx] = val > 0.0f ? val : 0.0f;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+#ifdef WINOGRAD_SIMD
+typedef float vec8_t __attribute__((vector_size(32)));
+typedef float vec16_t __attribute__((vector_size(64)));
+
+// Transforms one vector worth of channels at a time.  The input planes are
+// interleaved so that each pixel of in_pad holds one value per channel,
+// which turns the tile arithmetic into plain vector operations.  The tiles
+// of a whole plane are kept so they can be stored to V as contiguous runs.
+template <typename vec_t>
+WINOGRAD_INLINE void transform_in_simd(const float* const in,
+                                       float* const V,
+                                       const int C, const int batch_size,
+                                       const int c_begin, const int c_end) {
+    constexpr auto lanes = int{sizeof(vec_t) / sizeof(float)};
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = WINOGRAD_WTILES;
+    constexpr auto P = WINOGRAD_P;
+    constexpr auto Wpad = 2 + WINOGRAD_M * WTILES;
+    const auto Pb = P * batch_size;
+
+    vec_t in_pad[Wpad][Wpad];
+    vec_t out[P][WINOGRAD_TILE];
+    std::memset(in_pad, 0, sizeof(in_pad));
+
+    for (auto batch = 0; batch < batch_size; batch++) {
+        for (auto c0 = c_begin; c0 < c_end; c0 += lanes) {
+            const auto valid = std::min(lanes, c_end - c0);
+            if (valid < lanes) {
+                std::memset(in_pad, 0, sizeof(in_pad));
+            }
+            for (auto lane = 0; lane < valid; lane++) {
+                const auto plane = &in[(batch*C + c0 + lane) * (W*H)];
+                for (auto yin = 0; yin < H; yin++) {
+                    for (auto xin = 0; xin < W; xin++) {
+                        in_pad[yin + 1][xin + 1][lane] = plane[yin*W + xin];
+                    }
+                }
+            }
+            for (auto block_y = 0; block_y < WTILES; block_y++) {
+                // Tiles overlap by 2
+                const auto yin = WINOGRAD_M * block_y;
+                for (auto block_x = 0; block_x < WTILES; block_x++) {
+                    const auto xin = WINOGRAD_M * block_x;
+                    vec_t T1[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+
+                    // Calculates transpose(B).x.B
+                    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                        multiply_bt(
+                            T1[0][j], T1[1][j], T1[2][j], T1[3][j], T1[4][j], T1[5][j],
+                            in_pad[yin + 0][xin + j], in_pad[yin + 1][xin + j],
+                            in_pad[yin + 2][xin + j], in_pad[yin + 3][xin + j],
+                            in_pad[yin + 4][xin + j], in_pad[yin + 5][xin + j]
+                        );
+                    }
+                    const auto o = out[block_y * WTILES + block_x];
+                    for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+                        const auto row = i * WINOGRAD_ALPHA;
+                        multiply_bt(
+                            o[row + 0], o[row + 1], o[row + 2],
+                            o[row + 3], o[row + 4], o[row + 5],
+                            T1[i][0], T1[i][1], T1[i][2], T1[i][3], T1[i][4], T1[i][5]
+                        );
+                    }
+                }
+            }
+            for (auto i = 0; i < WINOGRAD_TILE; i++) {
+                for (auto lane = 0; lane < valid; lane++) {
+                    const auto dst = &V[i*C*Pb + (c0 + lane)*Pb + batch*P];
+                    for (auto tile = 0; tile < P; tile++) {
+                        dst[tile] = out[tile][i][lane];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Transforms one vector worth of tiles of an output plane at a time.  The
+// tiles of a plane are contiguous in M.  The last vector is shifted back to
+// overlap the previous one rather than being partially filled, and the
+// results go to a padded plane first, so the partial tiles at the board
+// edge need no bounds checks.  The batchnorm scaling is applied to the
+// tiles in registers, the residual add and ReLU when copying the plane out.
+template <typename vec_t>
+WINOGRAD_INLINE void transform_out_simd(const float* const M,
+                                        float* const Y,
+                                        const int K, const int batch_size,
+                                        const int k_begin, const int k_end,
+                                        const float* const means,
+                                        const float* const stddevs,
+                                        const float* const eltwise) {
+    constexpr auto lanes = int{sizeof(vec_t) / sizeof(float)};
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = WINOGRAD_WTILES;
+    constexpr auto P = WINOGRAD_P;
+    constexpr auto Wout = WINOGRAD_M * WTILES;
+    const auto Pb = P * batch_size;
+    static_assert(P >= lanes, "A plane must hold at least one full vector");
+
+    float out_pad[Wout][Wout];
+
+    for (auto batch = 0; batch < batch_size; batch++) {
+        for (auto k = k_begin; k < k_end; k++) {
+            const auto mean = means[k];
+            const auto scale_stddev = stddevs[k];
+            for (auto next = 0; next < P; next += lanes) {
+                const auto t0 = std::min(next, P - lanes);
+                vec_t temp_m[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+                for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
+                    for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
+                        const auto src =
+                            &M[(xi*WINOGRAD_ALPHA + nu)*K*Pb + k*Pb + batch*P + t0];
+                        std::memcpy(&temp_m[xi][nu], src, sizeof(vec_t));
+                    }
+                }
+                vec_t temp[WINOGRAD_M][WINOGRAD_ALPHA];
+                vec_t o[WINOGRAD_M][WINOGRAD_M];
+
+                // Calculates transpose(A).temp_m.A
+                for (auto j = 0; j < WINOGRAD_ALPHA; j++){
+                    multiply_at(
+                        temp[0][j], temp[1][j], temp[2][j], temp[3][j],
+                        temp_m[0][j], temp_m[1][j], temp_m[2][j], temp_m[3][j], temp_m[4][j], temp_m[5][j]
+                    );
+                }
+
+                for (auto i = 0; i < WINOGRAD_M; i++){
+                    multiply_at(
+                        o[i][0], o[i][1], o[i][2], o[i][3],
+                        temp[i][0], temp[i][1], temp[i][2], temp[i][3], temp[i][4], temp[i][5]
+                    );
+                    for (auto j = 0; j < WINOGRAD_M; j++) {
+                        o[i][j] = scale_stddev * (o[i][j] - mean);
+                    }
+                }
+
+                float o_lanes[WINOGRAD_M][WINOGRAD_M][lanes];
+                std::memcpy(o_lanes, o, sizeof(o));
+                for (auto lane = 0; lane < lanes; lane++) {
+                    const auto y = WINOGRAD_M * ((t0 + lane) / WTILES);
+                    const auto x = WINOGRAD_M * ((t0 + lane) % WTILES);
+                    for (auto i = 0; i < WINOGRAD_M; i++) {
+                        for (auto j = 0; j < WINOGRAD_M; j++) {
+                            out_pad[y + i][x + j] = o_lanes[i][j][lane];
+                        }
+                    }
+                }
+            }
+            const auto plane_offset = (batch * K + k) * H * W;
+            const auto plane = &Y[plane_offset];
+            for (auto y = 0; y < H; y++) {
+                const auto row = &plane[y * W];
+                if (eltwise != nullptr) {
+                    const auto res = &eltwise[plane_offset + y * W];
+                    for (auto x = 0; x < W; x++) {
+                        const auto val = out_pad[y][x] + res[x];
+                        row[x] = val > 0.0f ? val : 0.0f;
+                    }
+                } else {
+                    for (auto x = 0; x < W; x++) {
+                        const auto val = out_pad[y][x];
+                        row[x] = val > 0.0f ? val : 0.0f;
+                    }
+                }
+            }
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void transform_in_avx2(const float* in, float* V,
+                              int C, int batch_size, int c_begin, int c_end) {
+    transform_in_simd<vec8_t>(in, V, C, batch_size, c_begin, c_end);
+}
+
+__attribute__((target("avx2,fma")))
+static void transform_out_avx2(const float* M, float* Y,
+                               int K, int batch_size, int k_begin, int k_end,
+                               const float* means, const float* stddevs,
+                               const float* eltwise) {
+    transform_out_simd<vec8_t>(M, Y, K, batch_size, k_begin, k_end,
+                                means, stddevs, eltwise);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void transform_in_avx512(const float* in, float* V,
+                                int C, int batch_size, int c_begin, int c_end) {
+    transform_in_simd<vec16_t>(in, V, C, batch_size, c_begin, c_end);
+}
+
+__attribute__((target("avx512f,avx2,fma")))
+static void transform_out_avx512(const float* M, float* Y,
+                                 int K, int batch_size, int k_begin, int k_end,
+                                 const float* means, const float* stddevs,
+                                 const float* eltwise) {
+    transform_out_simd<vec16_t>(M, Y, K, batch_size, k_begin, k_end,
+                                means, stddevs, eltwise);
+}
+#endif
+
+void CPUWinograd::transform_in(const Isa isa,
+                               const float* const in,
+                               float* const V,
+                               const int C, const int batch_size,
+                               const int c_begin, const int c_end) {
+    assert(is_supported(isa));
+    assert(0 <= c_begin && c_begin <= c_end && c_end <= C);
+    switch (isa) {
+#ifdef WINOGRAD_SIMD
+        case Isa::AVX512:
+            transform_in_avx512(in, V, C, batch_size, c_begin, c_end);
+            break;
+        case Isa::AVX2:
+            transform_in_avx2(in, V, C, batch_size, c_begin, c_end);
+            break;
+#endif
+        default:
+            transform_in_scalar(in, V, C, batch_size, c_begin, c_end);
+            break;
+    }
+}
+
+void CPUWinograd::transform_out(const Isa isa,
+                                const float* const M,
+                                float* const Y,
+                                const int K, const int batch_size,
+                                const int k_begin, const int k_end,
+                                const float* const means,
+                                const float* const stddevs,
+                                const float* const eltwise) {
+    assert(is_supported(isa));
+    assert(0 <= k_begin && k_begin <= k_end && k_end <= K);
+    switch (isa) {
+#ifdef WINOGRAD_SIMD
+        case Isa::AVX512:
+            transform_out_avx512(M, Y, K, batch_size, k_begin, k_end,
+                                 means, stddevs, eltwise);
+            break;
+        case Isa::AVX2:
+            transform_out_avx2(M, Y, K, batch_size, k_begin, k_end,
+                               means, stddevs, eltwise);
+            break;
+#endif
+        default:
+            transform_out_scalar(M, Y, K, batch_size, k_begin, k_end,
+                                 means, stddevs, eltwise);
+            break;
+    }
+}
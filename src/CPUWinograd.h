@@ -0,0 +1,61 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef CPUWINOGRAD_H_INCLUDED
+#define CPUWINOGRAD_H_INCLUDED
+
+#include "config.h"
+
+#include "CPUFeatures.h"
+
+// Winograd input and output transforms for the CPU pipe.  V and M are
+// laid out as [WINOGRAD_TILE][channels][WINOGRAD_P * batch_size], the
+// input and output planes as [batch_size][channels][NUM_INTERSECTIONS].
+namespace CPUWinograd {
+    // Both transforms only touch the channels in [begin, end), so
+    // disjoint channel ranges can be transformed concurrently.
+    void transform_in(const CPUFeatures::Isa isa,
+                      const float* const in,
+                      float* const V,
+                      const int C, const int batch_size,
+                      const int c_begin, const int c_end);
+    // Output transform fused with the batchnorm, the optional residual
+    // add (eltwise, laid out like Y) and the ReLU that follow every 3x3
+    // convolution in the tower.
+    void transform_out(const CPUFeatures::Isa isa,
+                       const float* const M,
+                       float* const Y,
+                       const int K, const int batch_size,
+                       const int k_begin, const int k_end,
+                       const float* const means,
+                       const float* const stddevs,
+                       const float* const eltwise = nullptr);
+}
+
+#endif
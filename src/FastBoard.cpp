@@ -87,6 +87,22 @@ std::pair<int, int> FastBoard::get_xy(int vertex) const {
     return std::make_pair(x, y);
 }
 
+const FastBoard::plane_t& FastBoard::get_plane(int color) const {
+    assert(color == BLACK || color == WHITE);
+    return m_planes[color];
+}
+
+void FastBoard::set_plane(const int color, const int i, const bool stone) {
+    const auto xy = get_xy(i);
+    const auto idx = xy.second * BOARD_SIZE + xy.first;
+    const auto bit = std::uint64_t{1} << (idx % 64);
+    if (stone) {
+        m_planes[color][idx / 64] |= bit;
+    } else {
+        m_planes[color][idx / 64] &= ~bit;
+    }
+}
+
 FastBoard::vertex_t FastBoard::get_state(int vertex) const {
     assert(vertex >= 0 && vertex < NUM_VERTICES);
     assert(vertex >= 0 && vertex < m_numvertices);
@@ -99,7 +115,13 @@ void FastBoard::set_state(int vertex, FastBoard::vertex_t content) {
     assert(vertex >= 0 && vertex < m_numvertices);
     assert(content >= BLACK && content <= INVAL);
 
+    if (m_state[vertex] == BLACK || m_state[vertex] == WHITE) {
+        set_plane(m_state[vertex], vertex, false);
+    }
     m_state[vertex] = content;
+    if (content == BLACK || content == WHITE) {
+        set_plane(content, vertex, true);
+    }
 }
 
 FastBoard::vertex_t FastBoard::get_state(int x, int y) const {
@@ -118,6 +140,8 @@ void FastBoard::reset_board(int size) {
     m_prisoners[BLACK] = 0;
     m_prisoners[WHITE] = 0;
     m_empty_cnt = 0;
+    m_planes[BLACK].fill(0);
+    m_planes[WHITE].fill(0);
 
     m_dirs[0] = -m_sidevertices;
     m_dirs[1] = +1;
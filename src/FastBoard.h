@@ -33,6 +33,7 @@
 #include "config.h"
 
 #include <array>
+#include <cstdint>
 #include <queue>
 #include <string>
 #include <utility>
@@ -73,6 +74,12 @@ public:
         BLACK = 0, WHITE = 1, EMPTY = 2, INVAL = 3
     };
 
+    /*
+        stones of one color as a bit per intersection, in the row major
+        order of the network input planes
+    */
+    using plane_t = std::array<std::uint64_t, (NUM_INTERSECTIONS + 63) / 64>;
+
     int get_boardsize() const;
     vertex_t get_state(int x, int y) const;
     vertex_t get_state(int vertex) const ;
@@ -80,6 +87,7 @@ public:
     void set_state(int x, int y, vertex_t content);
     void set_state(int vertex, vertex_t content);
     std::pair<int, int> get_xy(int vertex) const;
+    const plane_t& get_plane(int color) const;
 
     bool is_suicide(int i, int color) const;
     int count_pliberties(const int i) const;
@@ -123,6 +131,7 @@ protected:
     std::array<unsigned short, NUM_VERTICES>   m_empty;      /* empty intersections */
     std::array<unsigned short, NUM_VERTICES>   m_empty_idx;  /* intersection indices */
     int m_empty_cnt;                                         /* count of empties */
+    std::array<plane_t, 2>                     m_planes;     /* stones per color */
 
     int m_tomove;
     int m_numvertices;
@@ -136,6 +145,7 @@ protected:
     void merge_strings(const int ip, const int aip);
     void add_neighbour(const int i, const int color);
     void remove_neighbour(const int i, const int color);
+    void set_plane(const int color, const int i, const bool stone);
     void print_columns();
 };
 
@@ -87,30 +87,30 @@ void FastState::play_move(int vertex) {
 }
 
 void FastState::play_move(int color, int vertex) {
-    board.m_hash ^= Zobrist::zobrist_ko[m_komove];
+    board.hash_ko_move(m_komove);
     if (vertex == FastBoard::PASS) {
         // No Ko move
         m_komove = FastBoard::NO_VERTEX;
     } else {
         m_komove = board.update_board(color, vertex);
     }
-    board.m_hash ^= Zobrist::zobrist_ko[m_komove];
+    board.hash_ko_move(m_komove);
 
     m_lastmove = vertex;
     m_movenum++;
 
     if (board.m_tomove == color) {
-        board.m_hash ^= Zobrist::zobrist_blacktomove;
+        board.hash_xor(Zobrist::zobrist_blacktomove);
     }
     board.m_tomove = !color;
 
-    board.m_hash ^= Zobrist::zobrist_pass[get_passes()];
+    board.hash_xor(Zobrist::zobrist_pass[get_passes()]);
     if (vertex == FastBoard::PASS) {
         increment_passes();
     } else {
         set_passes(0);
     }
-    board.m_hash ^= Zobrist::zobrist_pass[get_passes()];
+    board.hash_xor(Zobrist::zobrist_pass[get_passes()]);
 }
 
 size_t FastState::get_movenum() const {
@@ -175,7 +175,3 @@ void FastState::set_handicap(int hcap) {
 int FastState::get_handicap() const {
     return m_handicap;
 }
-
-std::uint64_t FastState::get_symmetry_hash(int symmetry) const {
-    return board.calc_symmetry_hash(m_komove, symmetry);
-}
@@ -57,7 +57,6 @@ public:
     void increment_passes();
 
     float final_score() const;
-    std::uint64_t get_symmetry_hash(int symmetry) const;
 
     size_t get_movenum() const;
     int get_last_move() const;
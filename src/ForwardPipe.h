@@ -30,7 +30,9 @@
 #ifndef FORWARDPIPE_H_INCLUDED
 #define FORWARDPIPE_H_INCLUDED
 
+#include <algorithm>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "config.h"
@@ -51,6 +53,10 @@ public:
 
         std::vector<float> m_conv_val_w;
         std::vector<float> m_conv_val_b;
+
+        // If not empty, backends may share what they make of these
+        // weights with other processes under names starting with this.
+        std::string m_shared_name;
     };
 
     virtual ~ForwardPipe() = default;
@@ -60,10 +66,36 @@ public:
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val) = 0;
+    // Evaluate batch_size positions stored back to back in input.
+    // Backends that can should run them as one batch; the default runs
+    // them one after another.
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const int batch_size);
     virtual void push_weights(unsigned int filter_size,
                               unsigned int channels,
                               unsigned int outputs,
                               std::shared_ptr<const ForwardPipeWeights> weights) = 0;
 };
 
+inline void ForwardPipe::forward_batch(const std::vector<float>& input,
+                                       std::vector<float>& output_pol,
+                                       std::vector<float>& output_val,
+                                       const int batch_size) {
+    const auto in_size = input.size() / batch_size;
+    const auto pol_size = output_pol.size() / batch_size;
+    const auto val_size = output_val.size() / batch_size;
+    auto in = std::vector<float>(in_size);
+    auto pol = std::vector<float>(pol_size);
+    auto val = std::vector<float>(val_size);
+    for (auto i = 0; i < batch_size; i++) {
+        std::copy(begin(input) + i * in_size, begin(input) + (i + 1) * in_size,
+                  begin(in));
+        forward(in, pol, val);
+        std::copy(begin(pol), end(pol), begin(output_pol) + i * pol_size);
+        std::copy(begin(val), end(val), begin(output_val) + i * val_size);
+    }
+}
+
 #endif
@@ -29,6 +29,7 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <array>
 #include <cassert>
 
@@ -39,17 +40,75 @@
 
 using namespace Utils;
 
+const int FullBoard::NUM_SYMMETRIES;
+
+namespace {
+    using SymmetryVertices =
+        std::array<std::array<std::uint16_t, FastBoard::NUM_VERTICES>,
+                   FullBoard::NUM_SYMMETRIES>;
+
+    // Symmetry s of every vertex of a size x size board.  Vertices off
+    // the board, like NO_VERTEX, map to themselves.
+    const SymmetryVertices& symmetry_vertices(const int size) {
+        static const auto tables = []() {
+            auto tables = std::array<SymmetryVertices, BOARD_SIZE + 1>{};
+            for (auto size = 1; size <= BOARD_SIZE; size++) {
+                const auto side = size + 2;
+                for (auto& table : tables[size]) {
+                    for (auto vertex = 0; vertex < FastBoard::NUM_VERTICES;
+                         vertex++) {
+                        table[vertex] = vertex;
+                    }
+                }
+                for (auto s = 0; s < FullBoard::NUM_SYMMETRIES; s++) {
+                    for (auto y = 0; y < size; y++) {
+                        for (auto x = 0; x < size; x++) {
+                            const auto sym = Network::get_symmetry({x, y},
+                                                                   s, size);
+                            tables[size][s][(y + 1) * side + x + 1] =
+                                (sym.second + 1) * side + sym.first + 1;
+                        }
+                    }
+                }
+            }
+            return tables;
+        }();
+        return tables[size];
+    }
+}
+
+void FullBoard::hash_stone(int color, int vertex) {
+    const auto& symmetry = symmetry_vertices(m_boardsize);
+    for (auto s = 0; s < NUM_SYMMETRIES; s++) {
+        m_hashes[s] ^= Zobrist::zobrist[color][symmetry[s][vertex]];
+    }
+}
+
+void FullBoard::hash_xor(std::uint64_t key) {
+    for (auto& hash : m_hashes) {
+        hash ^= key;
+    }
+}
+
+void FullBoard::hash_ko_move(int komove) {
+    const auto& symmetry = symmetry_vertices(m_boardsize);
+    for (auto s = 0; s < NUM_SYMMETRIES; s++) {
+        m_hashes[s] ^= Zobrist::zobrist_ko[symmetry[s][komove]];
+    }
+}
+
 int FullBoard::remove_string(int i) {
     int pos = i;
     int removed = 0;
     int color = m_state[i];
 
     do {
-        m_hash    ^= Zobrist::zobrist[m_state[pos]][pos];
+        hash_stone(m_state[pos], pos);
         m_ko_hash ^= Zobrist::zobrist[m_state[pos]][pos];
 
         m_state[pos] = EMPTY;
         m_parent[pos] = NUM_VERTICES;
+        set_plane(color, pos, false);
 
         remove_neighbour(pos, color);
 
@@ -57,7 +116,7 @@ int FullBoard::remove_string(int i) {
         m_empty[m_empty_cnt]  = pos;
         m_empty_cnt++;
 
-        m_hash    ^= Zobrist::zobrist[m_state[pos]][pos];
+        hash_stone(m_state[pos], pos);
         m_ko_hash ^= Zobrist::zobrist[m_state[pos]][pos];
 
         removed++;
@@ -108,18 +167,24 @@ std::uint64_t FullBoard::calc_hash(int komove) const {
 }
 
 std::uint64_t FullBoard::calc_symmetry_hash(int komove, int symmetry) const {
-    return calc_hash(komove, [this, symmetry](const auto vertex) {
-        if (vertex == NO_VERTEX) {
-            return NO_VERTEX;
-        } else {
-            const auto newvtx = Network::get_symmetry(get_xy(vertex), symmetry, m_boardsize);
-            return get_vertex(newvtx.first, newvtx.second);
-        }
+    const auto& table = symmetry_vertices(m_boardsize)[symmetry];
+    return calc_hash(komove, [&table](const auto vertex) {
+        return int(table[vertex]);
     });
 }
 
 std::uint64_t FullBoard::get_hash() const {
-    return m_hash;
+    return m_hashes[0];
+}
+
+std::uint64_t FullBoard::get_symmetry_hash(int symmetry) const {
+    return m_hashes[symmetry];
+}
+
+std::uint64_t FullBoard::get_canonical_hash(int& symmetry) const {
+    symmetry = std::min_element(begin(m_hashes), end(m_hashes))
+               - begin(m_hashes);
+    return m_hashes[symmetry];
 }
 
 std::uint64_t FullBoard::get_ko_hash() const {
@@ -128,7 +193,7 @@ std::uint64_t FullBoard::get_ko_hash() const {
 
 void FullBoard::set_to_move(int tomove) {
     if (m_tomove != tomove) {
-        m_hash ^= Zobrist::zobrist_blacktomove;
+        hash_xor(Zobrist::zobrist_blacktomove);
     }
     FastBoard::set_to_move(tomove);
 }
@@ -137,16 +202,17 @@ int FullBoard::update_board(const int color, const int i) {
     assert(i != FastBoard::PASS);
     assert(m_state[i] == EMPTY);
 
-    m_hash ^= Zobrist::zobrist[m_state[i]][i];
+    hash_stone(m_state[i], i);
     m_ko_hash ^= Zobrist::zobrist[m_state[i]][i];
 
     m_state[i] = vertex_t(color);
+    set_plane(color, i, true);
     m_next[i] = i;
     m_parent[i] = i;
     m_libs[i] = count_pliberties(i);
     m_stones[i] = 1;
 
-    m_hash ^= Zobrist::zobrist[m_state[i]][i];
+    hash_stone(m_state[i], i);
     m_ko_hash ^= Zobrist::zobrist[m_state[i]][i];
 
     /* update neighbor liberties (they all lose 1) */
@@ -181,9 +247,9 @@ int FullBoard::update_board(const int color, const int i) {
         }
     }
 
-    m_hash ^= Zobrist::zobrist_pris[color][m_prisoners[color]];
+    hash_xor(Zobrist::zobrist_pris[color][m_prisoners[color]]);
     m_prisoners[color] += captured_stones;
-    m_hash ^= Zobrist::zobrist_pris[color][m_prisoners[color]];
+    hash_xor(Zobrist::zobrist_pris[color][m_prisoners[color]]);
 
     /* move last vertex in list to our position */
     auto lastvertex = m_empty[--m_empty_cnt];
@@ -216,6 +282,8 @@ void FullBoard::display_board(int lastmove) {
 void FullBoard::reset_board(int size) {
     FastBoard::reset_board(size);
 
-    m_hash = calc_hash();
+    for (auto s = 0; s < NUM_SYMMETRIES; s++) {
+        m_hashes[s] = calc_symmetry_hash(NO_VERTEX, s);
+    }
     m_ko_hash = calc_ko_hash();
 }
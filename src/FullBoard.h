@@ -31,17 +31,31 @@
 #define FULLBOARD_H_INCLUDED
 
 #include "config.h"
+#include <array>
 #include <cstdint>
 #include "FastBoard.h"
 
 class FullBoard : public FastBoard {
 public:
+    // Of the square board, numbered as in Network::get_symmetry.
+    static constexpr auto NUM_SYMMETRIES = 8;
+
     int remove_string(int i);
     int update_board(const int color, const int i);
 
     std::uint64_t get_hash() const;
+    // Hash of symmetry s of the position, kept up to date along with
+    // get_hash(), which is that of symmetry 0.
+    std::uint64_t get_symmetry_hash(int symmetry) const;
+    // The smallest of the symmetric hashes, which is the same for all
+    // symmetric positions, and the symmetry it belongs to.
+    std::uint64_t get_canonical_hash(int& symmetry) const;
     std::uint64_t get_ko_hash() const;
     void set_to_move(int tomove);
+    // Toggle a key that doesn't depend on the orientation of the board
+    // in all the hashes.
+    void hash_xor(std::uint64_t key);
+    void hash_ko_move(int komove);
 
     void reset_board(int size);
     void display_board(int lastmove = -1);
@@ -50,12 +64,13 @@ public:
     std::uint64_t calc_symmetry_hash(int komove, int symmetry) const;
     std::uint64_t calc_ko_hash() const;
 
-    std::uint64_t m_hash;
+    std::array<std::uint64_t, NUM_SYMMETRIES> m_hashes;
     std::uint64_t m_ko_hash;
 
 private:
     template<class Function>
     std::uint64_t calc_hash(int komove, Function transform) const;
+    void hash_stone(int color, int vertex);
 };
 
 #endif
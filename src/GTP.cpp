@@ -42,6 +42,7 @@
 #include <string>
 #include <vector>
 #include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
 
 #include "GTP.h"
 #include "FastBoard.h"
@@ -51,6 +52,7 @@
 #include "SGFTree.h"
 #include "SMP.h"
 #include "Training.h"
+#include "UCTNodeArena.h"
 #include "UCTSearch.h"
 #include "Utils.h"
 
@@ -61,6 +63,7 @@ bool cfg_gtp_mode;
 bool cfg_allow_pondering;
 unsigned int cfg_num_threads;
 unsigned int cfg_batch_size;
+unsigned int cfg_eval_threads;
 int cfg_max_playouts;
 int cfg_max_visits;
 size_t cfg_max_memory;
@@ -75,14 +78,22 @@ int cfg_random_min_visits;
 float cfg_random_temp;
 std::uint64_t cfg_rng_seed;
 bool cfg_dumbpass;
+bool cfg_root_average;
+bool cfg_transpositions;
 #ifdef USE_OPENCL
 std::vector<int> cfg_gpus;
 bool cfg_sgemm_exhaustive;
 bool cfg_tune_only;
-#ifdef USE_HALF
-precision_t cfg_precision;
-#endif
 #endif
+precision_t cfg_precision;
+std::string cfg_int8_table;
+std::string cfg_int8_calibrate;
+std::string cfg_convert_weights;
+bool cfg_weights_cache;
+bool cfg_shared_weights;
+std::string cfg_nncache_file;
+bool cfg_nncache_shared;
+NNCache::Storage cfg_nncache_storage;
 float cfg_puct;
 float cfg_logpuct;
 float cfg_logconst;
@@ -311,6 +322,17 @@ void GTP::initialize(std::unique_ptr<Network>&& net) {
         throw std::runtime_error("Error setting memory requirements.");
     }
     myprintf("%s\n", message.c_str());
+
+    if (!cfg_nncache_file.empty()
+        && boost::filesystem::exists(cfg_nncache_file)) {
+        s_network->nncache_load(cfg_nncache_file, cfg_nncache_shared);
+    }
+}
+
+void GTP::save_nncache() {
+    if (!cfg_nncache_file.empty() && !cfg_nncache_shared) {
+        s_network->nncache_save(cfg_nncache_file);
+    }
 }
 
 void GTP::setup_default_parameters() {
@@ -321,6 +343,7 @@ void GTP::setup_default_parameters() {
     cfg_num_threads = 1;
     // we will re-calculate this on Leela.cpp
     cfg_batch_size = 1;
+    cfg_eval_threads = 1;
 
     cfg_max_memory = UCTSearch::DEFAULT_MAX_MEMORY;
     cfg_max_playouts = UCTSearch::UNLIMITED_PLAYOUTS;
@@ -335,11 +358,16 @@ void GTP::setup_default_parameters() {
     cfg_gpus = { };
     cfg_sgemm_exhaustive = false;
     cfg_tune_only = false;
-
-#ifdef USE_HALF
-    cfg_precision = precision_t::AUTO;
-#endif
 #endif
+    cfg_precision = precision_t::AUTO;
+    cfg_int8_table = "";
+    cfg_int8_calibrate = "";
+    cfg_convert_weights = "";
+    cfg_weights_cache = false;
+    cfg_shared_weights = false;
+    cfg_nncache_file.clear();
+    cfg_nncache_shared = false;
+    cfg_nncache_storage = NNCache::Storage::FLOAT;
     cfg_puct = 0.5f;
     cfg_logpuct = 0.015f;
     cfg_logconst = 1.7f;
@@ -355,6 +383,8 @@ void GTP::setup_default_parameters() {
     cfg_random_min_visits = 1;
     cfg_random_temp = 1.0f;
     cfg_dumbpass = false;
+    cfg_root_average = false;
+    cfg_transpositions = false;
     cfg_logfile_handle = nullptr;
     cfg_quiet = false;
     cfg_benchmark = false;
@@ -411,6 +441,8 @@ const std::string GTP::s_commands[] = {
     "lz-genmove_analyze",
     "lz-memory_report",
     "lz-setoption",
+    "lz-nncache_save",
+    "lz-nncache_load",
     "gomill-explain_last_move",
     ""
 };
@@ -500,6 +532,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
     if (input == "") {
         return;
     } else if (input == "exit") {
+        save_nncache();
         exit(EXIT_SUCCESS);
     } else if (input.find("#") == 0) {
         return;
@@ -524,6 +557,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         gtp_printf(id, PROGRAM_VERSION);
         return;
     } else if (command == "quit") {
+        save_nncache();
         gtp_printf(id, "");
         exit(EXIT_SUCCESS);
     } else if (command.find("known_command") == 0) {
@@ -575,7 +609,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         Training::clear_training();
         game.reset_game();
         search = std::make_unique<UCTSearch>(game, *s_network);
-        assert(UCTNodePointer::get_tree_size() == 0);
+        assert(UCTNodeArena::get_tree_size() == 0);
         gtp_printf(id, "");
         return;
     } else if (command.find("komi") == 0) {
@@ -1169,7 +1203,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         return;
     } else if (command.find("lz-memory_report") == 0) {
         auto base_memory = get_base_memory();
-        auto tree_size = add_overhead(UCTNodePointer::get_tree_size());
+        auto tree_size = add_overhead(UCTSearch::get_tree_size());
         auto cache_size = add_overhead(s_network->get_estimated_cache_size());
 
         auto total = base_memory + tree_size + cache_size;
@@ -1180,6 +1214,24 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         return;
     } else if (command.find("lz-setoption") == 0) {
         return execute_setoption(*search.get(), id, command);
+    } else if (command.find("lz-nncache_save") == 0
+               || command.find("lz-nncache_load") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+
+        cmdstream >> tmp >> filename;
+        if (cmdstream.fail()) {
+            gtp_fail_printf(id, "syntax not understood");
+        } else if (tmp == "lz-nncache_save"
+                   ? s_network->nncache_save(filename)
+                   : s_network->nncache_load(filename, false)) {
+            gtp_printf(id, "");
+        } else {
+            gtp_fail_printf(id, "cannot %s NNCache file %s",
+                            tmp == "lz-nncache_save" ? "save" : "load",
+                            filename.c_str());
+        }
+        return;
     } else if (command.find("gomill-explain_last_move") == 0) {
         gtp_printf(id, "%s\n", search->explain_last_think().c_str());
         return;
@@ -1236,7 +1288,8 @@ std::pair<bool, std::string> GTP::set_max_memory(size_t max_memory,
         cache_size_ratio_percent / 100;
 
     auto max_cache_count =
-        (int)(remove_overhead(max_cache_size) / NNCache::ENTRY_SIZE);
+        (int)(remove_overhead(max_cache_size)
+              / NNCache::entry_size(cfg_nncache_storage));
 
     // Verify if the setting would not result in too little cache.
     if (max_cache_count < NNCache::MIN_CACHE_COUNT) {
@@ -83,6 +83,7 @@ extern bool cfg_gtp_mode;
 extern bool cfg_allow_pondering;
 extern unsigned int cfg_num_threads;
 extern unsigned int cfg_batch_size;
+extern unsigned int cfg_eval_threads;
 extern int cfg_max_playouts;
 extern int cfg_max_visits;
 extern size_t cfg_max_memory;
@@ -97,17 +98,25 @@ extern int cfg_random_min_visits;
 extern float cfg_random_temp;
 extern std::uint64_t cfg_rng_seed;
 extern bool cfg_dumbpass;
+extern bool cfg_root_average;
+extern bool cfg_transpositions;
 #ifdef USE_OPENCL
 extern std::vector<int> cfg_gpus;
 extern bool cfg_sgemm_exhaustive;
 extern bool cfg_tune_only;
-#ifdef USE_HALF
+#endif
 enum class precision_t {
-    AUTO, SINGLE, HALF
+    AUTO, SINGLE, HALF, INT8
 };
 extern precision_t cfg_precision;
-#endif
-#endif
+extern std::string cfg_int8_table;
+extern std::string cfg_int8_calibrate;
+extern std::string cfg_convert_weights;
+extern bool cfg_weights_cache;
+extern bool cfg_shared_weights;
+extern std::string cfg_nncache_file;
+extern bool cfg_nncache_shared;
+extern NNCache::Storage cfg_nncache_storage;
 extern float cfg_puct;
 extern float cfg_logpuct;
 extern float cfg_logconst;
@@ -136,6 +145,8 @@ class GTP {
 public:
     static std::unique_ptr<Network> s_network;
     static void initialize(std::unique_ptr<Network>&& network);
+    // Save the NNCache to --nncache-file, unless it is shared.
+    static void save_nncache();
     static void execute(GameState & game, const std::string& xinput);
     static void setup_default_parameters();
 private:
@@ -36,8 +36,8 @@
 
 template <unsigned long filter_size>
 void im2col(const int channels,
-            const std::vector<float>& input,
-            std::vector<float>& output) {
+            const float* const input,
+            float* const output) {
     constexpr unsigned int height = BOARD_SIZE;
     constexpr unsigned int width = BOARD_SIZE;
 
@@ -45,8 +45,8 @@ void im2col(const int channels,
     constexpr unsigned int output_h = height + 2 * pad - filter_size  + 1;
     constexpr unsigned int output_w = width + 2 * pad - filter_size + 1;
 
-    const float* data_im = input.data();
-    float* data_col = output.data();
+    const float* data_im = input;
+    float* data_col = output;
 
     for (int channel = channels; channel--; data_im += NUM_INTERSECTIONS) {
         for (unsigned int kernel_row = 0; kernel_row < filter_size; kernel_row++) {
@@ -78,11 +78,10 @@ void im2col(const int channels,
 
 template <>
 void im2col<1>(const int channels,
-               const std::vector<float>& input,
-               std::vector<float>& output) {
+               const float* const input,
+               float* const output) {
     auto outSize = size_t{channels * static_cast<size_t>(NUM_INTERSECTIONS)};
-    assert(output.size() == outSize);
-    std::copy(begin(input), begin(input) + outSize, begin(output));
+    std::copy(input, input + outSize, output);
 }
 
 #endif
@@ -41,6 +41,7 @@ class KoState : public FastState {
 public:
     void init_game(int size, float komi);
     bool superko() const;
+    const std::vector<std::uint64_t>& get_ko_hash_history() const;
     void reset_game();
 
     void play_move(int color, int vertex);
@@ -48,6 +48,7 @@
 #include "Random.h"
 #include "ThreadPool.h"
 #include "Utils.h"
+#include "WeightsFile.h"
 #include "Zobrist.h"
 
 using namespace Utils;
@@ -65,6 +66,16 @@ static void calculate_thread_count_cpu(boost::program_options::variables_map & v
     // If we are CPU-based, there is no point using more than the number of CPUs/
     auto cfg_max_threads = std::min(SMP::get_num_cpus(), size_t{MAX_CPUS});
 
+    if (vm["batchsize"].as<unsigned int>() > 0) {
+        cfg_batch_size = vm["batchsize"].as<unsigned int>();
+    } else {
+        cfg_batch_size = 1;
+    }
+    // When batching, search threads mostly wait for their batch to fill up,
+    // so allow up to a batch worth of them per CPU.
+    cfg_max_threads = std::min(cfg_max_threads * cfg_batch_size,
+                               size_t{MAX_CPUS});
+
     if (vm["threads"].as<unsigned int>() > 0) {
         auto num_threads = vm["threads"].as<unsigned int>();
         if (num_threads > cfg_max_threads) {
@@ -75,6 +86,11 @@ static void calculate_thread_count_cpu(boost::program_options::variables_map & v
     } else {
         cfg_num_threads = cfg_max_threads;
     }
+
+    if (cfg_num_threads < cfg_batch_size) {
+        printf("Number of threads = %d must be no smaller than batch size = %d\n", cfg_num_threads, cfg_batch_size);
+        exit(EXIT_FAILURE);
+    }
 }
 
 #ifdef USE_OPENCL
@@ -138,6 +154,10 @@ static void parse_commandline(int argc, char *argv[]) {
         ("gtp,g", "Enable GTP mode.")
         ("threads,t", po::value<unsigned int>()->default_value(0),
                       "Number of threads to use. Select 0 to let leela-zero pick a reasonable default.")
+        ("eval-threads", po::value<unsigned int>()->default_value(1),
+                         "Number of cores each CPU network evaluation is "
+                         "split across. Lowers the latency of an eval, "
+                         "mostly useful with few search threads.")
         ("playouts,p", po::value<int>(),
                        "Weaken engine by limiting the number of playouts. "
                        "Requires --noponder.")
@@ -149,6 +169,24 @@ static void parse_commandline(int argc, char *argv[]) {
                         "Resign when winrate is less than x%.\n"
                         "-1 uses 10% but scales for handicap.")
         ("weights,w", po::value<std::string>()->default_value(cfg_weightsfile), "File with network weights.")
+        ("weights-cache", "Cache the transformed network weights in the "
+                          "leelaz data directory, so later starts with the "
+                          "same network skip parsing and transforming them.")
+        ("shared-weights", "Share the packed CPU weights with other leelaz "
+                           "processes running the same network, through a "
+                           "memory mapped file in the leelaz data directory.")
+        ("nncache-file", po::value<std::string>(),
+                         "Load the network cache from this file at startup "
+                         "and save it there on quit, so a restarted engine "
+                         "knows the positions it evaluated before.")
+        ("nncache-shared", "Map the --nncache-file read-only instead of "
+                           "loading it, sharing it between processes. It is "
+                           "not saved on quit.")
+        ("nncache-storage", po::value<std::string>()->default_value("float"),
+                            "[float|half|topk] How the network cache stores "
+                            "policies. half fits twice and topk five times "
+                            "as many positions in the same memory; topk "
+                            "keeps only the 64 most likely moves exactly.")
         ("logfile,l", po::value<std::string>(), "File to log input/output to.")
         ("quiet,q", "Disable all diagnostic output.")
         ("timemanage", po::value<std::string>()->default_value("auto"),
@@ -161,9 +199,31 @@ static void parse_commandline(int argc, char *argv[]) {
         ("noponder", "Disable thinking on opponent's time.")
         ("benchmark", "Test network and exit. Default args:\n-v3200 --noponder "
                       "-m0 -t1 -s1.")
+        ("root-average", "Evaluate the root position with the average of "
+                         "all 8 symmetries, run as one batch.")
+        ("transpositions", "Share the search of positions reached by "
+                           "different move orders, searching a graph "
+                           "instead of a tree.")
 #ifndef USE_CPU_ONLY
         ("cpu-only", "Use CPU-only implementation and do not use OpenCL device(s).")
 #endif
+#ifndef USE_OPENCL
+        ("batchsize", po::value<unsigned int>()->default_value(1),
+                      "Max batch size for CPU evaluation.")
+        ("precision", po::value<std::string>(),
+            "Arithmetic precision of the residual tower (single/int8).\n"
+            "int8 needs a table made with --int8-calibrate.")
+#endif
+        ("int8-table", po::value<std::string>(),
+                       "Int8 calibration table. Default is the weights "
+                       "file name with .int8 appended.")
+        ("int8-calibrate", po::value<std::string>(),
+                           "Calibrate int8 precision on positions from an "
+                           "SGF file, write the table, report the error "
+                           "against single precision and exit.")
+        ("convert-weights", po::value<std::string>(),
+                            "Write the weights file in the binary format, "
+                            "which loads much faster, to this file and exit.")
         ;
 #ifdef USE_OPENCL
     po::options_description gpu_desc("OpenCL device options");
@@ -175,8 +235,13 @@ static void parse_commandline(int argc, char *argv[]) {
         ("batchsize", po::value<unsigned int>()->default_value(0), "Max batch size.  Select 0 to let leela-zero pick a reasonable default.")
 #ifdef USE_HALF
         ("precision", po::value<std::string>(),
-            "Floating-point precision (single/half/auto).\n"
-            "Default is to auto which automatically determines which one to use.")
+            "Floating-point precision (single/half/auto/int8).\n"
+            "Default is to auto which automatically determines which one to use.\n"
+            "int8 needs --cpu-only and a table made with --int8-calibrate.")
+#else
+        ("precision", po::value<std::string>(),
+            "Arithmetic precision (single/int8).\n"
+            "int8 needs --cpu-only and a table made with --int8-calibrate.")
 #endif
         ;
 #endif
@@ -209,10 +274,6 @@ static void parse_commandline(int argc, char *argv[]) {
     // These won't be shown, we use them to catch incorrect usage of the
     // command line.
     po::options_description ignore("Ignored options");
-#ifndef USE_OPENCL
-    ignore.add_options()
-        ("batchsize", po::value<unsigned int>()->default_value(1), "Max batch size.");
-#endif
     po::options_description h_desc("Hidden options");
     h_desc.add_options()
         ("arguments", po::value<std::vector<std::string>>());
@@ -323,20 +384,35 @@ static void parse_commandline(int argc, char *argv[]) {
     if (vm.count("tune-only")) {
         cfg_tune_only = true;
     }
-#ifdef USE_HALF
+    if (vm.count("cpu-only")) {
+        cfg_cpu_only = true;
+    }
+#else
+    cfg_cpu_only = true;
+#endif
+
     if (vm.count("precision")) {
         auto precision = vm["precision"].as<std::string>();
         if ("single" == precision) {
             cfg_precision = precision_t::SINGLE;
+        } else if ("int8" == precision) {
+            cfg_precision = precision_t::INT8;
+#ifdef USE_HALF
         } else if ("half" == precision) {
             cfg_precision = precision_t::HALF;
         } else if ("auto" == precision) {
             cfg_precision = precision_t::AUTO;
         } else {
-            printf("Unexpected option for --precision, expecting single/half/auto\n");
+            printf("Unexpected option for --precision, expecting single/half/auto/int8\n");
             exit(EXIT_FAILURE);
+#else
+        } else {
+            printf("Unexpected option for --precision, expecting single/int8\n");
+            exit(EXIT_FAILURE);
+#endif
         }
     }
+#ifdef USE_HALF
     if (cfg_precision == precision_t::AUTO) {
         // Auto precision is not supported for full tuner cases.
         if (cfg_sgemm_exhaustive) {
@@ -346,15 +422,71 @@ static void parse_commandline(int argc, char *argv[]) {
         }
     }
 #endif
-    if (vm.count("cpu-only")) {
+
+    if (vm.count("int8-table")) {
+        cfg_int8_table = vm["int8-table"].as<std::string>();
+    } else {
+        cfg_int8_table = cfg_weightsfile + ".int8";
+    }
+    if (vm.count("weights-cache")) {
+        cfg_weights_cache = true;
+    }
+    if (vm.count("shared-weights")) {
+        cfg_shared_weights = true;
+    }
+    if (vm.count("nncache-file")) {
+        cfg_nncache_file = vm["nncache-file"].as<std::string>();
+    }
+    if (vm.count("nncache-shared")) {
+        if (cfg_nncache_file.empty()) {
+            printf("--nncache-shared requires --nncache-file.\n");
+            exit(EXIT_FAILURE);
+        }
+        cfg_nncache_shared = true;
+    }
+    if (vm.count("nncache-storage")) {
+        const auto storage = vm["nncache-storage"].as<std::string>();
+        if (storage == "float") {
+            cfg_nncache_storage = NNCache::Storage::FLOAT;
+        } else if (storage == "half") {
+            cfg_nncache_storage = NNCache::Storage::HALF;
+        } else if (storage == "topk") {
+            cfg_nncache_storage = NNCache::Storage::TOP_K;
+        } else {
+            printf("Unexpected option for --nncache-storage, "
+                   "expecting float/half/topk\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (vm.count("convert-weights")) {
+        cfg_convert_weights = vm["convert-weights"].as<std::string>();
+    }
+    if (vm.count("int8-calibrate")) {
+        // Calibration runs its own fp32 and int8 CPU pipes.
+        cfg_int8_calibrate = vm["int8-calibrate"].as<std::string>();
+        cfg_precision = precision_t::SINGLE;
         cfg_cpu_only = true;
     }
-#else
-    cfg_cpu_only = true;
-#endif
+    if (cfg_precision == precision_t::INT8 && !cfg_cpu_only) {
+        printf("Int8 precision is only supported by the CPU implementation.\n");
+        printf("Please add '--cpu-only'\n");
+        exit(EXIT_FAILURE);
+    }
 
     if (cfg_cpu_only) {
         calculate_thread_count_cpu(vm);
+        if (cfg_batch_size > 1) {
+            myprintf("Using CPU batch size of %d\n", cfg_batch_size);
+        }
+        cfg_eval_threads = std::max(vm["eval-threads"].as<unsigned int>(), 1u);
+        const auto max_eval_threads = std::min(SMP::get_num_cpus(), size_t{MAX_CPUS});
+        if (cfg_eval_threads > max_eval_threads) {
+            myprintf("Clamping eval threads to maximum = %d\n", max_eval_threads);
+            cfg_eval_threads = max_eval_threads;
+        }
+        if (cfg_eval_threads > 1) {
+            myprintf("Using %d threads per network evaluation.\n", cfg_eval_threads);
+        }
     } else {
 #ifdef USE_OPENCL
         calculate_thread_count_gpu(vm);
@@ -384,6 +516,14 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_dumbpass = true;
     }
 
+    if (vm.count("root-average")) {
+        cfg_root_average = true;
+    }
+
+    if (vm.count("transpositions")) {
+        cfg_transpositions = true;
+    }
+
     if (vm.count("playouts")) {
         cfg_max_playouts = vm["playouts"].as<int>();
         if (!vm.count("noponder")) {
@@ -508,6 +648,20 @@ void init_global_objects() {
     initialize_network();
 }
 
+static int convert_weights() {
+    auto weights = WeightsFile::Tensors{};
+    if (!WeightsFile::read(cfg_weightsfile, weights)) {
+        return EXIT_FAILURE;
+    }
+    if (!WeightsFile::write_binary(cfg_convert_weights, weights)) {
+        printf("Could not write %s.\n", cfg_convert_weights.c_str());
+        return EXIT_FAILURE;
+    }
+    printf("Wrote %zu tensors to %s.\n", weights.tensors.size(),
+           cfg_convert_weights.c_str());
+    return EXIT_SUCCESS;
+}
+
 void benchmark(GameState& game) {
     game.set_timecontrol(0, 1, 0, 0);  // Set infinite time.
     game.play_textmove("b", "r16");
@@ -535,12 +689,21 @@ int main(int argc, char *argv[]) {
     setbuf(stdin, nullptr);
 #endif
 
+    if (!cfg_convert_weights.empty()) {
+        return convert_weights();
+    }
+
     if (!cfg_gtp_mode && !cfg_benchmark) {
         license_blurb();
     }
 
     init_global_objects();
 
+    if (!cfg_int8_calibrate.empty()) {
+        GTP::s_network->calibrate_int8(cfg_int8_calibrate, cfg_int8_table);
+        return 0;
+    }
+
     auto maingame = std::make_unique<GameState>();
 
     /* set board limits */
@@ -563,8 +726,10 @@ int main(int argc, char *argv[]) {
             Utils::log_input(input);
             GTP::execute(*maingame, input);
         } else {
-            // eof or other error
+            // eof or other error, such as a GUI closing the pipe
+            // instead of sending quit.
             std::cout << std::endl;
+            GTP::save_nncache();
             break;
         }
 
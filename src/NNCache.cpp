@@ -28,62 +28,535 @@
 */
 
 #include "config.h"
-#include <functional>
-#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include <numeric>
+#include <boost/filesystem.hpp>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SNAPSHOT_MMAP
+#endif
 
 #include "NNCache.h"
+#include "half/half.hpp"
 #include "Utils.h"
 #include "UCTSearch.h"
 #include "GTP.h"
 
 const int NNCache::MAX_CACHE_COUNT;
 const int NNCache::MIN_CACHE_COUNT;
-const size_t NNCache::ENTRY_SIZE;
+const int NNCache::TOP_K_MOVES;
+const int NNCache::PROBE_WINDOW;
+const int NNCache::NUM_SHARDS;
 
-NNCache::NNCache(int size) : m_size(size) {}
+// Snapshot file format, in native byte order:
+//
+//   char     magic[8]       "LZNNCACH"
+//   uint32   format version SNAPSHOT_VERSION
+//   uint32   sizeof(Netresult), which depends on BOARD_SIZE
+//   uint32   stamp length   m
+//   char     stamp[m]
+//   uint64   entry count    n, at the next multiple of 8
+//   uint64   hashes[n]      ascending
+//   Netresult results[n]    at the next multiple of 64
+namespace {
+    constexpr char SNAPSHOT_MAGIC[8] = {'L', 'Z', 'N', 'N', 'C', 'A', 'C', 'H'};
+    constexpr auto SNAPSHOT_VERSION = std::uint32_t{1};
 
-bool NNCache::lookup(std::uint64_t hash, Netresult & result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    ++m_lookups;
+    size_t align(const size_t offset, const size_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    template <typename T>
+    void write_field(std::ostream& out, const T& value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
 
-    auto iter = m_cache.find(hash);
-    if (iter == m_cache.end()) {
-        return false;  // Not found.
+    template <typename T>
+    T read_field(const char* data, size_t& offset) {
+        auto value = T{};
+        std::memcpy(&value, data + offset, sizeof(T));
+        offset += sizeof(T);
+        return value;
     }
 
-    const auto& entry = iter->second;
+    using Netresult = NNCache::Netresult;
+    using Storage = NNCache::Storage;
 
-    // Found it.
-    ++m_hits;
-    result = entry->result;
-    return true;
+    // Policy entries, pass last.
+    constexpr auto POLICY_SIZE = NUM_INTERSECTIONS + 1;
+    constexpr auto FIXED_ONE = 65535.0f;
+
+    size_t result_bytes(const Storage storage) {
+        switch (storage) {
+        case Storage::HALF:
+            return sizeof(float) + POLICY_SIZE * sizeof(std::uint16_t);
+        case Storage::TOP_K:
+            return 3 * sizeof(float)
+                   + 2 * NNCache::TOP_K_MOVES * sizeof(std::uint16_t);
+        default:
+            return sizeof(Netresult);
+        }
+    }
+
+    float get_policy(const Netresult& result, const int move) {
+        return move < NUM_INTERSECTIONS ? result.policy[move]
+                                        : result.policy_pass;
+    }
+
+    void set_policy(Netresult& result, const int move, const float value) {
+        if (move < NUM_INTERSECTIONS) {
+            result.policy[move] = value;
+        } else {
+            result.policy_pass = value;
+        }
+    }
+
+    // Layouts, after the float winrate:
+    //   HALF:  uint16 policy[POLICY_SIZE] as half floats
+    //   TOP_K: float pass, float residual mass of the board moves,
+    //          uint16 moves[TOP_K_MOVES],
+    //          uint16 policy[TOP_K_MOVES] as multiples of 1/FIXED_ONE
+    void encode(const Storage storage, const Netresult& result, char* out) {
+        if (storage == Storage::FLOAT) {
+            std::memcpy(out, &result, sizeof(result));
+            return;
+        }
+        std::memcpy(out, &result.winrate, sizeof(float));
+        out += sizeof(float);
+        auto policy = std::array<std::uint16_t, POLICY_SIZE>{};
+        if (storage == Storage::HALF) {
+            for (auto i = 0; i < POLICY_SIZE; i++) {
+                const auto value = half_float::half(get_policy(result, i));
+                std::memcpy(&policy[i], &value, sizeof(policy[i]));
+            }
+            std::memcpy(out, policy.data(), POLICY_SIZE * sizeof(policy[0]));
+            return;
+        }
+
+        constexpr auto K = NNCache::TOP_K_MOVES;
+        auto moves = std::array<std::uint16_t, NUM_INTERSECTIONS>{};
+        std::iota(begin(moves), end(moves), 0);
+        std::partial_sort(begin(moves), begin(moves) + K, end(moves),
+                          [&result](const int a, const int b) {
+                              return result.policy[a] > result.policy[b];
+                          });
+        std::memcpy(out, &result.policy_pass, sizeof(float));
+        out += sizeof(float);
+        auto residual = 1.0f - result.policy_pass;
+        for (auto i = 0; i < K; i++) {
+            const auto value = result.policy[moves[i]];
+            policy[i] = std::uint16_t(std::lround(
+                std::min(std::max(value, 0.0f), 1.0f) * FIXED_ONE));
+            residual -= value;
+        }
+        residual = std::max(residual, 0.0f);
+        std::memcpy(out, &residual, sizeof(float));
+        out += sizeof(float);
+        std::memcpy(out, moves.data(), K * sizeof(moves[0]));
+        std::memcpy(out + K * sizeof(moves[0]), policy.data(),
+                    K * sizeof(policy[0]));
+    }
+
+    void decode(const Storage storage, const char* in, Netresult& result) {
+        if (storage == Storage::FLOAT) {
+            std::memcpy(&result, in, sizeof(result));
+            return;
+        }
+        std::memcpy(&result.winrate, in, sizeof(float));
+        in += sizeof(float);
+        auto policy = std::array<std::uint16_t, POLICY_SIZE>{};
+        if (storage == Storage::HALF) {
+            std::memcpy(policy.data(), in, POLICY_SIZE * sizeof(policy[0]));
+            for (auto i = 0; i < POLICY_SIZE; i++) {
+                auto value = half_float::half{};
+                // half is trivially copyable in all but name.
+                std::memcpy(static_cast<void*>(&value), &policy[i],
+                            sizeof(policy[i]));
+                set_policy(result, i, float(value));
+            }
+            return;
+        }
+
+        constexpr auto K = NNCache::TOP_K_MOVES;
+        std::memcpy(&result.policy_pass, in, sizeof(float));
+        in += sizeof(float);
+        auto residual = 0.0f;
+        std::memcpy(&residual, in, sizeof(float));
+        in += sizeof(float);
+        auto moves = std::array<std::uint16_t, K>{};
+        std::memcpy(moves.data(), in, K * sizeof(moves[0]));
+        std::memcpy(policy.data(), in + K * sizeof(moves[0]),
+                    K * sizeof(policy[0]));
+        result.policy.fill(residual / (NUM_INTERSECTIONS - K));
+        for (auto i = 0; i < K; i++) {
+            result.policy[moves[i]] = policy[i] / FIXED_ONE;
+        }
+    }
+
+    // Whole file contents, memory mapped where we can.
+    std::shared_ptr<const char> read_file(const std::string& filename,
+                                          size_t& size) {
+#ifdef SNAPSHOT_MMAP
+        const auto fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        auto data = std::shared_ptr<const char>{};
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            const auto addr = mmap(nullptr, st.st_size, PROT_READ,
+                                   MAP_SHARED, fd, 0);
+            if (addr != MAP_FAILED) {
+                // Lookups go all over the file.
+                madvise(addr, st.st_size, MADV_RANDOM);
+                size = st.st_size;
+                data = std::shared_ptr<const char>(
+                    static_cast<const char*>(addr), [size](const char* p) {
+                        munmap(const_cast<char*>(p), size);
+                    });
+            }
+        }
+        close(fd);
+        return data;
+#else
+        auto in = std::ifstream{filename, std::ios::binary};
+        if (!in) {
+            return nullptr;
+        }
+        const auto buffer = std::make_shared<std::vector<char>>(
+            std::istreambuf_iterator<char>(in),
+            std::istreambuf_iterator<char>());
+        size = buffer->size();
+        return std::shared_ptr<const char>(buffer, buffer->data());
+#endif
+    }
+}
+
+NNCache::NNCache(int size) : m_shards(NUM_SHARDS) {
+    resize(size);
+}
+
+size_t NNCache::entry_size(Storage storage) {
+    return sizeof(std::uint64_t) + sizeof(std::uint32_t)
+           + result_bytes(storage);
+}
+
+void NNCache::set_storage(Storage storage) {
+    m_storage = storage;
+    for (auto& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.clear(shard.size, result_bytes(m_storage));
+    }
+}
+
+size_t NNCache::Shard::home_slot(std::uint64_t hash) const {
+    // Map the top bits of the hash onto [0, size) without a division,
+    // so the table needs no power of two size and uses all of its budget.
+    return size_t(((hash >> 32) * std::uint64_t{size}) >> 32);
+}
+
+void NNCache::Shard::clear(size_t slots, size_t slot_bytes) {
+    size = std::max(slots, size_t{1});
+    result_bytes = slot_bytes;
+    used = 0;
+    // Assign fresh vectors so the old storage is released.
+    hashes = std::vector<std::uint64_t>(size);
+    stamps = std::vector<std::uint32_t>(size);
+    results = std::vector<char>(size * result_bytes);
+}
+
+size_t NNCache::Shard::probe(std::uint64_t hash, bool& found) const {
+    // The slot holding hash, or else the first empty slot in the window,
+    // or else the oldest entry in it.
+    auto slot = home_slot(hash);
+    auto victim = slot;
+    for (auto i = 0; i < PROBE_WINDOW; i++) {
+        if (stamps[slot] == 0) {
+            found = false;
+            return slot;
+        }
+        if (hashes[slot] == hash) {
+            found = true;
+            return slot;
+        }
+        if (stamps[slot] < stamps[victim]) {
+            victim = slot;
+        }
+        if (++slot == size) {
+            slot = 0;
+        }
+    }
+    found = false;
+    return victim;
+}
+
+void NNCache::Shard::store(size_t slot, std::uint64_t hash,
+                           std::uint32_t stamp, const char* data) {
+    if (stamps[slot] == 0) {
+        ++used;
+    }
+    hashes[slot] = hash;
+    stamps[slot] = stamp;
+    std::memcpy(&results[slot * result_bytes], data, result_bytes);
+}
+
+bool NNCache::lookup(std::uint64_t hash, Netresult & result) {
+    auto& shard = shard_for(hash);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    ++shard.lookups;
+
+    auto found = false;
+    const auto slot = shard.probe(hash, found);
+    if (found) {
+        ++shard.hits;
+        decode(m_storage, &shard.results[slot * shard.result_bytes], result);
+        return true;
+    }
+    lock.unlock();
+
+    if (m_snapshot.count && lookup_snapshot(hash, result)) {
+        ++m_snapshot_hits;
+        return true;
+    }
+    return false;  // Not found.
 }
 
 void NNCache::insert(std::uint64_t hash,
                      const Netresult& result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    auto data = std::array<char, sizeof(Netresult)>{};
+    encode(m_storage, result, data.data());
 
-    if (m_cache.find(hash) != m_cache.end()) {
+    auto& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto found = false;
+    const auto slot = shard.probe(hash, found);
+    if (found) {
         return;  // Already in the cache.
     }
 
-    m_cache.emplace(hash, std::make_unique<Entry>(result));
-    m_order.push_back(hash);
-    ++m_inserts;
-
-    // If the cache is too large, remove the oldest entry.
-    if (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+    // The clock wraps after 2^32 inserts. The live entries then all
+    // become equally old.
+    if (++shard.clock == 0) {
+        for (auto& stamp : shard.stamps) {
+            stamp = std::min(stamp, std::uint32_t{1});
+        }
+        shard.clock = 2;
     }
+    shard.store(slot, hash, shard.clock, data.data());
+    ++shard.inserts;
 }
 
 void NNCache::resize(int size) {
     m_size = size;
-    while (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+
+    for (auto i = 0; i < NUM_SHARDS; i++) {
+        auto& shard = m_shards[i];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        const auto hashes = std::move(shard.hashes);
+        const auto stamps = std::move(shard.stamps);
+        const auto results = std::move(shard.results);
+        const auto bytes = shard.result_bytes;
+        shard.clear(m_size / NUM_SHARDS + (size_t(i) < m_size % NUM_SHARDS),
+                    result_bytes(m_storage));
+
+        // Reinsert the old entries oldest first, so where they collide in
+        // the new table the newer ones win.
+        auto order = std::vector<size_t>{};
+        for (auto j = size_t{0}; j < stamps.size(); j++) {
+            if (stamps[j] != 0) {
+                order.emplace_back(j);
+            }
+        }
+        std::sort(begin(order), end(order), [&stamps](size_t a, size_t b) {
+            return stamps[a] < stamps[b];
+        });
+        for (const auto j : order) {
+            auto found = false;
+            const auto slot = shard.probe(hashes[j], found);
+            shard.store(slot, hashes[j], stamps[j], &results[j * bytes]);
+        }
+    }
+}
+
+NNCache::Snapshot NNCache::read_snapshot(const std::string& filename,
+                                         const std::string& stamp) {
+    auto snapshot = Snapshot{};
+    auto size = size_t{0};
+    const auto data = read_file(filename, size);
+    if (!data) {
+        Utils::myprintf("Could not read NNCache snapshot %s.\n",
+                        filename.c_str());
+        return snapshot;
+    }
+
+    auto offset = sizeof(SNAPSHOT_MAGIC);
+    const auto fixed_size = offset + 3 * sizeof(std::uint32_t);
+    if (size < fixed_size
+        || std::memcmp(data.get(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC))
+        || read_field<std::uint32_t>(data.get(), offset) != SNAPSHOT_VERSION
+        || read_field<std::uint32_t>(data.get(), offset) != sizeof(Netresult)) {
+        Utils::myprintf("%s is not an NNCache snapshot for this build.\n",
+                        filename.c_str());
+        return snapshot;
+    }
+    const auto stamp_size = read_field<std::uint32_t>(data.get(), offset);
+    if (size < offset + stamp_size + 2 * sizeof(std::uint64_t)
+        || stamp != std::string(data.get() + offset, stamp_size)) {
+        Utils::myprintf("NNCache snapshot %s is for another network "
+                        "or settings, ignoring it.\n", filename.c_str());
+        return snapshot;
+    }
+    offset = align(offset + stamp_size, sizeof(std::uint64_t));
+    const auto count = read_field<std::uint64_t>(data.get(), offset);
+    // Bound count by what the file can hold before multiplying with it.
+    if (count > (size - offset)
+                / (sizeof(std::uint64_t) + sizeof(Netresult))) {
+        Utils::myprintf("NNCache snapshot %s is truncated.\n",
+                        filename.c_str());
+        return snapshot;
+    }
+    const auto results_offset = align(offset + count * sizeof(std::uint64_t),
+                                      64);
+    if (size != results_offset + count * sizeof(Netresult)) {
+        Utils::myprintf("NNCache snapshot %s is truncated.\n",
+                        filename.c_str());
+        return snapshot;
+    }
+
+    snapshot.data = data;
+    snapshot.count = count;
+    snapshot.hashes =
+        reinterpret_cast<const std::uint64_t*>(data.get() + offset);
+    snapshot.results =
+        reinterpret_cast<const Netresult*>(data.get() + results_offset);
+    return snapshot;
+}
+
+bool NNCache::lookup_snapshot(std::uint64_t hash, Netresult& result) const {
+    const auto end = m_snapshot.hashes + m_snapshot.count;
+    const auto iter = std::lower_bound(m_snapshot.hashes, end, hash);
+    if (iter == end || *iter != hash) {
+        return false;
+    }
+    result = m_snapshot.results[iter - m_snapshot.hashes];
+    return true;
+}
+
+bool NNCache::save(const std::string& filename, const std::string& stamp) {
+    // Hold every shard while the entries are written out.
+    auto locks = std::vector<std::unique_lock<std::mutex>>{};
+    for (auto& shard : m_shards) {
+        locks.emplace_back(shard.mutex);
     }
+
+    struct Entry {
+        std::uint64_t hash;
+        const char* data;
+        Storage storage;
+    };
+    auto entries = std::vector<Entry>{};
+    for (const auto& shard : m_shards) {
+        for (auto i = size_t{0}; i < shard.size; i++) {
+            if (shard.stamps[i] != 0) {
+                entries.push_back({shard.hashes[i],
+                                   &shard.results[i * shard.result_bytes],
+                                   m_storage});
+            }
+        }
+    }
+    for (auto i = size_t{0}; i < m_snapshot.count; i++) {
+        entries.push_back({m_snapshot.hashes[i],
+                           reinterpret_cast<const char*>(
+                               &m_snapshot.results[i]),
+                           Storage::FLOAT});
+    }
+    // The table goes first, so stable sorting keeps its entry where both
+    // have a hash.
+    std::stable_sort(begin(entries), end(entries),
+                     [](const auto& a, const auto& b) {
+                         return a.hash < b.hash;
+                     });
+    entries.erase(std::unique(begin(entries), end(entries),
+                              [](const auto& a, const auto& b) {
+                                  return a.hash == b.hash;
+                              }),
+                  end(entries));
+
+    // Readers may have the old file mapped, so write a new one and move
+    // it into place.
+    const auto temp_file = filename + boost::filesystem::unique_path(
+        ".%%%%-%%%%-%%%%").string();
+    {
+        auto out = std::ofstream{temp_file, std::ios::binary};
+        out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        write_field(out, SNAPSHOT_VERSION);
+        write_field(out, std::uint32_t(sizeof(Netresult)));
+        write_field(out, std::uint32_t(stamp.size()));
+        out.write(stamp.data(), stamp.size());
+        const char padding[64] = {};
+        auto offset = size_t(out.tellp());
+        out.write(padding, align(offset, sizeof(std::uint64_t)) - offset);
+        write_field(out, std::uint64_t(entries.size()));
+        for (const auto& entry : entries) {
+            write_field(out, entry.hash);
+        }
+        offset = size_t(out.tellp());
+        out.write(padding, align(offset, 64) - offset);
+        // Snapshots always hold full float results.
+        auto result = Netresult{};
+        for (const auto& entry : entries) {
+            decode(entry.storage, entry.data, result);
+            write_field(out, result);
+        }
+        if (!out) {
+            boost::filesystem::remove(temp_file);
+            return false;
+        }
+    }
+    auto error = boost::system::error_code{};
+    boost::filesystem::rename(temp_file, filename, error);
+    if (error) {
+        boost::filesystem::remove(temp_file);
+        return false;
+    }
+    Utils::myprintf("Saved %d NNCache entries to %s.\n",
+                    int(entries.size()), filename.c_str());
+    return true;
+}
+
+bool NNCache::load(const std::string& filename, const std::string& stamp) {
+    const auto snapshot = read_snapshot(filename, stamp);
+    if (!snapshot.data) {
+        return false;
+    }
+    for (auto i = size_t{0}; i < snapshot.count; i++) {
+        insert(snapshot.hashes[i], snapshot.results[i]);
+    }
+    Utils::myprintf("Loaded %d NNCache entries from %s.\n",
+                    int(snapshot.count), filename.c_str());
+    return true;
+}
+
+bool NNCache::map(const std::string& filename, const std::string& stamp) {
+    auto snapshot = read_snapshot(filename, stamp);
+    if (!snapshot.data) {
+        return false;
+    }
+    m_snapshot = std::move(snapshot);
+    Utils::myprintf("Mapped %d NNCache entries from %s.\n",
+                    int(m_snapshot.count), filename.c_str());
+    return true;
 }
 
 void NNCache::set_size_from_playouts(int max_playouts) {
@@ -99,13 +572,36 @@ void NNCache::set_size_from_playouts(int max_playouts) {
     resize(max_size);
 }
 
+std::pair<int, int> NNCache::hit_rate() const {
+    auto hits = int(m_snapshot_hits);
+    auto lookups = 0;
+    for (const auto& shard : m_shards) {
+        hits += shard.hits;
+        lookups += shard.lookups;
+    }
+    return {hits, lookups};
+}
+
 void NNCache::dump_stats() {
+    auto hits = int(m_snapshot_hits);
+    auto lookups = 0;
+    auto inserts = 0;
+    auto used = 0;
+    for (const auto& shard : m_shards) {
+        hits += shard.hits;
+        lookups += shard.lookups;
+        inserts += shard.inserts;
+        used += shard.used;
+    }
     Utils::myprintf(
-        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %u size\n",
-        m_hits, m_lookups, 100. * m_hits / (m_lookups + 1),
-        m_inserts, m_cache.size());
+        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %d size\n",
+        hits, lookups, 100. * hits / (lookups + 1), inserts, used);
 }
 
 size_t NNCache::get_estimated_size() {
-    return m_order.size() * NNCache::ENTRY_SIZE;
+    auto slots = size_t{0};
+    for (const auto& shard : m_shards) {
+        slots += shard.size;
+    }
+    return slots * entry_size(m_storage);
 }
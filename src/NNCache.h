@@ -33,10 +33,14 @@
 #include "config.h"
 
 #include <array>
-#include <deque>
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <mutex>
-#include <unordered_map>
+#include <string>
+#include <vector>
+
+#include "AlignedAllocator.h"
 
 class NNCache {
 public:
@@ -62,17 +66,40 @@ public:
         }
     };
 
-    static constexpr size_t ENTRY_SIZE =
-          sizeof(Netresult)
-        + sizeof(std::uint64_t)
-        + sizeof(std::unique_ptr<Netresult>);
+    // How the cache stores policies.  The winrate is always exact.
+    enum class Storage {
+        // As floats, about 1.4KiB per entry
+        FLOAT,
+        // As half precision floats, half the size
+        HALF,
+        // The TOP_K_MOVES most likely board moves as 16 bit fixed point,
+        // with the rest of their probability mass spread evenly over the
+        // other board moves, and the pass as a float.  About a fifth of
+        // the size.
+        TOP_K
+    };
+    static constexpr int TOP_K_MOVES = 64;
+
+    // Memory used by a single entry.
+    static size_t entry_size(Storage storage);
+
+    // Number of slots from the home slot of a hash that are searched
+    // before the oldest of them gets replaced.
+    static constexpr int PROBE_WINDOW = 8;
+
+    // The table is split by the low bits of the hash into shards with
+    // a lock each, so search threads rarely wait on one another.
+    static constexpr int NUM_SHARDS = 64;
 
     NNCache(int size = MAX_CACHE_COUNT);  // ~ 208MiB
 
+    // Change how results are stored.  This empties the cache.
+    void set_storage(Storage storage);
+
     // Set a reasonable size gives max number of playouts
     void set_size_from_playouts(int max_playouts);
 
-    // Resize NNCache
+    // Resize NNCache, keeping the newest entries that still fit.
     void resize(int size);
 
     // Try and find an existing entry.
@@ -83,35 +110,87 @@ public:
                 const Netresult& result);
 
     // Return the hit rate ratio.
-    std::pair<int, int> hit_rate() const {
-        return {m_hits, m_lookups};
-    }
+    std::pair<int, int> hit_rate() const;
 
     void dump_stats();
 
-    // Return the estimated memory consumption of the cache.
+    // Write the entries to a snapshot file, tagged with stamp, which
+    // should name everything the results depend on.  Entries of a
+    // mapped snapshot are included.  Returns false on errors.
+    bool save(const std::string& filename, const std::string& stamp);
+
+    // Insert the entries of a snapshot file with the same stamp.
+    bool load(const std::string& filename, const std::string& stamp);
+
+    // Map a snapshot file with the same stamp read-only and answer the
+    // lookups that miss the table from it.  Processes that map the same
+    // file share its pages.
+    bool map(const std::string& filename, const std::string& stamp);
+
+    // Return the memory consumption of the cache, all of which is
+    // allocated up front by resize().
     size_t get_estimated_size();
 private:
 
-    std::mutex m_mutex;
+    // Each shard starts on its own cache line, so threads taking the
+    // mutex or counting hits of one shard don't invalidate the line of
+    // its neighbours.
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        size_t home_slot(std::uint64_t hash) const;
+        size_t probe(std::uint64_t hash, bool& found) const;
+        void store(size_t slot, std::uint64_t hash, std::uint32_t stamp,
+                   const char* data);
+        void clear(size_t slots, size_t slot_bytes);
+
+        std::mutex mutex;
+
+        size_t size{0};
+        size_t result_bytes{0};
+
+        // Statistics
+        int hits{0};
+        int lookups{0};
+        int inserts{0};
+        int used{0};
+
+        // Insertion stamp of the newest entry.
+        std::uint32_t clock{0};
+
+        // Open-addressed table of size slots. Insertion stamps start at 1,
+        // a stamp of 0 marks an empty slot. Hashes and stamps are kept
+        // apart from the results so a probe touches one or two cache lines.
+        // The results are stored as result_bytes each, see Storage.
+        std::vector<std::uint64_t> hashes;
+        std::vector<std::uint32_t> stamps;
+        std::vector<char> results;
+    };
+
+    // Snapshot file contents, entries sorted by hash.
+    struct Snapshot {
+        std::shared_ptr<const char> data;
+        size_t count{0};
+        const std::uint64_t* hashes{nullptr};
+        const Netresult* results{nullptr};
+    };
+
+    static Snapshot read_snapshot(const std::string& filename,
+                                  const std::string& stamp);
+    bool lookup_snapshot(std::uint64_t hash, Netresult& result) const;
+
+    Shard& shard_for(std::uint64_t hash) {
+        return m_shards[hash % NUM_SHARDS];
+    }
 
     size_t m_size;
 
-    // Statistics
-    int m_hits{0};
-    int m_lookups{0};
-    int m_inserts{0};
+    Storage m_storage{Storage::FLOAT};
 
-    struct Entry {
-        Entry(const Netresult& r)
-            : result(r) {}
-        Netresult result;  // ~ 1.4KiB
-    };
+    // Allocated so that the alignment of Shard holds, which new doesn't
+    // guarantee for over-aligned types before C++17.
+    std::vector<Shard, AlignedAllocator<Shard>> m_shards;
 
-    // Map from hash to {features, result}
-    std::unordered_map<std::uint64_t, std::unique_ptr<const Entry>> m_cache;
-    // Order entries were added to the map.
-    std::deque<size_t> m_order;
+    Snapshot m_snapshot;
+    std::atomic<int> m_snapshot_hits{0};
 };
 
 #endif
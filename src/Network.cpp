@@ -37,9 +37,9 @@
 #include <memory>
 #include <sstream>
 #include <string>
+#include <boost/filesystem.hpp>
 #include <boost/utility.hpp>
 #include <boost/format.hpp>
-#include <boost/spirit/home/x3.hpp>
 #ifndef USE_BLAS
 #include <Eigen/Dense>
 #endif
@@ -53,10 +53,10 @@
 #ifdef USE_OPENBLAS
 #include <cblas.h>
 #endif
-#include "zlib.h"
 
 #include "Network.h"
 #include "CPUPipe.h"
+#include "CPUScheduler.h"
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
 #include "UCTNode.h"
@@ -68,13 +68,21 @@
 #include "GTP.h"
 #include "NNCache.h"
 #include "Random.h"
+#include "SearchState.h"
+#include "SGFParser.h"
+#include "SGFTree.h"
+#include "Symmetry.h"
 #include "ThreadPool.h"
 #include "Timing.h"
 #include "Utils.h"
+#include "WeightsFile.h"
 
-namespace x3 = boost::spirit::x3;
 using namespace Utils;
 
+// Bump when the transformed weights change layout or meaning, so
+// caches made by older versions are ignored.
+static constexpr auto WEIGHTS_CACHE_VERSION = 1;
+
 #ifndef USE_BLAS
 // Eigen helpers
 template <typename T>
@@ -88,10 +96,6 @@ using ConstEigenMatrixMap =
     Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
 #endif
 
-// Symmetry helper
-static std::array<std::array<int, NUM_INTERSECTIONS>,
-                  Network::NUM_SYMMETRIES> symmetry_nn_idx_table;
-
 float Network::benchmark_time(int centiseconds) {
     const auto cpus = cfg_num_threads;
 
@@ -224,74 +228,50 @@ std::vector<float> Network::winograd_transform_f(const std::vector<float>& f,
     return U;
 }
 
-std::pair<int, int> Network::load_v1_network(std::istream& wtfile) {
+std::pair<int, int> Network::load_v1_network(WeightsFile::Tensors&& network,
+                                             const bool transformed) {
     // Count size of the network
     myprintf("Detecting residual layers...");
     // We are version 1 or 2
-    if (m_value_head_not_stm) {
-        myprintf("v%d...", 2);
-    } else {
-        myprintf("v%d...", 1);
-    }
-    // First line was the version number
-    auto linecount = size_t{1};
-    auto channels = 0;
-    auto line = std::string{};
-    while (std::getline(wtfile, line)) {
-        auto iss = std::stringstream{line};
-        // Third line of parameters are the convolution layer biases,
-        // so this tells us the amount of channels in the residual layers.
-        // We are assuming all layers have the same amount of filters.
-        if (linecount == 2) {
-            auto count = std::distance(std::istream_iterator<std::string>(iss),
-                                       std::istream_iterator<std::string>());
-            myprintf("%d channels...", count);
-            channels = count;
-        }
-        linecount++;
-    }
-    // 1 format id, 1 input layer (4 x weights), 14 ending weights,
+    myprintf("v%d...", network.version);
+    // Version 2 networks are identical to v1, except
+    // that they return the value for black instead of
+    // the player to move. This is used by ELF Open Go.
+    m_value_head_not_stm = (network.version == 2);
+
+    auto& tensors = network.tensors;
+    // Second line of parameters are the convolution layer biases,
+    // so this tells us the amount of channels in the residual layers.
+    // We are assuming all layers have the same amount of filters.
+    const auto channels = tensors.size() > 1 ? int(tensors[1].size()) : 0;
+    myprintf("%d channels...", channels);
+    // 1 input layer (4 x weights), 14 ending weights,
     // the rest are residuals, every residual has 8 x weight lines
-    auto residual_blocks = linecount - (1 + 4 + 14);
-    if (residual_blocks % 8 != 0) {
+    if (tensors.size() < 4 + 14 || (tensors.size() - (4 + 14)) % 8 != 0) {
         myprintf("\nInconsistent number of weights in the file.\n");
         return {0, 0};
     }
-    residual_blocks /= 8;
+    const auto residual_blocks = (tensors.size() - (4 + 14)) / 8;
     myprintf("%d blocks.\n", residual_blocks);
 
-    // Re-read file and process
-    wtfile.clear();
-    wtfile.seekg(0, std::ios::beg);
-
-    // Get the file format id out of the way
-    std::getline(wtfile, line);
-
     const auto plain_conv_layers = 1 + (residual_blocks * 2);
     const auto plain_conv_wts = plain_conv_layers * 4;
-    linecount = 0;
-    while (std::getline(wtfile, line)) {
-        std::vector<float> weights;
-        auto it_line = line.cbegin();
-        const auto ok = phrase_parse(it_line, line.cend(),
-                                     *x3::float_, x3::space, weights);
-        if (!ok || it_line != line.cend()) {
-            myprintf("\nFailed to parse weight file. Error on line %d.\n",
-                    linecount + 2); //+1 from version line, +1 from 0-indexing
-            return {0, 0};
-        }
+    for (auto linecount = size_t{0}; linecount < tensors.size(); linecount++) {
+        auto& weights = tensors[linecount];
         if (linecount < plain_conv_wts) {
             if (linecount % 4 == 0) {
-                m_fwd_weights->m_conv_weights.emplace_back(weights);
+                m_fwd_weights->m_conv_weights.emplace_back(std::move(weights));
             } else if (linecount % 4 == 1) {
                 // Redundant in our model, but they encode the
                 // number of outputs so we have to read them in.
-                m_fwd_weights->m_conv_biases.emplace_back(weights);
+                m_fwd_weights->m_conv_biases.emplace_back(std::move(weights));
             } else if (linecount % 4 == 2) {
-                m_fwd_weights->m_batchnorm_means.emplace_back(weights);
+                m_fwd_weights->m_batchnorm_means.emplace_back(std::move(weights));
             } else if (linecount % 4 == 3) {
-                process_bn_var(weights);
-                m_fwd_weights->m_batchnorm_stddevs.emplace_back(weights);
+                if (!transformed) {
+                    process_bn_var(weights);
+                }
+                m_fwd_weights->m_batchnorm_stddevs.emplace_back(std::move(weights));
             }
         } else {
             switch (linecount - plain_conv_wts) {
@@ -328,62 +308,138 @@ std::pair<int, int> Network::load_v1_network(std::istream& wtfile) {
                                    begin(m_ip2_val_b)); break;
             }
         }
-        linecount++;
     }
-    process_bn_var(m_bn_pol_w2);
-    process_bn_var(m_bn_val_w2);
+    if (!transformed) {
+        process_bn_var(m_bn_pol_w2);
+        process_bn_var(m_bn_val_w2);
+    }
 
     return {channels, static_cast<int>(residual_blocks)};
 }
 
-std::pair<int, int> Network::load_network_file(const std::string& filename) {
-    // gzopen supports both gz and non-gz files, will decompress
-    // or just read directly as needed.
-    auto gzhandle = gzopen(filename.c_str(), "rb");
-    if (gzhandle == nullptr) {
-        myprintf("Could not open weights file: %s\n", filename.c_str());
+std::pair<int, int> Network::load_network_file(const std::string& filename,
+                                               WeightsFile::ReadTimes& times) {
+    auto weights = WeightsFile::Tensors{};
+    if (!WeightsFile::read(filename, weights,
+                           std::max(cfg_num_threads, 1u), &times)) {
         return {0, 0};
     }
-    // Stream the gz file in to a memory buffer stream.
-    auto buffer = std::stringstream{};
-    constexpr auto chunkBufferSize = 64 * 1024;
-    std::vector<char> chunkBuffer(chunkBufferSize);
-    while (true) {
-        auto bytesRead = gzread(gzhandle, chunkBuffer.data(), chunkBufferSize);
-        if (bytesRead == 0) break;
-        if (bytesRead < 0) {
-            myprintf("Failed to decompress or read: %s\n", filename.c_str());
-            gzclose(gzhandle);
-            return {0, 0};
+    return load_v1_network(std::move(weights), false);
+}
+
+void Network::transform_weights(const size_t channels,
+                                const size_t residual_blocks) {
+    auto weight_index = size_t{0};
+    // Input convolution
+    // Winograd transform convolution weights
+    m_fwd_weights->m_conv_weights[weight_index] =
+        winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index],
+                             channels, INPUT_CHANNELS);
+    weight_index++;
+
+    // Residual block convolutions
+    for (auto i = size_t{0}; i < residual_blocks * 2; i++) {
+        m_fwd_weights->m_conv_weights[weight_index] =
+            winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index],
+                                 channels, channels);
+        weight_index++;
+    }
+
+    // Biases are not calculated and are typically zero but some networks might
+    // still have non-zero biases.
+    // Move biases to batchnorm means to make the output match without having
+    // to separately add the biases.
+    auto bias_size = m_fwd_weights->m_conv_biases.size();
+    for (auto i = size_t{0}; i < bias_size; i++) {
+        auto means_size = m_fwd_weights->m_batchnorm_means[i].size();
+        for (auto j = size_t{0}; j < means_size; j++) {
+            m_fwd_weights->m_batchnorm_means[i][j] -= m_fwd_weights->m_conv_biases[i][j];
+            m_fwd_weights->m_conv_biases[i][j] = 0.0f;
         }
-        assert(bytesRead <= chunkBufferSize);
-        buffer.write(chunkBuffer.data(), bytesRead);
     }
-    gzclose(gzhandle);
-
-    // Read format version
-    auto line = std::string{};
-    auto format_version = -1;
-    if (std::getline(buffer, line)) {
-        auto iss = std::stringstream{line};
-        // First line is the file format version id
-        iss >> format_version;
-        if (iss.fail() || (format_version != 1 && format_version != 2)) {
-            myprintf("Weights file is the wrong version.\n");
-            return {0, 0};
-        } else {
-            // Version 2 networks are identical to v1, except
-            // that they return the value for black instead of
-            // the player to move. This is used by ELF Open Go.
-            if (format_version == 2) {
-                m_value_head_not_stm = true;
-            } else {
-                m_value_head_not_stm = false;
-            }
-            return load_v1_network(buffer);
+
+    for (auto i = size_t{0}; i < m_bn_val_w1.size(); i++) {
+        m_bn_val_w1[i] -= m_fwd_weights->m_conv_val_b[i];
+        m_fwd_weights->m_conv_val_b[i] = 0.0f;
+    }
+
+    for (auto i = size_t{0}; i < m_bn_pol_w1.size(); i++) {
+        m_bn_pol_w1[i] -= m_fwd_weights->m_conv_pol_b[i];
+        m_fwd_weights->m_conv_pol_b[i] = 0.0f;
+    }
+}
+
+std::string Network::weights_cache_file(const std::string& fingerprint) {
+    // The transform is the same for every backend and precision, so
+    // only the network and the layout of the transformed weights go
+    // into the name.
+    return Utils::leelaz_file(
+        boost::str(boost::format("weights-cache-v%d-w%d-%s")
+                   % WEIGHTS_CACHE_VERSION % WINOGRAD_ALPHA % fingerprint));
+}
+
+std::pair<int, int> Network::load_weights_cache(const std::string& filename,
+                                                WeightsFile::ReadTimes& times) {
+    auto weights = WeightsFile::Tensors{};
+    if (!WeightsFile::read(filename, weights, 1, &times)) {
+        return {0, 0};
+    }
+    myprintf("Using transformed weights from %s.\n", filename.c_str());
+    return load_v1_network(std::move(weights), true);
+}
+
+void Network::save_weights_cache(const std::string& filename) {
+    // Borrow the tower weights rather than copying them, and lay all
+    // tensors out in the order of the text format.
+    auto weights = WeightsFile::Tensors{};
+    weights.version = m_value_head_not_stm ? 2 : 1;
+    auto& tensors = weights.tensors;
+    auto& fwd = *m_fwd_weights;
+    for (auto i = size_t{0}; i < fwd.m_conv_weights.size(); i++) {
+        tensors.emplace_back(std::move(fwd.m_conv_weights[i]));
+        tensors.emplace_back(std::move(fwd.m_conv_biases[i]));
+        tensors.emplace_back(std::move(fwd.m_batchnorm_means[i]));
+        tensors.emplace_back(std::move(fwd.m_batchnorm_stddevs[i]));
+    }
+    const auto head_begin = tensors.size();
+    tensors.emplace_back(std::move(fwd.m_conv_pol_w));
+    tensors.emplace_back(std::move(fwd.m_conv_pol_b));
+    tensors.emplace_back(begin(m_bn_pol_w1), end(m_bn_pol_w1));
+    tensors.emplace_back(begin(m_bn_pol_w2), end(m_bn_pol_w2));
+    tensors.emplace_back(begin(m_ip_pol_w), end(m_ip_pol_w));
+    tensors.emplace_back(begin(m_ip_pol_b), end(m_ip_pol_b));
+    tensors.emplace_back(std::move(fwd.m_conv_val_w));
+    tensors.emplace_back(std::move(fwd.m_conv_val_b));
+    tensors.emplace_back(begin(m_bn_val_w1), end(m_bn_val_w1));
+    tensors.emplace_back(begin(m_bn_val_w2), end(m_bn_val_w2));
+    tensors.emplace_back(begin(m_ip1_val_w), end(m_ip1_val_w));
+    tensors.emplace_back(begin(m_ip1_val_b), end(m_ip1_val_b));
+    tensors.emplace_back(begin(m_ip2_val_w), end(m_ip2_val_w));
+    tensors.emplace_back(begin(m_ip2_val_b), end(m_ip2_val_b));
+
+    // Several processes may start on the same network at once, so
+    // write to a private file and move it into place.
+    const auto temp_file = filename + boost::filesystem::unique_path(
+        ".%%%%-%%%%-%%%%").string();
+    if (WeightsFile::write_binary(temp_file, weights)) {
+        auto error = boost::system::error_code{};
+        boost::filesystem::rename(temp_file, filename, error);
+        if (!error) {
+            myprintf("Cached transformed weights in %s.\n", filename.c_str());
         }
     }
-    return {0, 0};
+    boost::filesystem::remove(temp_file);
+
+    for (auto i = size_t{0}; i < fwd.m_conv_weights.size(); i++) {
+        fwd.m_conv_weights[i] = std::move(tensors[4 * i]);
+        fwd.m_conv_biases[i] = std::move(tensors[4 * i + 1]);
+        fwd.m_batchnorm_means[i] = std::move(tensors[4 * i + 2]);
+        fwd.m_batchnorm_stddevs[i] = std::move(tensors[4 * i + 3]);
+    }
+    fwd.m_conv_pol_w = std::move(tensors[head_begin]);
+    fwd.m_conv_pol_b = std::move(tensors[head_begin + 1]);
+    fwd.m_conv_val_w = std::move(tensors[head_begin + 6]);
+    fwd.m_conv_val_b = std::move(tensors[head_begin + 7]);
 }
 
 std::unique_ptr<ForwardPipe>&& Network::init_net(int channels,
@@ -395,6 +451,37 @@ std::unique_ptr<ForwardPipe>&& Network::init_net(int channels,
     return std::move(pipe);
 }
 
+void Network::init_cpu_net(int channels) {
+    auto int8_table = std::shared_ptr<const CPUInt8::Table>{};
+    if (cfg_precision == precision_t::INT8) {
+        int8_table = CPUInt8::Table::load(cfg_int8_table);
+        if (!int8_table
+            || !int8_table->fits(m_fwd_weights->m_conv_weights, channels)) {
+            myprintf("Could not load an int8 calibration table for this "
+                     "network from %s.\n", cfg_int8_table.c_str());
+            myprintf("Create one with --int8-calibrate <sgf file>.\n");
+            exit(EXIT_FAILURE);
+        }
+        myprintf("Using int8 calibration table %s, %s kernel.\n",
+                 cfg_int8_table.c_str(),
+                 CPUInt8::kernel_name(CPUFeatures::detect_isa()));
+    }
+    if (!int8_table && CPUFeatures::detect_isa() != CPUFeatures::Isa::SCALAR
+        && CPUGemm::is_specialized(channels)) {
+        myprintf("Using GEMM kernels compiled for %d channels.\n", channels);
+    }
+    if (cfg_batch_size > 1) {
+        myprintf("Initializing CPU-only evaluation (%sbatch size %d).\n",
+                 int8_table ? "int8, " : "", cfg_batch_size);
+        m_forward = init_net(channels,
+                             std::make_unique<CPUScheduler>(int8_table));
+    } else {
+        myprintf("Initializing CPU-only evaluation%s.\n",
+                 int8_table ? " (int8)" : "");
+        m_forward = init_net(channels, std::make_unique<CPUPipe>(int8_table));
+    }
+}
+
 #ifdef USE_HALF
 void Network::select_precision(int channels) {
     if (cfg_precision == precision_t::AUTO) {
@@ -494,73 +581,52 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
 #endif
 
     m_fwd_weights = std::make_shared<ForwardPipeWeights>();
+    m_weightsfile = weightsfile;
 
     // Make a guess at a good size as long as the user doesn't
     // explicitly set a maximum memory usage.
+    m_nncache.set_storage(cfg_nncache_storage);
     m_nncache.set_size_from_playouts(playouts);
 
-    // Prepare symmetry table
-    for (auto s = 0; s < NUM_SYMMETRIES; ++s) {
-        for (auto v = 0; v < NUM_INTERSECTIONS; ++v) {
-            const auto newvtx =
-                get_symmetry({v % BOARD_SIZE, v / BOARD_SIZE}, s);
-            symmetry_nn_idx_table[s][v] =
-                (newvtx.second * BOARD_SIZE) + newvtx.first;
-            assert(symmetry_nn_idx_table[s][v] >= 0
-                   && symmetry_nn_idx_table[s][v] < NUM_INTERSECTIONS);
-        }
-    }
-
-    // Load network from file
+    // Load network from file, or its transformed weights from the cache
     size_t channels, residual_blocks;
-    std::tie(channels, residual_blocks) = load_network_file(weightsfile);
-    if (channels == 0) {
-        exit(EXIT_FAILURE);
-    }
-
-    auto weight_index = size_t{0};
-    // Input convolution
-    // Winograd transform convolution weights
-    m_fwd_weights->m_conv_weights[weight_index] =
-        winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index],
-                             channels, INPUT_CHANNELS);
-    weight_index++;
-
-    // Residual block convolutions
-    for (auto i = size_t{0}; i < residual_blocks * 2; i++) {
-        m_fwd_weights->m_conv_weights[weight_index] =
-            winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index],
-                                 channels, channels);
-        weight_index++;
-    }
-
-    // Biases are not calculated and are typically zero but some networks might
-    // still have non-zero biases.
-    // Move biases to batchnorm means to make the output match without having
-    // to separately add the biases.
-    auto bias_size = m_fwd_weights->m_conv_biases.size();
-    for (auto i = size_t{0}; i < bias_size; i++) {
-        auto means_size = m_fwd_weights->m_batchnorm_means[i].size();
-        for (auto j = size_t{0}; j < means_size; j++) {
-            m_fwd_weights->m_batchnorm_means[i][j] -= m_fwd_weights->m_conv_biases[i][j];
-            m_fwd_weights->m_conv_biases[i][j] = 0.0f;
+    auto read_times = WeightsFile::ReadTimes{};
+    const auto fingerprint = cfg_weights_cache || cfg_shared_weights
+        ? WeightsFile::fingerprint(weightsfile) : std::string{};
+    const auto cache_file = cfg_weights_cache && !fingerprint.empty()
+        ? weights_cache_file(fingerprint) : std::string{};
+    auto cached = false;
+    if (!cache_file.empty() && boost::filesystem::exists(cache_file)) {
+        std::tie(channels, residual_blocks) = load_weights_cache(cache_file,
+                                                                 read_times);
+        cached = (channels != 0);
+        if (!cached) {
+            // Drop whatever a broken cache file got loaded.
+            m_fwd_weights = std::make_shared<ForwardPipeWeights>();
         }
     }
-
-    for (auto i = size_t{0}; i < m_bn_val_w1.size(); i++) {
-        m_bn_val_w1[i] -= m_fwd_weights->m_conv_val_b[i];
-        m_fwd_weights->m_conv_val_b[i] = 0.0f;
+    auto transform_time = 0.0;
+    if (!cached) {
+        std::tie(channels, residual_blocks) = load_network_file(weightsfile,
+                                                                read_times);
+        if (channels == 0) {
+            exit(EXIT_FAILURE);
+        }
+        const Time transform_start;
+        transform_weights(channels, residual_blocks);
+        transform_time = Time::timediff_seconds(transform_start, Time{});
+        if (!cache_file.empty()) {
+            save_weights_cache(cache_file);
+        }
     }
-
-    for (auto i = size_t{0}; i < m_bn_pol_w1.size(); i++) {
-        m_bn_pol_w1[i] -= m_fwd_weights->m_conv_pol_b[i];
-        m_fwd_weights->m_conv_pol_b[i] = 0.0f;
+    if (cfg_shared_weights && !fingerprint.empty()) {
+        m_fwd_weights->m_shared_name = "shared-weights-" + fingerprint;
     }
 
+    const Time backend_start;
 #ifdef USE_OPENCL
     if (cfg_cpu_only) {
-        myprintf("Initializing CPU-only evaluation.\n");
-        m_forward = init_net(channels, std::make_unique<CPUPipe>());
+        init_cpu_net(channels);
     } else {
 #ifdef USE_OPENCL_SELFCHECK
         // initialize CPU reference first, so that we can self-check
@@ -579,13 +645,22 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
     }
 
 #else //!USE_OPENCL
-    myprintf("Initializing CPU-only evaluation.\n");
-    m_forward = init_net(channels, std::make_unique<CPUPipe>());
+    init_cpu_net(channels);
 #endif
+    const Time backend_end;
+    // For OpenCL the last stage also includes tuning and self-checks.
+    myprintf("Network startup: read/decompress %.2fs, parse %.2fs, "
+             "Winograd transform %.2fs, push_weights %.2fs.\n",
+             read_times.read, read_times.parse,
+             transform_time,
+             Time::timediff_seconds(backend_start, backend_end));
 
     // Need to estimate size before clearing up the pipe.
     get_estimated_size();
-    m_fwd_weights.reset();
+    // Calibration builds its own pipes from the weights.
+    if (cfg_int8_calibrate.empty()) {
+        m_fwd_weights.reset();
+    }
 }
 
 template<unsigned int inputs,
@@ -701,39 +776,45 @@ std::vector<float> softmax(const std::vector<float>& input,
     return output;
 }
 
-bool Network::probe_cache(const GameState* const state,
+std::uint64_t Network::cache_key(const FastState* const state,
+                                  int& symmetry) {
+    // If we are not generating a self-play game, symmetric positions
+    // share the entry of the canonical symmetry, which holds the policy
+    // of that symmetry of the board.
+    if (cfg_noise || cfg_random_cnt) {
+        symmetry = IDENTITY_SYMMETRY;
+        return state->board.get_hash();
+    }
+    return state->board.get_canonical_hash(symmetry);
+}
+
+bool Network::probe_cache(const FastState* const state,
                           Network::Netresult& result) {
-    if (m_nncache.lookup(state->board.get_hash(), result)) {
-        return true;
+    auto symmetry = IDENTITY_SYMMETRY;
+    const auto hash = cache_key(state, symmetry);
+    if (!m_nncache.lookup(hash, result)) {
+        return false;
     }
-    // If we are not generating a self-play game, try to find
-    // symmetries if we are in the early opening.
-    if (!cfg_noise && !cfg_random_cnt
-        && state->get_movenum()
-           < (state->get_timecontrol().opening_moves(BOARD_SIZE) / 2)) {
-        for (auto sym = 0; sym < Network::NUM_SYMMETRIES; ++sym) {
-            if (sym == Network::IDENTITY_SYMMETRY) {
-                continue;
-            }
-            const auto hash = state->get_symmetry_hash(sym);
-            if (m_nncache.lookup(hash, result)) {
-                decltype(result.policy) corrected_policy;
-                for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; ++idx) {
-                    const auto sym_idx = symmetry_nn_idx_table[sym][idx];
-                    corrected_policy[idx] = result.policy[sym_idx];
-                }
-                result.policy = std::move(corrected_policy);
-                return true;
-            }
-        }
+    if (symmetry != IDENTITY_SYMMETRY) {
+        decltype(result.policy) corrected_policy;
+        Symmetry::transform(symmetry, result.policy.data(),
+                            corrected_policy.data());
+        result.policy = corrected_policy;
     }
-
-    return false;
+    return true;
 }
 
 Network::Netresult Network::get_output(
     const GameState* const state, const Ensemble ensemble, const int symmetry,
     const bool read_cache, const bool write_cache, const bool force_selfcheck) {
+    const auto search_state = SearchState{*state};
+    return get_output(&search_state, ensemble, symmetry,
+                      read_cache, write_cache, force_selfcheck);
+}
+
+Network::Netresult Network::get_output(
+    const SearchState* const state, const Ensemble ensemble, const int symmetry,
+    const bool read_cache, const bool write_cache, const bool force_selfcheck) {
     Netresult result;
     if (state->board.get_boardsize() != BOARD_SIZE) {
         return result;
@@ -751,8 +832,8 @@ Network::Netresult Network::get_output(
         result = get_output_internal(state, symmetry);
     } else if (ensemble == AVERAGE) {
         assert(symmetry == -1);
-        for (auto sym = 0; sym < NUM_SYMMETRIES; ++sym) {
-            auto tmpresult = get_output_internal(state, sym);
+        const auto results = get_output_symmetries(state);
+        for (const auto& tmpresult : results) {
             result.winrate +=
                 tmpresult.winrate / static_cast<float>(NUM_SYMMETRIES);
             result.policy_pass +=
@@ -763,6 +844,17 @@ Network::Netresult Network::get_output(
                     tmpresult.policy[idx] / static_cast<float>(NUM_SYMMETRIES);
             }
         }
+#ifdef USE_OPENCL_SELFCHECK
+        // The batched evaluation takes its own path through the OpenCL
+        // backend, so check one of its symmetries as well.
+        if (m_forward_cpu != nullptr
+            && (force_selfcheck || Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0)
+        ) {
+            const auto sym = Random::get_Rng().randfix<NUM_SYMMETRIES>();
+            auto result_ref = get_output_internal(state, sym, true);
+            compare_net_outputs(results[sym], result_ref);
+        }
+#endif
     } else {
         assert(ensemble == RANDOM_SYMMETRY);
         assert(symmetry == -1);
@@ -793,14 +885,24 @@ Network::Netresult Network::get_output(
 
     if (write_cache) {
         // Insert result into cache.
-        m_nncache.insert(state->board.get_hash(), result);
+        auto symmetry = IDENTITY_SYMMETRY;
+        const auto hash = cache_key(state, symmetry);
+        if (symmetry == IDENTITY_SYMMETRY) {
+            m_nncache.insert(hash, result);
+        } else {
+            auto canonical = result;
+            Symmetry::transform(Symmetry::inverse(symmetry),
+                                result.policy.data(),
+                                canonical.policy.data());
+            m_nncache.insert(hash, canonical);
+        }
     }
 
     return result;
 }
 
 Network::Netresult Network::get_output_internal(
-    const GameState* const state, const int symmetry, bool selfcheck) {
+    const SearchState* const state, const int symmetry, bool selfcheck) {
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
     constexpr auto width = BOARD_SIZE;
     constexpr auto height = BOARD_SIZE;
@@ -819,6 +921,62 @@ Network::Netresult Network::get_output_internal(
     (void) selfcheck;
 #endif
 
+    return get_output_from_planes(policy_data, value_data, symmetry);
+}
+
+std::array<Network::Netresult, Network::NUM_SYMMETRIES>
+Network::get_output_symmetries(const SearchState* const state) {
+    constexpr auto in_size = INPUT_CHANNELS * NUM_INTERSECTIONS;
+    constexpr auto pol_size = OUTPUTS_POLICY * NUM_INTERSECTIONS;
+    constexpr auto val_size = OUTPUTS_VALUE * NUM_INTERSECTIONS;
+
+    auto input_data = std::vector<float>(NUM_SYMMETRIES * in_size);
+    for (auto sym = 0; sym < NUM_SYMMETRIES; ++sym) {
+        const auto features = gather_features(state, sym);
+        std::copy(begin(features), end(features),
+                  begin(input_data) + sym * in_size);
+    }
+    // In batches of the size the backend was set up for, which is all
+    // of them at once with the usual OpenCL batch sizes.
+    const auto batch_size = std::min(std::max(int(cfg_batch_size), 1),
+                                     NUM_SYMMETRIES);
+    auto policy_batch = std::vector<float>(NUM_SYMMETRIES * pol_size);
+    auto value_batch = std::vector<float>(NUM_SYMMETRIES * val_size);
+    auto chunk_input = std::vector<float>{};
+    auto chunk_policy = std::vector<float>{};
+    auto chunk_value = std::vector<float>{};
+    for (auto first = 0; first < NUM_SYMMETRIES; first += batch_size) {
+        const auto count = std::min(batch_size, NUM_SYMMETRIES - first);
+        chunk_input.assign(begin(input_data) + first * in_size,
+                           begin(input_data) + (first + count) * in_size);
+        chunk_policy.resize(count * pol_size);
+        chunk_value.resize(count * val_size);
+        m_forward->forward_batch(chunk_input, chunk_policy, chunk_value,
+                                 count);
+        std::copy(begin(chunk_policy), end(chunk_policy),
+                  begin(policy_batch) + first * pol_size);
+        std::copy(begin(chunk_value), end(chunk_value),
+                  begin(value_batch) + first * val_size);
+    }
+
+    auto results = std::array<Netresult, NUM_SYMMETRIES>{};
+    auto policy_data = std::vector<float>(pol_size);
+    auto value_data = std::vector<float>(val_size);
+    for (auto sym = 0; sym < NUM_SYMMETRIES; ++sym) {
+        std::copy(begin(policy_batch) + sym * pol_size,
+                  begin(policy_batch) + (sym + 1) * pol_size,
+                  begin(policy_data));
+        std::copy(begin(value_batch) + sym * val_size,
+                  begin(value_batch) + (sym + 1) * val_size,
+                  begin(value_data));
+        results[sym] = get_output_from_planes(policy_data, value_data, sym);
+    }
+    return results;
+}
+
+Network::Netresult Network::get_output_from_planes(
+    std::vector<float>& policy_data, std::vector<float>& value_data,
+    const int symmetry) {
     // Get the moves
     batchnorm<NUM_INTERSECTIONS>(OUTPUTS_POLICY, policy_data,
         m_bn_pol_w1.data(), m_bn_pol_w2.data());
@@ -841,10 +999,8 @@ Network::Netresult Network::get_output_internal(
 
     Netresult result;
 
-    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        result.policy[sym_idx] = outputs[idx];
-    }
+    Symmetry::transform(Symmetry::inverse(symmetry), outputs.data(),
+                        result.policy.data());
 
     result.policy_pass = outputs[NUM_INTERSECTIONS];
     result.winrate = winrate;
@@ -852,6 +1008,134 @@ Network::Netresult Network::get_output_internal(
     return result;
 }
 
+void Network::calibrate_int8(const std::string& sgf_name,
+                             const std::string& table_name) {
+    // Every CALIBRATION_STRIDE-th position of each game, until
+    // CALIBRATION_POSITIONS are collected.  Even positions calibrate,
+    // odd ones are kept aside to measure the error.
+    constexpr auto CALIBRATION_POSITIONS = size_t{400};
+    constexpr auto CALIBRATION_STRIDE = 7;
+
+    auto inputs = std::vector<std::vector<float>>{};
+    auto symmetries = std::vector<int>{};
+    auto games = SGFParser::chop_all(sgf_name);
+    auto used_games = 0;
+    for (const auto& game : games) {
+        if (inputs.size() >= CALIBRATION_POSITIONS) {
+            break;
+        }
+        auto sgftree = std::make_unique<SGFTree>();
+        try {
+            sgftree->load_from_string(game);
+        } catch (...) {
+            continue;
+        }
+        const auto moves = sgftree->get_mainline().size();
+        if (moves == 0) {
+            continue;
+        }
+        used_games++;
+        for (auto movenum = size_t{0}; movenum < moves
+             && inputs.size() < CALIBRATION_POSITIONS;
+             movenum += CALIBRATION_STRIDE) {
+            const auto state = sgftree->follow_mainline_state(movenum);
+            if (state.board.get_boardsize() != BOARD_SIZE) {
+                break;
+            }
+            const auto symmetry = int(inputs.size() % NUM_SYMMETRIES);
+            inputs.emplace_back(gather_features(&state, symmetry));
+            symmetries.emplace_back(symmetry);
+        }
+    }
+    if (inputs.size() < 2) {
+        myprintf("Not enough positions in %s to calibrate int8.\n",
+                 sgf_name.c_str());
+        return;
+    }
+
+    const auto channels = m_fwd_weights->m_batchnorm_means[0].size();
+    const auto layers = m_fwd_weights->m_conv_weights.size();
+    auto policy_data = std::vector<float>(OUTPUTS_POLICY * NUM_INTERSECTIONS);
+    auto value_data = std::vector<float>(OUTPUTS_VALUE * NUM_INTERSECTIONS);
+
+    auto table = std::make_shared<CPUInt8::Table>(layers);
+    auto fp32_net = std::make_unique<CPUPipe>();
+    fp32_net->initialize(channels);
+    fp32_net->push_weights(WINOGRAD_ALPHA, INPUT_CHANNELS, channels,
+                           m_fwd_weights);
+
+    auto reference = std::vector<Netresult>{};
+    for (auto i = size_t{0}; i < inputs.size(); i++) {
+        // Only record the calibration half.
+        fp32_net->set_int8_calibration(i % 2 == 0 ? table : nullptr);
+        fp32_net->forward(inputs[i], policy_data, value_data);
+        reference.emplace_back(
+            get_output_from_planes(policy_data, value_data, symmetries[i]));
+    }
+    myprintf("Calibrated int8 on %d positions from %d games.\n",
+             int((inputs.size() + 1) / 2), used_games);
+    if (!table->save(table_name)) {
+        myprintf("Could not write int8 calibration table %s.\n",
+                 table_name.c_str());
+        return;
+    }
+    myprintf("Wrote int8 calibration table to %s.\n", table_name.c_str());
+
+    auto int8_net = std::make_unique<CPUPipe>(table);
+    int8_net->initialize(channels);
+    int8_net->push_weights(WINOGRAD_ALPHA, INPUT_CHANNELS, channels,
+                           m_fwd_weights);
+
+    // Same L2 error measure as compare_net_outputs, which is what the
+    // OpenCL self-check tolerates up to 0.2.
+    auto count = 0;
+    auto l2_sum = 0.0f, l2_max = 0.0f;
+    auto policy_max = 0.0f;
+    auto winrate_sum = 0.0f, winrate_max = 0.0f;
+    auto same_top_move = 0;
+    for (auto i = size_t{1}; i < inputs.size(); i += 2) {
+        int8_net->forward(inputs[i], policy_data, value_data);
+        const auto data =
+            get_output_from_planes(policy_data, value_data, symmetries[i]);
+        const auto& ref = reference[i];
+
+        auto error = 0.0f;
+        for (auto idx = size_t{0}; idx < data.policy.size(); ++idx) {
+            const auto diff = data.policy[idx] - ref.policy[idx];
+            error += diff * diff;
+            policy_max = std::max(policy_max, std::abs(diff));
+        }
+        const auto diff_pass = data.policy_pass - ref.policy_pass;
+        const auto diff_winrate = data.winrate - ref.winrate;
+        error += diff_pass * diff_pass;
+        error += diff_winrate * diff_winrate;
+        error = std::sqrt(error);
+        policy_max = std::max(policy_max, std::abs(diff_pass));
+
+        l2_sum += error;
+        l2_max = std::max(l2_max, error);
+        winrate_sum += std::abs(diff_winrate);
+        winrate_max = std::max(winrate_max, std::abs(diff_winrate));
+
+        const auto top_move = [](const Netresult& result) {
+            const auto best = std::max_element(begin(result.policy),
+                                               end(result.policy));
+            return *best < result.policy_pass ?
+                NUM_INTERSECTIONS : int(std::distance(begin(result.policy), best));
+        };
+        same_top_move += top_move(data) == top_move(ref);
+        count++;
+    }
+
+    myprintf("Int8 vs. single precision on %d held out positions:\n", count);
+    myprintf("L2 error:         mean %.4f, max %.4f\n",
+             l2_sum / count, l2_max);
+    myprintf("Policy error:     max %.4f\n", policy_max);
+    myprintf("Winrate error:    mean %.4f, max %.4f\n",
+             winrate_sum / count, winrate_max);
+    myprintf("Same best move:   %.1f%%\n", 100.0f * same_top_move / count);
+}
+
 void Network::show_heatmap(const FastState* const state,
                            const Netresult& result,
                            const bool topmoves) {
@@ -905,25 +1189,25 @@ void Network::show_heatmap(const FastState* const state,
     }
 }
 
-void Network::fill_input_plane_pair(const FullBoard& board,
+void Network::fill_input_plane_pair(const FastBoard::plane_t& black_plane,
+                                    const FastBoard::plane_t& white_plane,
                                     std::vector<float>::iterator black,
                                     std::vector<float>::iterator white,
                                     const int symmetry) {
-    for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        const auto x = sym_idx % BOARD_SIZE;
-        const auto y = sym_idx / BOARD_SIZE;
-        const auto color = board.get_state(x, y);
-        if (color == FastBoard::BLACK) {
-            black[idx] = float(true);
-        } else if (color == FastBoard::WHITE) {
-            white[idx] = float(true);
-        }
-    }
+    Symmetry::unpack(symmetry, black_plane, &*black);
+    Symmetry::unpack(symmetry, white_plane, &*white);
 }
 
 std::vector<float> Network::gather_features(const GameState* const state,
                                             const int symmetry) {
+    const auto search_state = SearchState{*state};
+    return gather_features(&search_state, symmetry);
+}
+
+std::vector<float> Network::gather_features(const SearchState* const state,
+                                            const int symmetry) {
+    static_assert(INPUT_MOVES <= SearchState::PAST_POSITIONS,
+                  "SearchState keeps too few positions for the inputs");
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
     auto input_data = std::vector<float>(INPUT_CHANNELS * NUM_INTERSECTIONS);
 
@@ -944,7 +1228,8 @@ std::vector<float> Network::gather_features(const GameState* const state,
     // Go back in time, fill history boards
     for (auto h = size_t{0}; h < moves; h++) {
         // collect white, black occupation planes
-        fill_input_plane_pair(state->get_past_board(h),
+        fill_input_plane_pair(state->get_past_plane(h, FastBoard::BLACK),
+                              state->get_past_plane(h, FastBoard::WHITE),
                               black_it + h * NUM_INTERSECTIONS,
                               white_it + h * NUM_INTERSECTIONS,
                               symmetry);
@@ -1033,3 +1318,32 @@ size_t Network::get_estimated_cache_size() {
 void Network::nncache_resize(int max_count) {
     return m_nncache.resize(max_count);
 }
+
+std::string Network::nncache_stamp() {
+    if (m_nncache_stamp.empty()) {
+        const auto fingerprint = WeightsFile::fingerprint(m_weightsfile);
+        if (!fingerprint.empty()) {
+            // The policy is stored after the softmax.
+            // Self-play doesn't key by canonical hashes, see cache_key.
+            m_nncache_stamp = boost::str(boost::format("%s-softmax-%g-%s")
+                                         % fingerprint % cfg_softmax_temp
+                                         % (cfg_noise || cfg_random_cnt
+                                            ? "direct" : "canonical"));
+        }
+    }
+    return m_nncache_stamp;
+}
+
+bool Network::nncache_save(const std::string& filename) {
+    const auto stamp = nncache_stamp();
+    return !stamp.empty() && m_nncache.save(filename, stamp);
+}
+
+bool Network::nncache_load(const std::string& filename, const bool shared) {
+    const auto stamp = nncache_stamp();
+    if (stamp.empty()) {
+        return false;
+    }
+    return shared ? m_nncache.map(filename, stamp)
+                  : m_nncache.load(filename, stamp);
+}
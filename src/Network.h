@@ -47,6 +47,8 @@
 #endif
 #include "GameState.h"
 #include "ForwardPipe.h"
+#include "SearchState.h"
+#include "WeightsFile.h"
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
 #endif
@@ -74,6 +76,12 @@ public:
     using PolicyVertexPair = std::pair<float,int>;
     using Netresult = NNCache::Netresult;
 
+    Netresult get_output(const SearchState* const state,
+                         const Ensemble ensemble,
+                         const int symmetry = -1,
+                         const bool read_cache = true,
+                         const bool write_cache = true,
+                         const bool force_selfcheck = false);
     Netresult get_output(const GameState* const state,
                          const Ensemble ensemble,
                          const int symmetry = -1,
@@ -88,13 +96,22 @@ public:
     static constexpr auto VALUE_LAYER = 256;
 
     void initialize(int playouts, const std::string & weightsfile);
+    // Cache of transform_weights() output in the leelaz data directory,
+    // named after the WeightsFile::fingerprint of the weights file.
+    static std::string weights_cache_file(const std::string& fingerprint);
 
     float benchmark_time(int centiseconds);
     void benchmark(const GameState * const state,
                    const int iterations = 1600);
     static void show_heatmap(const FastState * const state,
                              const Netresult & netres, const bool topmoves);
+    // Record int8 activation ranges on positions from an SGF file, save
+    // them to table_name and report the int8 error against fp32.
+    void calibrate_int8(const std::string& sgf_name,
+                        const std::string& table_name);
 
+    static std::vector<float> gather_features(const SearchState* const state,
+                                              const int symmetry);
     static std::vector<float> gather_features(const GameState* const state,
                                               const int symmetry);
     static std::pair<int, int> get_symmetry(const std::pair<int, int>& vertex,
@@ -104,10 +121,25 @@ public:
     size_t get_estimated_size();
     size_t get_estimated_cache_size();
     void nncache_resize(int max_count);
+    // Save or load the NNCache, see NNCache::save.  With shared the
+    // file is mapped read-only instead of loaded.
+    bool nncache_save(const std::string& filename);
+    bool nncache_load(const std::string& filename, const bool shared);
 
 private:
-    std::pair<int, int> load_v1_network(std::istream& wtfile);
-    std::pair<int, int> load_network_file(const std::string& filename);
+    // Tensors in the order of the text format.  Transformed tensors come
+    // from the weights cache and have had all preprocessing applied.
+    std::pair<int, int> load_v1_network(WeightsFile::Tensors&& network,
+                                        const bool transformed);
+    std::pair<int, int> load_network_file(const std::string& filename,
+                                          WeightsFile::ReadTimes& times);
+    // Winograd transform the convolutions and fold the biases into the
+    // batchnorm means.
+    void transform_weights(const size_t channels,
+                           const size_t residual_blocks);
+    std::pair<int, int> load_weights_cache(const std::string& filename,
+                                           WeightsFile::ReadTimes& times);
+    void save_weights_cache(const std::string& filename);
 
     static std::vector<float> winograd_transform_f(const std::vector<float>& f,
                                                    const int outputs, const int channels);
@@ -129,15 +161,26 @@ private:
     static void winograd_sgemm(const std::vector<float>& U,
                                const std::vector<float>& V,
                                std::vector<float>& M, const int C, const int K);
-    Netresult get_output_internal(const GameState* const state,
+    Netresult get_output_internal(const SearchState* const state,
                                   const int symmetry, bool selfcheck = false);
-    static void fill_input_plane_pair(const FullBoard& board,
+    // All symmetries of state, evaluated as one batch.
+    std::array<Netresult, NUM_SYMMETRIES>
+    get_output_symmetries(const SearchState* const state);
+    Netresult get_output_from_planes(std::vector<float>& policy_data,
+                                     std::vector<float>& value_data,
+                                     const int symmetry);
+    static void fill_input_plane_pair(const FastBoard::plane_t& black_plane,
+                                      const FastBoard::plane_t& white_plane,
                                       std::vector<float>::iterator black,
                                       std::vector<float>::iterator white,
                                       const int symmetry);
-    bool probe_cache(const GameState* const state, Network::Netresult& result);
+    // NNCache key of state and the symmetry of the board it belongs to.
+    static std::uint64_t cache_key(const FastState* const state,
+                                   int& symmetry);
+    bool probe_cache(const FastState* const state, Network::Netresult& result);
     std::unique_ptr<ForwardPipe>&& init_net(int channels,
                                             std::unique_ptr<ForwardPipe>&& pipe);
+    void init_cpu_net(int channels);
 #ifdef USE_HALF
     void select_precision(int channels);
 #endif
@@ -147,7 +190,13 @@ private:
     std::unique_ptr<ForwardPipe> m_forward_cpu;
 #endif
 
-    NNCache m_nncache;
+    // Sized by initialize(), start small rather than allocating the
+    // largest possible cache.
+    NNCache m_nncache{NNCache::MIN_CACHE_COUNT};
+    // What cached results depend on, for NNCache snapshots.
+    std::string nncache_stamp();
+    std::string m_weightsfile;
+    std::string m_nncache_stamp;
 
     size_t estimated_size{0};
 
@@ -277,7 +277,47 @@ void OpenCLScheduler<net_t>::forward(const std::vector<float>& input,
         }
     }
     m_cv.notify_one();
-    entry->cv.wait(lk);
+    entry->cv.wait(lk, [&entry] () { return entry->done; });
+}
+
+template <typename net_t>
+void OpenCLScheduler<net_t>::forward_batch(const std::vector<float>& input,
+                                           std::vector<float>& output_pol,
+                                           std::vector<float>& output_val,
+                                           const int batch_size) {
+    const auto in_size = input.size() / batch_size;
+    const auto pol_size = output_pol.size() / batch_size;
+    const auto val_size = output_val.size() / batch_size;
+    auto inputs = std::vector<std::vector<float>>(batch_size);
+    auto pols = std::vector<std::vector<float>>(batch_size,
+                                                std::vector<float>(pol_size));
+    auto vals = std::vector<std::vector<float>>(batch_size,
+                                                std::vector<float>(val_size));
+    auto entries = std::vector<std::shared_ptr<ForwardQueueEntry>>{};
+    for (auto i = 0; i < batch_size; i++) {
+        inputs[i].assign(begin(input) + i * in_size,
+                         begin(input) + (i + 1) * in_size);
+        entries.emplace_back(
+            std::make_shared<ForwardQueueEntry>(inputs[i], pols[i], vals[i]));
+    }
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        for (auto& entry : entries) {
+            m_forward_queue.push_back(entry);
+        }
+    }
+    m_cv.notify_all();
+    for (auto i = 0; i < batch_size; i++) {
+        auto& entry = entries[i];
+        {
+            std::unique_lock<std::mutex> lk(entry->mutex);
+            entry->cv.wait(lk, [&entry] () { return entry->done; });
+        }
+        std::copy(begin(pols[i]), end(pols[i]),
+                  begin(output_pol) + i * pol_size);
+        std::copy(begin(vals[i]), end(vals[i]),
+                  begin(output_val) + i * val_size);
+    }
 }
 
 #ifndef NDEBUG
@@ -393,12 +433,16 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
         // Get output and copy back
         index = 0;
         for (auto & x : inputs) {
-            std::copy(begin(batch_output_pol) + out_pol_size * index,
-                      begin(batch_output_pol) + out_pol_size * (index + 1),
-                      begin(x->out_p));
-            std::copy(begin(batch_output_val) + out_val_size * index,
-                      begin(batch_output_val) + out_val_size * (index + 1),
-                      begin(x->out_v));
+            {
+                std::unique_lock<std::mutex> lk(x->mutex);
+                std::copy(begin(batch_output_pol) + out_pol_size * index,
+                          begin(batch_output_pol) + out_pol_size * (index + 1),
+                          begin(x->out_p));
+                std::copy(begin(batch_output_val) + out_val_size * index,
+                          begin(batch_output_val) + out_val_size * (index + 1),
+                          begin(x->out_v));
+                x->done = true;
+            }
             x->cv.notify_all();
             index++;
         }
@@ -54,6 +54,7 @@ class OpenCLScheduler : public ForwardPipe {
     public:
         std::mutex mutex;
         std::condition_variable cv;
+        bool done{false};
         const std::vector<float>& in;
         std::vector<float>& out_p;
         std::vector<float>& out_v;
@@ -71,6 +72,11 @@ public:
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val);
+    // Queues all positions at once, so they can share a batch.
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const int batch_size);
     virtual bool needs_autodetect();
     virtual void push_weights(unsigned int filter_size,
                               unsigned int channels,
@@ -0,0 +1,235 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+
+#include "PUCT.h"
+#include "FastBoard.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PUCT_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+    // No a * b + c in here or in the kernel, so that neither side can be
+    // contracted into a fused multiply-add and round differently.
+    float score(const UCTNodeChildren& children, const size_t i,
+                const PUCT::Params& params,
+                const std::function<bool(size_t)>& busy) {
+        const auto visits = float(children.visits()[i].load());
+        const auto virtual_loss = float(children.virtual_loss()[i].load());
+        auto winrate = params.fpu_eval;
+        if (virtual_loss > 0.0f && busy(i)) {
+            winrate = params.busy_eval;
+        } else if (visits > 0.0f) {
+            // As get_raw_eval(color, virtual_loss) on the child.
+            auto blackeval = children.blackevals()[i].load();
+            if (params.color == FastBoard::WHITE) {
+                blackeval += virtual_loss;
+            }
+            winrate = blackeval / (visits + virtual_loss);
+            if (params.color == FastBoard::WHITE) {
+                winrate = 1.0f - winrate;
+            }
+        }
+        const auto puct = (children.policy()[i] * params.puct_scale)
+                          / (1.0f + visits);
+        return winrate + puct;
+    }
+
+    // Goes on from begin with the best child so far, best_value being
+    // lowest() if there is none yet.
+    size_t select_scalar(const UCTNodeChildren& children,
+                         const PUCT::Params& params,
+                         const std::function<bool(size_t)>& busy,
+                         const size_t begin, size_t best, float best_value) {
+        for (auto i = begin; i < children.size(); i++) {
+            if (children.status()[i] != params.active_status) {
+                continue;
+            }
+            const auto value = score(children, i, params, busy);
+            assert(value > std::numeric_limits<float>::lowest());
+            if (value > best_value) {
+                best_value = value;
+                best = i;
+            }
+        }
+        return best;
+    }
+
+#ifdef PUCT_SIMD
+    // The kernel reads the atomic statistics with vector loads of the
+    // values underneath, which needs every atomic to be just its value.
+    // float atomics are lock free whenever int ones are on x86.
+    static_assert(sizeof(std::atomic<float>) == sizeof(float)
+                  && sizeof(std::atomic<int>) == sizeof(int)
+                  && sizeof(std::atomic<std::int16_t>) == sizeof(std::int16_t)
+                  && sizeof(std::atomic<std::uint8_t>) == sizeof(std::uint8_t),
+                  "atomic statistics must have the layout of their values");
+    static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_SHORT_LOCK_FREE == 2
+                  && ATOMIC_CHAR_LOCK_FREE == 2,
+                  "atomic statistics must be lock free");
+
+    // 8 children per iteration, the rest in select_scalar.  Every value is
+    // naturally aligned, so none is read torn, but the 8 children of a
+    // vector are no snapshot: other threads can update some of them in
+    // between.  That is all the relaxed loads of select_scalar give too,
+    // and selection already races with the updates of the other threads,
+    // so scoring a child one update late is fine.
+    __attribute__((target("avx2")))
+    size_t select_avx2(const UCTNodeChildren& children,
+                       const PUCT::Params& params,
+                       const std::function<bool(size_t)>& busy) {
+        const auto size = children.size();
+        const auto blackevals =
+            reinterpret_cast<const float*>(children.blackevals());
+        const auto policy = children.policy();
+        const auto visits_in =
+            reinterpret_cast<const int*>(children.visits());
+        const auto virtual_loss_in =
+            reinterpret_cast<const std::int16_t*>(children.virtual_loss());
+        const auto status =
+            reinterpret_cast<const std::uint8_t*>(children.status());
+
+        const auto white = params.color == FastBoard::WHITE;
+        const auto active = _mm256_set1_epi32(params.active_status);
+        const auto zero = _mm256_setzero_si256();
+        const auto one = _mm256_set1_ps(1.0f);
+        const auto fpu_eval = _mm256_set1_ps(params.fpu_eval);
+        const auto busy_eval = _mm256_set1_ps(params.busy_eval);
+        const auto puct_scale = _mm256_set1_ps(params.puct_scale);
+        const auto lowest =
+            _mm256_set1_ps(std::numeric_limits<float>::lowest());
+
+        auto best_values = lowest;
+        auto best_indices = zero;
+        auto indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const auto eight = _mm256_set1_epi32(8);
+
+        auto i = size_t{0};
+        for (; i + 8 <= size; i += 8) {
+            const auto selectable = _mm256_cmpeq_epi32(
+                _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                    reinterpret_cast<const __m128i*>(status + i))),
+                active);
+            const auto visits_i = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(visits_in + i));
+            const auto virtual_loss_i = _mm256_cvtepi16_epi32(_mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(virtual_loss_in + i)));
+            const auto visits = _mm256_cvtepi32_ps(visits_i);
+            const auto virtual_loss = _mm256_cvtepi32_ps(virtual_loss_i);
+
+            auto blackeval = _mm256_loadu_ps(blackevals + i);
+            if (white) {
+                blackeval = _mm256_add_ps(blackeval, virtual_loss);
+            }
+            auto eval = _mm256_div_ps(blackeval,
+                                      _mm256_add_ps(visits, virtual_loss));
+            if (white) {
+                eval = _mm256_sub_ps(one, eval);
+            }
+            auto winrate = _mm256_blendv_ps(
+                fpu_eval, eval,
+                _mm256_castsi256_ps(_mm256_cmpgt_epi32(visits_i, zero)));
+
+            // Only with more than one search thread.
+            const auto loss_mask = _mm256_movemask_ps(_mm256_castsi256_ps(
+                _mm256_cmpgt_epi32(virtual_loss_i, zero)));
+            if (loss_mask) {
+                alignas(32) int busy_lanes[8] = {};
+                for (auto lane = 0; lane < 8; lane++) {
+                    if ((loss_mask >> lane) & 1) {
+                        busy_lanes[lane] = busy(i + lane) ? -1 : 0;
+                    }
+                }
+                winrate = _mm256_blendv_ps(
+                    winrate, busy_eval,
+                    _mm256_castsi256_ps(_mm256_load_si256(
+                        reinterpret_cast<const __m256i*>(busy_lanes))));
+            }
+
+            const auto puct = _mm256_div_ps(
+                _mm256_mul_ps(_mm256_loadu_ps(policy + i), puct_scale),
+                _mm256_add_ps(one, visits));
+            const auto values = _mm256_blendv_ps(
+                lowest, _mm256_add_ps(winrate, puct),
+                _mm256_castsi256_ps(selectable));
+
+            // Strictly greater keeps the first best child of each lane.
+            const auto better = _mm256_cmp_ps(values, best_values, _CMP_GT_OQ);
+            best_values = _mm256_blendv_ps(best_values, values, better);
+            best_indices = _mm256_castps_si256(_mm256_blendv_ps(
+                _mm256_castsi256_ps(best_indices),
+                _mm256_castsi256_ps(indices), better));
+            indices = _mm256_add_epi32(indices, eight);
+        }
+
+        alignas(32) float lane_values[8];
+        alignas(32) int lane_indices[8];
+        _mm256_store_ps(lane_values, best_values);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lane_indices),
+                           best_indices);
+        auto best = size;
+        auto best_value = std::numeric_limits<float>::lowest();
+        for (auto lane = 0; lane < 8; lane++) {
+            const auto index = size_t(lane_indices[lane]);
+            if (lane_values[lane] > best_value
+                || (lane_values[lane] == best_value && index < best
+                    && best_value > std::numeric_limits<float>::lowest())) {
+                best_value = lane_values[lane];
+                best = index;
+            }
+        }
+        return select_scalar(children, params, busy, i, best, best_value);
+    }
+#endif
+}
+
+size_t PUCT::select(const CPUFeatures::Isa isa,
+                    const UCTNodeChildren& children, const Params& params,
+                    const std::function<bool(size_t)>& busy) {
+    assert(CPUFeatures::is_supported(isa));
+#ifdef PUCT_SIMD
+    // AVX-512 machines run the AVX2 kernel, 250 children do not fill
+    // enough 16 wide vectors to be worth another one.
+    if (isa != CPUFeatures::Isa::SCALAR) {
+        return select_avx2(children, params, busy);
+    }
+#else
+    (void)isa;
+#endif
+    return select_scalar(children, params, busy, 0, children.size(),
+                         std::numeric_limits<float>::lowest());
+}
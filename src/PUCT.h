@@ -0,0 +1,67 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef PUCT_H_INCLUDED
+#define PUCT_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+#include "CPUFeatures.h"
+#include "UCTNodePointer.h"
+
+// The score pass of UCTNode::uct_select_child over the statistics the
+// parent keeps in UCTNodeChildren.  Scores are computed in float, and
+// the AVX2 kernel does the same float operations in the same order as
+// the scalar code, so every instruction set picks the same child.
+namespace PUCT {
+    struct Params {
+        int color;
+        // UCTNode::Status of the children that can be selected.
+        std::uint8_t active_status;
+        // Eval of children without visits.
+        float fpu_eval;
+        // Eval of children that are being expanded.
+        float busy_eval;
+        // cfg_puct times the numerator of the exploration term.
+        float puct_scale;
+    };
+
+    // Index of the selectable child with the highest score, the first
+    // one on ties, or children.size() if there is none.  busy is only
+    // asked about children with a virtual loss.
+    size_t select(const CPUFeatures::Isa isa,
+                  const UCTNodeChildren& children, const Params& params,
+                  const std::function<bool(size_t)>& busy);
+}
+
+#endif
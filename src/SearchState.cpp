@@ -0,0 +1,84 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+#include "SearchState.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+#include "GameState.h"
+
+SearchState::SearchState(const GameState& root)
+    : FastState(root), m_root(root), m_root_movenum(root.get_movenum()) {
+}
+
+void SearchState::play_move(int vertex) {
+    FastState::play_move(vertex);
+    m_ko_hash_history.push_back(board.get_ko_hash());
+    m_past_planes[m_movenum % PAST_POSITIONS] = {
+        board.get_plane(FastBoard::BLACK), board.get_plane(FastBoard::WHITE)
+    };
+}
+
+bool SearchState::superko() const {
+    if (m_ko_hash_history.empty()) {
+        return m_root.superko();
+    }
+    const auto ko_hash = board.get_ko_hash();
+    const auto last = std::prev(cend(m_ko_hash_history));
+    if (std::find(cbegin(m_ko_hash_history), last, ko_hash) != last) {
+        return true;
+    }
+    const auto& root_history = m_root.get_ko_hash_history();
+    return std::find(cbegin(root_history), cend(root_history), ko_hash)
+           != cend(root_history);
+}
+
+std::uint64_t SearchState::get_transposition_key() const {
+    // The node of a position holds the move that reached it, so only
+    // positions reached by the same move can share one.
+    const auto move = std::uint64_t(get_last_move()) + 1;
+    return board.get_hash() ^ (move * 0x9E3779B97F4A7C15ULL);
+}
+
+const FastBoard::plane_t& SearchState::get_past_plane(int moves_ago,
+                                                      int color) const {
+    assert(moves_ago >= 0 && (unsigned)moves_ago <= m_movenum);
+    if (moves_ago == 0) {
+        return board.get_plane(color);
+    }
+    const auto movenum = m_movenum - moves_ago;
+    if (movenum <= m_root_movenum) {
+        return m_root.get_past_board(m_root_movenum - movenum).get_plane(color);
+    }
+    assert(moves_ago < PAST_POSITIONS);
+    return m_past_planes[movenum % PAST_POSITIONS][color];
+}
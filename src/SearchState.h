@@ -0,0 +1,74 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef SEARCHSTATE_H_INCLUDED
+#define SEARCHSTATE_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "FastBoard.h"
+#include "FastState.h"
+
+class GameState;
+
+// The position of one playout: a copy of the root position plus the moves
+// played below it.  The history before the root is read from the root
+// GameState, which must not change while a SearchState refers to it.
+class SearchState : public FastState {
+public:
+    // Positions back from the current one that get_past_plane can return
+    // for moves below the root.
+    static constexpr auto PAST_POSITIONS = 8;
+
+    explicit SearchState(const GameState& root);
+
+    void play_move(int vertex);
+    bool superko() const;
+    // Key of the position for sharing search nodes: the hash of the
+    // board, which includes the side to move and the ko, and the last
+    // move.  The NNCache keys its evaluations by the board alone, so the
+    // older positions the network sees don't keep nodes apart.
+    std::uint64_t get_transposition_key() const;
+    const FastBoard::plane_t& get_past_plane(int moves_ago, int color) const;
+
+private:
+    const GameState& m_root;
+    size_t m_root_movenum;
+    // Ko hashes of the positions below the root, the current one last.
+    std::vector<std::uint64_t> m_ko_hash_history;
+    // Stones of the positions below the root, indexed by move number.
+    std::array<std::array<FastBoard::plane_t, 2>, PAST_POSITIONS> m_past_planes;
+};
+
+#endif
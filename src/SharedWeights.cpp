@@ -0,0 +1,164 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <boost/filesystem.hpp>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SHARED_MMAP
+#endif
+
+#include "zlib.h"
+
+#include "SharedWeights.h"
+#include "AlignedAllocator.h"
+#include "Utils.h"
+
+#ifdef SHARED_MMAP
+namespace {
+    constexpr char MAGIC[8] = {'L', 'Z', 'S', 'H', 'A', 'R', 'E', '1'};
+
+    // Padded to a cache line so the payload keeps the alignment of the
+    // mapping.
+    struct Header {
+        char magic[sizeof(MAGIC)];
+        std::uint64_t size;
+        std::uint32_t crc;
+        char padding[CACHE_LINE_SIZE - sizeof(MAGIC)
+                     - sizeof(std::uint64_t) - sizeof(std::uint32_t)];
+    };
+    static_assert(sizeof(Header) == CACHE_LINE_SIZE, "Header is one line");
+
+    std::uint32_t checksum(const char* const data, const size_t size) {
+        auto crc = crc32(0L, Z_NULL, 0);
+        // crc32 takes 32 bit lengths.
+        constexpr auto CHUNK = size_t{1} << 30;
+        for (auto done = size_t{0}; done < size; done += CHUNK) {
+            crc = crc32(crc, reinterpret_cast<const Bytef*>(data + done),
+                        static_cast<uInt>(std::min(CHUNK, size - done)));
+        }
+        return static_cast<std::uint32_t>(crc);
+    }
+
+    std::shared_ptr<const char> map_file(const std::string& filename,
+                                         const size_t size) {
+        const auto fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        const auto file_size = sizeof(Header) + size;
+        struct stat st;
+        auto addr = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && size_t(st.st_size) == file_size) {
+            addr = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (addr == MAP_FAILED) {
+            return nullptr;
+        }
+        const auto base = static_cast<const char*>(addr);
+        auto mapping = std::shared_ptr<const char>(
+            base, [file_size](const char* p) {
+                munmap(const_cast<char*>(p), file_size);
+            });
+        const auto header = reinterpret_cast<const Header*>(base);
+        const auto payload = base + sizeof(Header);
+        if (std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0
+            || header->size != size
+            || header->crc != checksum(payload, size)) {
+            return nullptr;
+        }
+        return std::shared_ptr<const char>(mapping, payload);
+    }
+
+    bool create_file(const std::string& filename, const size_t size,
+                     const std::function<void(char*)>& fill) {
+        const auto fd = open(filename.c_str(), O_RDWR | O_CREAT | O_EXCL,
+                             0644);
+        if (fd < 0) {
+            return false;
+        }
+        const auto file_size = sizeof(Header) + size;
+        auto addr = MAP_FAILED;
+        if (ftruncate(fd, file_size) == 0) {
+            addr = mmap(nullptr, file_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+        const auto header = static_cast<Header*>(addr);
+        const auto payload = static_cast<char*>(addr) + sizeof(Header);
+        fill(payload);
+        std::memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->size = size;
+        header->crc = checksum(payload, size);
+        return munmap(addr, file_size) == 0;
+    }
+}
+#endif
+
+std::shared_ptr<const char> SharedWeights::map(
+    const std::string& name, const size_t size,
+    const std::function<void(char*)>& fill) {
+#ifdef SHARED_MMAP
+    const auto filename = Utils::leelaz_file(name);
+    auto data = map_file(filename, size);
+    if (data) {
+        return data;
+    }
+    // Write to a private file and move it into place, so other
+    // processes never map a half written one.  If several processes
+    // race, each maps its own and the last rename wins for later ones.
+    const auto temp_file = filename + boost::filesystem::unique_path(
+        ".%%%%-%%%%-%%%%").string();
+    if (create_file(temp_file, size, fill)) {
+        auto error = boost::system::error_code{};
+        boost::filesystem::rename(temp_file, filename, error);
+        if (!error) {
+            data = map_file(filename, size);
+        }
+    }
+    boost::filesystem::remove(temp_file);
+    return data;
+#else
+    (void)name;
+    (void)size;
+    (void)fill;
+    return nullptr;
+#endif
+}
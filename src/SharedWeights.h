@@ -0,0 +1,58 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef SHAREDWEIGHTS_H_INCLUDED
+#define SHAREDWEIGHTS_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+
+// Read-only weights shared between leelaz processes through memory
+// mapped files in the leelaz data directory.  The first process that
+// needs a blob writes the file, later ones map it, and all of them end
+// up using the same page cache pages instead of a private copy each.
+//
+// Every file starts with a header holding its payload size and a crc32
+// of the payload, which is checked before a file is used, so a stale or
+// damaged file gets rewritten instead of trusted.
+namespace SharedWeights {
+    // Maps the size byte blob name, 64 byte aligned.  If it doesn't
+    // exist yet, or fails its header check, fill is called on a zeroed
+    // buffer to write it first.  Returns nullptr if the file can't be
+    // created or mapped, or if this platform can't share weights.
+    std::shared_ptr<const char> map(const std::string& name,
+                                    const size_t size,
+                                    const std::function<void(char*)>& fill);
+}
+
+#endif
@@ -0,0 +1,304 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "Symmetry.h"
+#include "CPUFeatures.h"
+#include "Network.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SYMMETRY_SIMD
+#include <immintrin.h>
+#endif
+
+namespace {
+    constexpr auto N = BOARD_SIZE;
+    static_assert(N <= 32, "Rows of a bit plane must fit a 32-bit word");
+
+    // Bits of Network::get_symmetry
+    constexpr auto SWAP_XY = 4;
+    constexpr auto FLIP_X = 2;
+    constexpr auto FLIP_Y = 1;
+
+    using Rows = std::array<std::uint32_t, 32>;
+
+    bool use_avx2() {
+        static const auto avx2 =
+            CPUFeatures::is_supported(CPUFeatures::Isa::AVX2);
+        return avx2;
+    }
+
+    // The flips are applied first, then a swap of x and y is done as
+    // a transpose.
+    void transform_scalar(const int symmetry, const float* const in,
+                          float* const out) {
+        for (auto y = 0; y < N; y++) {
+            const auto row_in = in + (symmetry & FLIP_Y ? N - 1 - y : y) * N;
+            for (auto x = 0; x < N; x++) {
+                const auto value = row_in[symmetry & FLIP_X ? N - 1 - x : x];
+                if (symmetry & SWAP_XY) {
+                    out[x * N + y] = value;
+                } else {
+                    out[y * N + x] = value;
+                }
+            }
+        }
+    }
+
+    void unpack_scalar(const Rows& rows, float* const out) {
+        for (auto y = 0; y < N; y++) {
+            for (auto x = 0; x < N; x++) {
+                out[y * N + x] = float((rows[y] >> x) & 1);
+            }
+        }
+    }
+
+#ifdef SYMMETRY_SIMD
+    // Rows and columns are N wide, so like the output transform the last
+    // vector of a row is shifted back to overlap the previous one.
+    static_assert(N >= 8, "Rows must fill a vector");
+
+    // Columns [x0, x0 + 8) of row y after the flips
+    template <int SYMMETRY>
+    __attribute__((target("avx2")))
+    inline __m256 load_flipped(const float* const in,
+                               const int y, const int x0) {
+        const auto row_in = in + (SYMMETRY & FLIP_Y ? N - 1 - y : y) * N;
+        if (SYMMETRY & FLIP_X) {
+            const auto reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+            return _mm256_permutevar8x32_ps(
+                _mm256_loadu_ps(row_in + N - 8 - x0), reverse);
+        }
+        return _mm256_loadu_ps(row_in + x0);
+    }
+
+    // The transpose goes by 8 x 8 blocks, the last ones of each row and
+    // column overlapping the previous ones.
+    template <int SYMMETRY>
+    __attribute__((target("avx2")))
+    void transform_avx2(const float* const in, float* const out) {
+        if (!(SYMMETRY & SWAP_XY)) {
+            for (auto y = 0; y < N; y++) {
+                for (auto next = 0; next < N; next += 8) {
+                    const auto x0 = std::min(next, N - 8);
+                    _mm256_storeu_ps(out + y * N + x0,
+                                     load_flipped<SYMMETRY>(in, y, x0));
+                }
+            }
+            return;
+        }
+        for (auto next_y = 0; next_y < N; next_y += 8) {
+            const auto y0 = std::min(next_y, N - 8);
+            for (auto next_x = 0; next_x < N; next_x += 8) {
+                const auto x0 = std::min(next_x, N - 8);
+                __m256 r[8], t[8];
+                for (auto i = 0; i < 8; i++) {
+                    r[i] = load_flipped<SYMMETRY>(in, y0 + i, x0);
+                }
+                for (auto i = 0; i < 8; i += 2) {
+                    t[i] = _mm256_unpacklo_ps(r[i], r[i + 1]);
+                    t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+                }
+                for (auto i = 0; i < 8; i += 4) {
+                    r[i] = _mm256_shuffle_ps(t[i], t[i + 2], 0x44);
+                    r[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], 0xEE);
+                    r[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0x44);
+                    r[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0xEE);
+                }
+                // Rows 0-3 hold the columns of the upper half in their
+                // 128-bit lanes, rows 4-7 those of the lower half
+                const auto dst = out + x0 * N + y0;
+                for (auto i = 0; i < 4; i++) {
+                    _mm256_storeu_ps(dst + i * N,
+                        _mm256_permute2f128_ps(r[i], r[i + 4], 0x20));
+                    _mm256_storeu_ps(dst + (i + 4) * N,
+                        _mm256_permute2f128_ps(r[i], r[i + 4], 0x31));
+                }
+            }
+        }
+    }
+
+    using Kernel = void (*)(const float* in, float* out);
+    constexpr Kernel TRANSFORM_AVX2[] = {
+        transform_avx2<0>, transform_avx2<1>, transform_avx2<2>,
+        transform_avx2<3>, transform_avx2<4>, transform_avx2<5>,
+        transform_avx2<6>, transform_avx2<7>
+    };
+
+    // movemask gathers the top bit of every byte, that is one column
+    // of all rows at a time.
+    __attribute__((target("avx2")))
+    void transpose_bits_avx2(Rows& rows) {
+        auto columns = Rows{};
+        for (auto c0 = 0; c0 < N; c0 += 8) {
+            alignas(32) std::uint8_t bytes[32] = {};
+            for (auto y = 0; y < N; y++) {
+                bytes[y] = std::uint8_t(rows[y] >> c0);
+            }
+            auto v = _mm256_load_si256(reinterpret_cast<const __m256i*>(bytes));
+            for (auto c = 7; c >= 0; c--) {
+                columns[c0 + c] = std::uint32_t(_mm256_movemask_epi8(v));
+                v = _mm256_slli_epi16(v, 1);
+            }
+        }
+        rows = columns;
+    }
+
+    __attribute__((target("avx2")))
+    void unpack_avx2(const Rows& rows, float* const out) {
+        const auto bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        const auto one = _mm256_set1_ps(1.0f);
+        for (auto y = 0; y < N; y++) {
+            for (auto next = 0; next < N; next += 8) {
+                const auto x0 = std::min(next, N - 8);
+                const auto byte =
+                    _mm256_set1_epi32(int((rows[y] >> x0) & 0xff));
+                const auto set = _mm256_cmpeq_epi32(
+                    _mm256_and_si256(byte, bits), bits);
+                _mm256_storeu_ps(out + y * N + x0,
+                                 _mm256_and_ps(_mm256_castsi256_ps(set), one));
+            }
+        }
+    }
+#endif
+
+    std::uint32_t get_row(const FastBoard::plane_t& plane, const int y) {
+        const auto pos = y * N;
+        auto bits = plane[pos / 64] >> (pos % 64);
+        if (pos % 64 + N > 64) {
+            bits |= plane[pos / 64 + 1] << (64 - pos % 64);
+        }
+        return std::uint32_t(bits & ((std::uint64_t{1} << N) - 1));
+    }
+
+    // Swaps row k bits [J, 2J) with row k + J bits [0, J) in every
+    // 2J x 2J block.  Going from J = 16 down to 1 transposes the rows,
+    // row k bit c ending up in row c bit k (Hacker's Delight 7-3, with
+    // bit 0 as the first column).
+    template <int J, std::uint32_t MASK>
+    void transpose_stage(Rows& rows) {
+        for (auto k = 0; k < 32; k++) {
+            if ((k & J) == 0) {
+                const auto t = ((rows[k] >> J) ^ rows[k + J]) & MASK;
+                rows[k + J] ^= t;
+                rows[k] ^= t << J;
+            }
+        }
+    }
+
+    void transpose_bits(Rows& rows) {
+        transpose_stage<16, 0x0000FFFF>(rows);
+        transpose_stage<8, 0x00FF00FF>(rows);
+        transpose_stage<4, 0x0F0F0F0F>(rows);
+        transpose_stage<2, 0x33333333>(rows);
+        transpose_stage<1, 0x55555555>(rows);
+    }
+
+    std::uint32_t reverse_bits(std::uint32_t v) {
+        v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+        v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+        v = ((v >> 4) & 0x0F0F0F0F) | ((v & 0x0F0F0F0F) << 4);
+        v = ((v >> 8) & 0x00FF00FF) | ((v & 0x00FF00FF) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    // Whole rows at a time, one per 32-bit word
+    Rows transform_rows(const int symmetry, const FastBoard::plane_t& in) {
+        auto rows = Rows{};
+        for (auto y = 0; y < N; y++) {
+            rows[y] = get_row(in, y);
+        }
+        if (symmetry & FLIP_Y) {
+            std::reverse(begin(rows), begin(rows) + N);
+        }
+        if (symmetry & FLIP_X) {
+            for (auto y = 0; y < N; y++) {
+                rows[y] = reverse_bits(rows[y]) >> (32 - N);
+            }
+        }
+        if (symmetry & SWAP_XY) {
+#ifdef SYMMETRY_SIMD
+            if (use_avx2()) {
+                transpose_bits_avx2(rows);
+            } else
+#endif
+            {
+                transpose_bits(rows);
+            }
+        }
+        return rows;
+    }
+}
+
+int Symmetry::inverse(const int symmetry) {
+    assert(symmetry >= 0 && symmetry < Network::NUM_SYMMETRIES);
+    // Undoing the flips before the swap exchanges them
+    if ((symmetry & SWAP_XY)
+        && bool(symmetry & FLIP_X) != bool(symmetry & FLIP_Y)) {
+        return symmetry ^ (FLIP_X | FLIP_Y);
+    }
+    return symmetry;
+}
+
+void Symmetry::transform(const int symmetry, const float* const in,
+                         float* const out) {
+    assert(symmetry >= 0 && symmetry < Network::NUM_SYMMETRIES);
+    assert(in + NUM_INTERSECTIONS <= out || out + NUM_INTERSECTIONS <= in);
+    if (symmetry == Network::IDENTITY_SYMMETRY) {
+        std::memcpy(out, in, NUM_INTERSECTIONS * sizeof(float));
+        return;
+    }
+#ifdef SYMMETRY_SIMD
+    if (use_avx2()) {
+        TRANSFORM_AVX2[symmetry](in, out);
+        return;
+    }
+#endif
+    transform_scalar(symmetry, in, out);
+}
+
+void Symmetry::unpack(const int symmetry, const FastBoard::plane_t& in,
+                      float* const out) {
+    assert(symmetry >= 0 && symmetry < Network::NUM_SYMMETRIES);
+    const auto rows = transform_rows(symmetry, in);
+#ifdef SYMMETRY_SIMD
+    if (use_avx2()) {
+        unpack_avx2(rows, out);
+        return;
+    }
+#endif
+    unpack_scalar(rows, out);
+}
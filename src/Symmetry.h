@@ -0,0 +1,54 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef SYMMETRY_H_INCLUDED
+#define SYMMETRY_H_INCLUDED
+
+#include "config.h"
+
+#include "FastBoard.h"
+
+// The 8 symmetries of the board applied to whole planes of
+// NUM_INTERSECTIONS points in the row-major order of the network.
+// Symmetry s maps each point as Network::get_symmetry does, and
+// transform gives out[idx] = in[s(idx)].  That is the plane the network
+// sees when it evaluates symmetry s of the board, and transforming its
+// output back takes inverse(s).
+namespace Symmetry {
+    int inverse(const int symmetry);
+
+    // in and out must not overlap.
+    void transform(const int symmetry, const float* const in,
+                   float* const out);
+    // Symmetry s of a bit plane as 1.0f for every bit set, 0.0f elsewhere.
+    void unpack(const int symmetry, const FastBoard::plane_t& in,
+                float* const out);
+}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include "TranspositionTable.h"
+
+std::atomic<size_t> TranspositionTable::s_memory_used{0};
+
+TranspositionTable::TranspositionTable() : m_shards(NUM_SHARDS) {
+    for (const auto& shard : m_shards) {
+        s_memory_used += shard.memory_used();
+    }
+}
+
+TranspositionTable::~TranspositionTable() {
+    for (const auto& shard : m_shards) {
+        s_memory_used -= shard.memory_used();
+    }
+}
+
+size_t TranspositionTable::Shard::memory_used() const {
+    // A node holds the entry and the link to the next one, the buckets
+    // a pointer each.
+    using Entry = decltype(nodes)::value_type;
+    return nodes.size() * (sizeof(Entry) + sizeof(void*))
+        + nodes.bucket_count() * sizeof(void*);
+}
+
+UCTNode* TranspositionTable::insert(std::uint64_t key, UCTNode* node) {
+    auto& shard = shard_for(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    const auto old_memory = shard.memory_used();
+    const auto entry = shard.nodes.emplace(key, node).first;
+    s_memory_used += shard.memory_used() - old_memory;
+    return entry->second;
+}
+
+void TranspositionTable::retain(
+    const std::unordered_set<const UCTNode*>& kept) {
+    for (auto& shard : m_shards) {
+        const auto old_memory = shard.memory_used();
+        auto& nodes = shard.nodes;
+        for (auto entry = begin(nodes); entry != end(nodes);) {
+            if (kept.count(entry->second)) {
+                ++entry;
+            } else {
+                entry = nodes.erase(entry);
+            }
+        }
+        s_memory_used -= old_memory - shard.memory_used();
+    }
+}
+
+void TranspositionTable::add_orphan(UCTNode* node) {
+    std::lock_guard<std::mutex> lock(m_orphans_mutex);
+    m_orphans.emplace_back(node);
+}
+
+std::vector<UCTNode*> TranspositionTable::take_orphans() {
+    std::lock_guard<std::mutex> lock(m_orphans_mutex);
+    auto orphans = std::vector<UCTNode*>{};
+    orphans.swap(m_orphans);
+    return orphans;
+}
+
+size_t TranspositionTable::size() const {
+    auto count = size_t{0};
+    for (const auto& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        count += shard.nodes.size();
+    }
+    return count;
+}
+
+size_t TranspositionTable::get_memory_used() {
+    return s_memory_used.load();
+}
@@ -0,0 +1,102 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef TRANSPOSITIONTABLE_H_INCLUDED
+#define TRANSPOSITIONTABLE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "AlignedAllocator.h"
+
+class UCTNode;
+
+// The nodes of a search by the SearchState::get_transposition_key of
+// their position, so that the search can share the node of a position
+// that is reached by more than one sequence of moves.  The nodes are
+// not owned, they live in the arena of the search.
+class TranspositionTable {
+public:
+    // Like NNCache, split by the low bits of the key with a lock each.
+    static constexpr int NUM_SHARDS = 64;
+
+    TranspositionTable();
+    ~TranspositionTable();
+    TranspositionTable(const TranspositionTable&) = delete;
+    TranspositionTable& operator=(const TranspositionTable&) = delete;
+
+    // The node of key, which is node itself if key had none yet.
+    UCTNode* insert(std::uint64_t key, UCTNode* node);
+
+    // Drop the entries of the nodes that are not in kept.  Not thread
+    // safe.
+    void retain(const std::unordered_set<const UCTNode*>& kept);
+
+    // A node that lost its parent to the node from insert().  It stays
+    // allocated until take_orphans() hands it back, as a thread may
+    // still be searching it.  The same node can be added more than
+    // once.
+    void add_orphan(UCTNode* node);
+    std::vector<UCTNode*> take_orphans();
+
+    size_t size() const;
+
+    // Estimated bytes used by the entries of all tables, the nodes
+    // themselves are in their arena.
+    static size_t get_memory_used();
+
+private:
+    // Each shard starts on its own cache line, like in NNCache.
+    struct alignas(CACHE_LINE_SIZE) Shard {
+        size_t memory_used() const;
+
+        mutable std::mutex mutex;
+        std::unordered_map<std::uint64_t, UCTNode*> nodes;
+    };
+
+    Shard& shard_for(std::uint64_t key) {
+        return m_shards[key % NUM_SHARDS];
+    }
+
+    std::vector<Shard, AlignedAllocator<Shard>> m_shards;
+    std::mutex m_orphans_mutex;
+    std::vector<UCTNode*> m_orphans;
+
+    static std::atomic<size_t> s_memory_used;
+};
+
+#endif
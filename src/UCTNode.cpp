@@ -37,6 +37,7 @@
 #include <functional>
 #include <iterator>
 #include <limits>
+#include <new>
 #include <numeric>
 #include <utility>
 #include <vector>
@@ -47,6 +48,7 @@
 #include "GTP.h"
 #include "GameState.h"
 #include "Network.h"
+#include "PUCT.h"
 #include "Utils.h"
 
 using namespace Utils;
@@ -60,9 +62,10 @@ bool UCTNode::first_visit() const {
 
 bool UCTNode::create_children(Network & network,
                               std::atomic<int>& nodecount,
-                              GameState& state,
+                              SearchState& state,
                               float& eval,
-                              float min_psa_ratio) {
+                              float min_psa_ratio,
+                              Network::Ensemble ensemble) {
     // no successors in final state
     if (state.get_passes() >= 2) {
         return false;
@@ -79,8 +82,9 @@ bool UCTNode::create_children(Network & network,
         return false;
     }
 
+    // An averaged eval replaces any single symmetry one in the cache.
     const auto raw_netlist = network.get_output(
-        &state, Network::Ensemble::RANDOM_SYMMETRY);
+        &state, ensemble, -1, ensemble == Network::Ensemble::RANDOM_SYMMETRY);
 
     // DCNN returns winrate as side to move
     const auto stm_eval = raw_netlist.winrate;
@@ -162,30 +166,56 @@ void UCTNode::link_nodelist(std::atomic<int>& nodecount,
     const auto max_psa = nodelist[0].first;
     const auto old_min_psa = max_psa * m_min_psa_ratio_children;
     const auto new_min_psa = max_psa * min_psa_ratio;
-    if (new_min_psa > 0.0f) {
-        m_children.reserve(
-            std::count_if(cbegin(nodelist), cend(nodelist),
-                [=](const auto& node) { return node.first >= new_min_psa; }
-            )
+    const auto new_children =
+        std::count_if(cbegin(nodelist), cend(nodelist),
+            [=](const auto& node) {
+                return node.first >= new_min_psa && node.first < old_min_psa;
+            }
         );
-    } else {
-        m_children.reserve(nodelist.size());
-    }
 
-    auto skipped_children = false;
-    for (const auto& node : nodelist) {
-        if (node.first < new_min_psa) {
-            skipped_children = true;
-        } else if (node.first < old_min_psa) {
-            m_children.emplace_back(node.second, node.first);
-            ++nodecount;
+    // Threads wait for the expansion before they look at the children,
+    // so they can move to a larger array.
+    if (new_children > 0) {
+        const auto old_size = m_children.size();
+        const auto capacity = old_size + new_children;
+        resize_children(capacity);
+        for (const auto& node : nodelist) {
+            if (node.first >= new_min_psa && node.first < old_min_psa) {
+                m_children.push_back(UCTNodePointer(node.second, node.first));
+                ++nodecount;
+            }
         }
+        sync_child_stats(old_size);
     }
 
+    const auto skipped_children = nodelist.back().first < new_min_psa;
+
     m_min_psa_ratio_children = skipped_children ? min_psa_ratio : 0.0f;
 }
 
-const std::vector<UCTNodePointer>& UCTNode::get_children() const {
+void UCTNode::resize_children(size_t capacity) {
+    // The array lives in our arena.  The children move over with their
+    // statistics, and the old array goes back to the arena.
+    auto children = UCTNodeChildren{UCTNodeArena::owner(this), capacity};
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        children.push_back(std::move(m_children[i]));
+        children.copy_stats(i, m_children, i);
+    }
+    m_children.release();
+    m_children = children;
+}
+
+void UCTNode::reorder_children(const std::vector<size_t>& order) {
+    auto children = UCTNodeChildren{UCTNodeArena::owner(this), order.size()};
+    for (auto i = size_t{0}; i < order.size(); i++) {
+        children.push_back(std::move(m_children[order[i]]));
+        children.copy_stats(i, m_children, order[i]);
+    }
+    m_children.release();
+    m_children = children;
+}
+
+const UCTNodeChildren& UCTNode::get_children() const {
     return m_children;
 }
 
@@ -297,17 +327,109 @@ void UCTNode::accumulate_eval(float eval) {
     atomic_add(m_blackevals, double(eval));
 }
 
-UCTNode* UCTNode::uct_select_child(int color, bool is_root) {
+void UCTNode::sync_child_stats(const size_t begin) {
+    for (auto i = begin; i < m_children.size(); i++) {
+        const auto& child = m_children[i];
+        m_children.policy()[i] = child.get_policy();
+        if (child.is_inflated()) {
+            m_children.visits()[i] = child->m_visits.load();
+            m_children.blackevals()[i] = float(child->m_blackevals);
+            m_children.virtual_loss()[i] = child->m_virtual_loss.load();
+        }
+    }
+}
+
+void UCTNode::child_stats_virtual_loss(size_t index) {
+    m_children.virtual_loss()[index] += VIRTUAL_LOSS_COUNT;
+}
+
+void UCTNode::child_stats_virtual_loss_undo(size_t index) {
+    m_children.virtual_loss()[index] -= VIRTUAL_LOSS_COUNT;
+}
+
+void UCTNode::child_stats_update(size_t index, float eval) {
+    m_children.visits()[index]++;
+    atomic_add(m_children.blackevals()[index], eval);
+}
+
+int UCTNode::get_child_visits(size_t index) const {
+    return m_children.visits()[index];
+}
+
+int UCTNode::get_move_visits(size_t index) const {
+    if (cfg_transpositions) {
+        return get_child_visits(index);
+    }
+    return m_children[index].get_visits();
+}
+
+void UCTNode::child_invalidate(size_t index) {
+    m_children.status()[index] = INVALID;
+}
+
+UCTNode* UCTNode::child_link(size_t index, UCTNode* node) {
+    const auto child = m_children[index].get();
+    if (child == node) {
+        return node;
+    }
+    return m_children[index].replace(child, node);
+}
+
+void UCTNode::update_from_child(size_t index, float eval) {
+    // Cache values to avoid race conditions.
+    auto old_eval = static_cast<float>(m_blackevals);
+    auto old_visits = static_cast<int>(m_visits);
+    auto old_delta = old_visits > 0 ? eval - old_eval / old_visits : 0.0f;
+
+    // The edge now holds the current eval of the child, which other
+    // parents may have moved since this edge was last searched.
+    const auto& child = m_children[index];
+    const auto edge_visits = ++m_children.visits()[index];
+    const auto child_eval = child->get_blackevals() / child->get_visits();
+    const auto old_edge_evals = m_children.blackevals()[index].exchange(
+        float(edge_visits * child_eval));
+    m_visits++;
+    atomic_add(m_blackevals, edge_visits * child_eval - old_edge_evals);
+
+    auto new_eval = static_cast<float>(get_blackevals() / get_visits());
+    auto new_delta = eval - new_eval;
+    // Welford's online algorithm for calculating variance.
+    auto delta = old_delta * new_delta;
+    atomic_add(m_squared_eval_diff, delta);
+}
+
+void UCTNode::child_set_active(size_t index, const bool active) {
+    auto& status = m_children.status()[index];
+    if (status != INVALID) {
+        status = active ? ACTIVE : PRUNED;
+    }
+}
+
+bool UCTNode::child_valid(size_t index) const {
+    return m_children.status()[index] != INVALID;
+}
+
+bool UCTNode::child_active(size_t index) const {
+    return m_children.status()[index] == ACTIVE;
+}
+
+UCTNode* UCTNode::uct_select_child(int color, bool is_root, size_t& index) {
     wait_expanded();
 
+    const auto size = m_children.size();
+    const auto child_policy = m_children.policy();
+    const auto child_visits = m_children.visits();
+    const auto child_status = m_children.status();
+
     // Count parentvisits manually to avoid issues with transpositions.
     auto total_visited_policy = 0.0f;
     auto parentvisits = size_t{0};
-    for (const auto& child : m_children) {
-        if (child.valid()) {
-            parentvisits += child.get_visits();
-            if (child.get_visits() > 0) {
-                total_visited_policy += child.get_policy();
+    for (auto i = size_t{0}; i < size; i++) {
+        if (child_status[i] != INVALID) {
+            const auto visits = child_visits[i].load();
+            parentvisits += visits;
+            if (visits > 0) {
+                total_visited_policy += child_policy[i];
             }
         }
     }
@@ -318,51 +440,43 @@ UCTNode* UCTNode::uct_select_child(int color, bool is_root) {
     // Estimated eval for unknown nodes = original parent NN eval - reduction
     const auto fpu_eval = get_net_eval(color) - fpu_reduction;
 
-    auto best = static_cast<UCTNodePointer*>(nullptr);
-    auto best_value = std::numeric_limits<double>::lowest();
-
-    for (auto& child : m_children) {
-        if (!child.active()) {
-            continue;
-        }
-
-        auto winrate = fpu_eval;
-        if (child.is_inflated() && child->m_expand_state.load() == ExpandState::EXPANDING) {
-            // Someone else is expanding this node, never select it
-            // if we can avoid so, because we'd block on it.
-            winrate = -1.0f - fpu_reduction;
-        } else if (child.get_visits() > 0) {
-            winrate = child.get_eval(color);
-        }
-        const auto psa = child.get_policy();
-        const auto denom = 1.0 + child.get_visits();
-        const auto puct = cfg_puct * psa * (numerator / denom);
-        const auto value = winrate + puct;
-        assert(value > std::numeric_limits<double>::lowest());
-
-        if (value > best_value) {
-            best_value = value;
-            best = &child;
-        }
-    }
-
-    assert(best != nullptr);
-    best->inflate();
-    return best->get();
-}
-
-class NodeComp : public std::binary_function<UCTNodePointer&,
-                                             UCTNodePointer&, bool> {
+    auto params = PUCT::Params{};
+    params.color = color;
+    params.active_status = ACTIVE;
+    params.fpu_eval = fpu_eval;
+    // Someone else is expanding this node, never select it
+    // if we can avoid so, because we'd block on it.
+    params.busy_eval = -1.0f - fpu_reduction;
+    params.puct_scale = static_cast<float>(cfg_puct * numerator);
+    static const auto isa = CPUFeatures::detect_isa();
+    // Only an inflated child with a virtual loss can be in the middle
+    // of an expansion.  The node is looked at only then.
+    const auto best = PUCT::select(isa, m_children, params,
+        [this](const size_t i) {
+            return m_children[i].is_inflated()
+                && m_children[i]->m_expand_state.load()
+                   == ExpandState::EXPANDING;
+        });
+
+    assert(best < size);
+    index = best;
+    m_children[best].inflate();
+    return m_children[best].get();
+}
+
+class NodeComp : public std::binary_function<size_t, size_t, bool> {
 public:
-    NodeComp(int color, float lcb_min_visits) : m_color(color),
-        m_lcb_min_visits(lcb_min_visits){};
+    NodeComp(const UCTNode& parent, int color, float lcb_min_visits)
+        : m_parent(parent), m_color(color),
+          m_lcb_min_visits(lcb_min_visits){};
 
     // WARNING : on very unusual cases this can be called on multithread
     // contexts (e.g., UCTSearch::get_pv()) so beware of race conditions
-    bool operator()(const UCTNodePointer& a,
-                    const UCTNodePointer& b) {
-        auto a_visit = a.get_visits();
-        auto b_visit = b.get_visits();
+    bool operator()(const size_t a_index, const size_t b_index) {
+        const auto& a = m_parent.get_children()[a_index];
+        const auto& b = m_parent.get_children()[b_index];
+        auto a_visit = m_parent.get_move_visits(a_index);
+        auto b_visit = m_parent.get_move_visits(b_index);
 
         // Need at least 2 visits for LCB.
         if (m_lcb_min_visits < 2) {
@@ -394,12 +508,20 @@ public:
         return a.get_eval(m_color) < b.get_eval(m_color);
     }
 private:
+    const UCTNode& m_parent;
     int m_color;
     float m_lcb_min_visits;
 };
 
 void UCTNode::sort_children(int color, float lcb_min_visits) {
-    std::stable_sort(rbegin(m_children), rend(m_children), NodeComp(color, lcb_min_visits));
+    // Best to worst, ties in reverse order like a stable sort of the
+    // children from the back.
+    auto order = std::vector<size_t>(m_children.size());
+    std::iota(order.rbegin(), order.rend(), size_t{0});
+    std::stable_sort(order.begin(), order.end(),
+                     NodeComp(*this, color, lcb_min_visits));
+    std::reverse(order.begin(), order.end());
+    reorder_children(order);
 }
 
 UCTNode& UCTNode::get_best_root_child(int color) {
@@ -408,49 +530,37 @@ UCTNode& UCTNode::get_best_root_child(int color) {
     assert(!m_children.empty());
 
     auto max_visits = 0;
-    for (const auto& node : m_children) {
-        max_visits = std::max(max_visits, node.get_visits());
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        max_visits = std::max(max_visits, get_move_visits(i));
     }
 
-    auto ret = std::max_element(begin(m_children), end(m_children),
-                                NodeComp(color, cfg_lcb_min_visit_ratio * max_visits));
-    ret->inflate();
+    auto order = std::vector<size_t>(m_children.size());
+    std::iota(order.begin(), order.end(), size_t{0});
+    auto ret = *std::max_element(
+        order.begin(), order.end(),
+        NodeComp(*this, color, cfg_lcb_min_visit_ratio * max_visits));
+    m_children[ret].inflate();
 
-    return *(ret->get());
+    return *(m_children[ret].get());
 }
 
-size_t UCTNode::count_nodes_and_clear_expand_state() {
+size_t UCTNode::count_nodes_and_clear_expand_state(
+    std::unordered_set<const UCTNode*>* seen) {
+
     auto nodecount = size_t{0};
     nodecount += m_children.size();
     if (expandable()) {
         m_expand_state = ExpandState::INITIAL;
     }
     for (auto& child : m_children) {
-        if (child.is_inflated()) {
-            nodecount += child->count_nodes_and_clear_expand_state();
+        if (child.is_inflated()
+            && (!seen || seen->insert(child.get()).second)) {
+            nodecount += child->count_nodes_and_clear_expand_state(seen);
         }
     }
     return nodecount;
 }
 
-void UCTNode::invalidate() {
-    m_status = INVALID;
-}
-
-void UCTNode::set_active(const bool active) {
-    if (valid()) {
-        m_status = active ? ACTIVE : PRUNED;
-    }
-}
-
-bool UCTNode::valid() const {
-    return m_status != INVALID;
-}
-
-bool UCTNode::active() const {
-    return m_status == ACTIVE;
-}
-
 bool UCTNode::acquire_expanding() {
     auto expected = ExpandState::INITIAL;
     auto newval = ExpandState::EXPANDING;
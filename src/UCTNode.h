@@ -34,13 +34,16 @@
 
 #include <atomic>
 #include <memory>
+#include <unordered_set>
 #include <vector>
 #include <cassert>
 #include <cstring>
 
 #include "GameState.h"
 #include "Network.h"
+#include "SearchState.h"
 #include "SMP.h"
+#include "UCTNodeArena.h"
 #include "UCTNodePointer.h"
 
 class UCTNode {
@@ -56,22 +59,23 @@ public:
 
     bool create_children(Network & network,
                          std::atomic<int>& nodecount,
-                         GameState& state, float& eval,
-                         float min_psa_ratio = 0.0f);
+                         SearchState& state, float& eval,
+                         float min_psa_ratio = 0.0f,
+                         Network::Ensemble ensemble =
+                             Network::Ensemble::RANDOM_SYMMETRY);
 
-    const std::vector<UCTNodePointer>& get_children() const;
+    const UCTNodeChildren& get_children() const;
     void sort_children(int color, float lcb_min_visits);
     UCTNode& get_best_root_child(int color);
-    UCTNode* uct_select_child(int color, bool is_root);
+    // index is set to the position of the child in get_children().
+    UCTNode* uct_select_child(int color, bool is_root, size_t& index);
 
-    size_t count_nodes_and_clear_expand_state();
+    // With seen, nodes reached more than once are counted once.
+    size_t count_nodes_and_clear_expand_state(
+        std::unordered_set<const UCTNode*>* seen = nullptr);
     bool first_visit() const;
     bool has_children() const;
     bool expandable(const float min_psa_ratio = 0.0f) const;
-    void invalidate();
-    void set_active(const bool active);
-    bool valid() const;
-    bool active() const;
     int get_move() const;
     int get_visits() const;
     float get_policy() const;
@@ -85,6 +89,36 @@ public:
     void update(float eval);
     float get_eval_lcb(int color) const;
 
+    // Keep the statistics we hold for the child at index in step with
+    // its own virtual_loss(), virtual_loss_undo() and update().
+    void child_stats_virtual_loss(size_t index);
+    void child_stats_virtual_loss_undo(size_t index);
+    void child_stats_update(size_t index, float eval);
+    // Visits of the edge to the child at index.
+    int get_child_visits(size_t index) const;
+    // Visits of the child at index to choose between the moves by.  With
+    // transpositions they are those of the edge, as a shared child also
+    // counts the visits of its other parents.
+    int get_move_visits(size_t index) const;
+    // The status of the child at index.  It belongs to the edge, as the
+    // position of a shared child can be a superko or not worth searching
+    // for one parent and fine for the others.
+    void child_invalidate(size_t index);
+    void child_set_active(size_t index, const bool active);
+    bool child_valid(size_t index) const;
+    bool child_active(size_t index) const;
+    // Point the child at index to node, which is the same position
+    // reached by other moves.  Returns the child after that.
+    UCTNode* child_link(size_t index, UCTNode* node);
+    // child_stats_update() and update() for a node whose child at index
+    // may be shared by several parents.  The edge takes the current eval
+    // of the child for all its visits, and the node the change in the
+    // edge, so that it stays its net eval plus what the edges hold.
+    // eval is the result of the playout, which only goes into the
+    // variance, so that the lower confidence bound sees the spread of
+    // the playouts and not that of the averages of the child.
+    void update_from_child(size_t index, float eval);
+
     // Defined in UCTNodeRoot.cpp, only to be called on m_root in UCTSearch
     void randomize_first_proportionally();
     void prepare_root_node(Network & network, int color,
@@ -93,16 +127,25 @@ public:
 
     UCTNode* get_first_child() const;
     UCTNode* get_nopass_child(FastState& state) const;
-    std::unique_ptr<UCTNode> find_child(const int move);
+    UCTNode* find_child(const int move);
     void inflate_all_children();
+    // Give node and everything below it back to the arena, except for
+    // keep, the nodes in kept and what is below those.  With released,
+    // nodes reached more than once are released once.
+    static void release_tree(UCTNode* node, const UCTNode* keep,
+        const std::unordered_set<const UCTNode*>* kept = nullptr,
+        std::unordered_set<const UCTNode*>* released = nullptr);
 
     void clear_expand_state();
-private:
+
+    // Of the edges to the children, see UCTNodeChildren::status().
     enum Status : char {
         INVALID, // superko
         PRUNED,
         ACTIVE
     };
+
+private:
     void link_nodelist(std::atomic<int>& nodecount,
                        std::vector<Network::PolicyVertexPair>& nodelist,
                        float min_psa_ratio);
@@ -110,6 +153,16 @@ private:
     void accumulate_eval(float eval);
     void kill_superkos(const GameState& state);
     void dirichlet_noise(float epsilon, float alpha);
+    // Move the children to an array of capacity children.  Not
+    // thread-safe.
+    void resize_children(size_t capacity);
+    // Put the children in the order of order, leaving out the ones not
+    // in it.  The children keep the statistics we hold for them.  Not
+    // thread-safe.
+    void reorder_children(const std::vector<size_t>& order);
+    // Copy the statistics of the children from begin on from the
+    // children, after they were added.  Not thread-safe.
+    void sync_child_stats(size_t begin);
 
     // Note : This class is very size-sensitive as we are going to create
     // tens of millions of instances of these.  Please put extra caution
@@ -129,7 +182,6 @@ private:
     // at low visits.
     std::atomic<float> m_squared_eval_diff{1e-4f};
     std::atomic<double> m_blackevals{0.0};
-    std::atomic<Status> m_status{ACTIVE};
 
     // m_expand_state acts as the lock for m_children.
     // see manipulation methods below for possible state transition
@@ -150,7 +202,7 @@ private:
 
     // Tree data
     std::atomic<float> m_min_psa_ratio_children{2.0f};
-    std::vector<UCTNodePointer> m_children;
+    UCTNodeChildren m_children;
 
     //  m_expand_state manipulation methods
     // INITIAL -> EXPANDING
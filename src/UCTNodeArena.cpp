@@ -0,0 +1,204 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+#include "UCTNodeArena.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+constexpr size_t UCTNodeArena::SLAB_SIZE;
+constexpr size_t UCTNodeArena::MAX_BLOCK;
+constexpr size_t UCTNodeArena::NUM_CLASSES;
+
+thread_local UCTNodeArena::ThreadSlab UCTNodeArena::s_thread_slab{0, nullptr};
+std::atomic<std::uint64_t> UCTNodeArena::s_next_id{1};
+std::atomic<size_t> UCTNodeArena::s_tree_size{0};
+std::atomic<size_t> UCTNodeArena::s_reserved_size{0};
+
+namespace {
+    void free_slab(void* const slab) {
+#ifdef _WIN32
+        _aligned_free(slab);
+#else
+        std::free(slab);
+#endif
+    }
+}
+
+UCTNodeArena::UCTNodeArena() : m_id(s_next_id++) {
+}
+
+UCTNodeArena::~UCTNodeArena() {
+    for (const auto slab : m_slabs) {
+        free_slab(slab);
+    }
+    s_tree_size -= m_used;
+    s_reserved_size -= m_slabs.size() * SLAB_SIZE;
+}
+
+size_t UCTNodeArena::size_class(const size_t bytes) {
+    assert(bytes > 0 && bytes <= MAX_BLOCK);
+    if (bytes <= 256) {
+        return (bytes + 15) / 16 - 1;
+    }
+    // bytes is in (2^p, 2^(p+1)], split in four steps.
+    auto p = size_t{8};
+    while ((size_t{2} << p) < bytes) {
+        p++;
+    }
+    const auto step = size_t{1} << (p - 2);
+    const auto k = (bytes - (size_t{1} << p) + step - 1) / step;
+    return 16 + (p - 8) * 4 + (k - 1);
+}
+
+size_t UCTNodeArena::class_size(const size_t size_class) {
+    if (size_class < 16) {
+        return (size_class + 1) * 16;
+    }
+    const auto p = 8 + (size_class - 16) / 4;
+    const auto k = (size_class - 16) % 4 + 1;
+    return (size_t{1} << p) + k * (size_t{1} << (p - 2));
+}
+
+UCTNodeArena::Slab* UCTNodeArena::new_slab() {
+#ifdef _WIN32
+    auto memory = _aligned_malloc(SLAB_SIZE, SLAB_SIZE);
+#else
+    auto memory = static_cast<void*>(nullptr);
+    if (posix_memalign(&memory, SLAB_SIZE, SLAB_SIZE) != 0) {
+        memory = nullptr;
+    }
+#endif
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    const auto slab = new (memory) Slab(this);
+    {
+        LOCK(m_mutex, lock);
+        m_slabs.emplace_back(slab);
+    }
+    s_reserved_size += SLAB_SIZE;
+    return slab;
+}
+
+void UCTNodeArena::release(Slab* const slab, const size_t bytes) {
+    if (slab->held.fetch_sub(bytes) != bytes) {
+        return;
+    }
+    {
+        LOCK(m_mutex, lock);
+        const auto it = std::find(begin(m_slabs), end(m_slabs), slab);
+        assert(it != end(m_slabs));
+        *it = m_slabs.back();
+        m_slabs.pop_back();
+    }
+    free_slab(slab);
+    s_reserved_size -= SLAB_SIZE;
+}
+
+void* UCTNodeArena::allocate(size_t bytes, size_t alignment) {
+    // Every block starts on a multiple of 16.
+    assert(alignment <= 16 && 16 % alignment == 0);
+    (void)alignment;
+    const auto index = size_class(bytes);
+    const auto size = class_size(index);
+    m_used += size;
+    s_tree_size += size;
+
+    auto& list = m_free[index];
+    if (list.head.load(std::memory_order_relaxed) != nullptr) {
+        LOCK(list.mutex, lock);
+        const auto block = list.head.load();
+        if (block != nullptr) {
+            list.head = block->next;
+            m_free_bytes -= size;
+            return block;
+        }
+    }
+
+    auto& current = s_thread_slab;
+    const auto align = [](const size_t offset) {
+        return (offset + 15) / 16 * 16;
+    };
+    if (current.arena_id != m_id
+        || align(current.slab->used) + size > SLAB_SIZE) {
+        if (current.arena_id == m_id) {
+            // Full, it goes once its blocks are released.
+            release(current.slab, 1);
+        }
+        current = {m_id, new_slab()};
+    }
+    const auto offset = align(current.slab->used);
+    assert(offset + size <= SLAB_SIZE);
+    current.slab->used = offset + size;
+    current.slab->held += size;
+    return reinterpret_cast<char*>(current.slab) + offset;
+}
+
+void UCTNodeArena::deallocate(void* block, size_t bytes) {
+    assert(&owner(block) == this);
+    const auto index = size_class(bytes);
+    const auto size = class_size(index);
+    m_used -= size;
+    s_tree_size -= size;
+    if (m_free_bytes + size > std::max(m_used.load(), SLAB_SIZE)) {
+        release(slab_of(block), size);
+        return;
+    }
+    auto& list = m_free[index];
+    LOCK(list.mutex, lock);
+    const auto released = static_cast<FreeBlock*>(block);
+    released->next = list.head.load();
+    list.head = released;
+    m_free_bytes += size;
+}
+
+UCTNodeArena::Slab* UCTNodeArena::slab_of(const void* object) {
+    const auto address = reinterpret_cast<std::uintptr_t>(object);
+    return reinterpret_cast<Slab*>(address & ~(SLAB_SIZE - 1));
+}
+
+UCTNodeArena& UCTNodeArena::owner(const void* object) {
+    return *slab_of(object)->arena;
+}
+
+size_t UCTNodeArena::get_tree_size() {
+    return s_tree_size.load();
+}
+
+size_t UCTNodeArena::get_reserved_size() {
+    return s_reserved_size.load();
+}
@@ -0,0 +1,154 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef UCTNODEARENA_H_INCLUDED
+#define UCTNODEARENA_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "SMP.h"
+
+// Allocator for the search tree.  UCTNodes and their child arrays are
+// carved out of slabs, one slab per thread at a time, so threads
+// expanding the tree don't contend for the heap.  Released blocks go to
+// a free list per size class and are handed out again before a slab is
+// bumped any further.  Destroying the arena releases all its slabs at
+// once, whatever is still allocated in them.  Everything allocated here
+// must therefore be trivially destructible.
+//
+// Retention: the free lists keep at most as many bytes as are allocated,
+// or one slab if that is more, so that a tree that shrinks by most of
+// its nodes after a move doesn't hold on to all of them.  Blocks
+// released past that are given up.  A slab goes back to the system as
+// soon as none of its blocks is allocated or on a free list and no
+// thread allocates from it any more.
+//
+// Slabs are aligned to their size, so the arena an object lives in can
+// be found from its address, see owner().  New nodes go to the arena of
+// their parent.
+class UCTNodeArena {
+public:
+    static constexpr size_t SLAB_SIZE = size_t{1} << 20;
+    // Largest block allocate() hands out.
+    static constexpr size_t MAX_BLOCK = size_t{1} << 16;
+
+    UCTNodeArena();
+    ~UCTNodeArena();
+    UCTNodeArena(const UCTNodeArena&) = delete;
+    UCTNodeArena& operator=(const UCTNodeArena&) = delete;
+
+    // alignment can be at most 16.
+    void* allocate(size_t bytes, size_t alignment);
+    // Give back a block from allocate() of the same size.  Thread safe,
+    // but the block must not be in use by any thread any more.
+    void deallocate(void* block, size_t bytes);
+
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "Arena objects are never destructed");
+        return new (allocate(sizeof(T), alignof(T)))
+            T(std::forward<Args>(args)...);
+    }
+    template <typename T>
+    void destroy(T* object) {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "Arena objects are never destructed");
+        deallocate(object, sizeof(T));
+    }
+
+    static UCTNodeArena& owner(const void* object);
+
+    // Bytes allocated from all arenas and not given back yet, rounded
+    // up to their size class.
+    static size_t get_tree_size();
+    // Bytes of the slabs all arenas hold from the system.
+    static size_t get_reserved_size();
+
+private:
+    struct Slab {
+        explicit Slab(UCTNodeArena* arena) : arena(arena) {}
+
+        UCTNodeArena* arena;
+        // Offset of the first free byte.
+        size_t used{sizeof(Slab)};
+        // Bytes of the blocks that are allocated or on a free list, plus
+        // one while a thread allocates from the slab.  The slab is freed
+        // when this drops to zero.
+        std::atomic<size_t> held{1};
+    };
+    // The slab the current thread allocates from and its arena.
+    struct ThreadSlab {
+        std::uint64_t arena_id;
+        Slab* slab;
+    };
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+    // Released blocks of one size class.
+    struct FreeList {
+        SMP::Mutex mutex;
+        std::atomic<FreeBlock*> head{nullptr};
+    };
+
+    // Multiples of 16 bytes up to 256, then four classes per doubling.
+    static constexpr size_t NUM_CLASSES = 16 + 4 * 8;
+    static size_t size_class(size_t bytes);
+    static size_t class_size(size_t size_class);
+
+    static Slab* slab_of(const void* object);
+    Slab* new_slab();
+    // Drop bytes of what slab holds, freeing it when nothing is left.
+    void release(Slab* slab, size_t bytes);
+
+    std::uint64_t m_id;
+    SMP::Mutex m_mutex;
+    std::vector<Slab*> m_slabs;
+    std::array<FreeList, NUM_CLASSES> m_free;
+    // Bytes allocated from this arena and not given back.
+    std::atomic<size_t> m_used{0};
+    // Bytes on the free lists.
+    std::atomic<size_t> m_free_bytes{0};
+
+    static thread_local ThreadSlab s_thread_slab;
+    static std::atomic<std::uint64_t> s_next_id;
+    static std::atomic<size_t> s_tree_size;
+    static std::atomic<size_t> s_reserved_size;
+};
+
+#endif
@@ -33,33 +33,11 @@
 #include <memory>
 #include <cassert>
 #include <cstring>
+#include <limits>
+#include <new>
 
 #include "UCTNode.h"
-
-std::atomic<size_t> UCTNodePointer::m_tree_size = {0};
-
-size_t UCTNodePointer::get_tree_size() {
-    return m_tree_size.load();
-}
-
-void UCTNodePointer::increment_tree_size(size_t sz) {
-    m_tree_size += sz;
-}
-
-void UCTNodePointer::decrement_tree_size(size_t sz) {
-    assert(UCTNodePointer::m_tree_size >= sz);
-    m_tree_size -= sz;
-}
-
-UCTNodePointer::~UCTNodePointer() {
-    auto sz = sizeof(UCTNodePointer);
-    auto v = m_data.load();
-    if (is_inflated(v)) {
-        delete read_ptr(v);
-        sz += sizeof(UCTNode);
-    }
-    decrement_tree_size(sz);
-}
+#include "UCTNodeArena.h"
 
 UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
     auto nv = std::atomic_exchange(&n.m_data, INVALID);
@@ -69,7 +47,6 @@ UCTNodePointer::UCTNodePointer(UCTNodePointer&& n) {
 #else
     assert(v == INVALID);
 #endif
-    increment_tree_size(sizeof(UCTNodePointer));
 }
 
 UCTNodePointer::UCTNodePointer(std::int16_t vertex, float policy) {
@@ -79,24 +56,15 @@ UCTNodePointer::UCTNodePointer(std::int16_t vertex, float policy) {
 
     m_data =  (static_cast<std::uint64_t>(i_policy)  << 32)
             | (static_cast<std::uint64_t>(i_vertex) << 16);
-    increment_tree_size(sizeof(UCTNodePointer));
 }
 
-UCTNodePointer& UCTNodePointer::operator=(UCTNodePointer&& n) {
-    auto nv = std::atomic_exchange(&n.m_data, INVALID);
-    auto v = std::atomic_exchange(&m_data, nv);
-
-    if (is_inflated(v)) {
-        decrement_tree_size(sizeof(UCTNode));
-        delete read_ptr(v);
-    }
-    return *this;
+UCTNodePointer::UCTNodePointer(UCTNode* node) {
+    m_data = reinterpret_cast<std::uint64_t>(node) | POINTER;
 }
 
-UCTNode * UCTNodePointer::release() {
-    auto v = std::atomic_exchange(&m_data, INVALID);
-    decrement_tree_size(sizeof(UCTNode));
-    return read_ptr(v);
+UCTNodePointer& UCTNodePointer::operator=(UCTNodePointer&& n) {
+    m_data = std::atomic_exchange(&n.m_data, INVALID);
+    return *this;
 }
 
 void UCTNodePointer::inflate() const {
@@ -104,25 +72,27 @@ void UCTNodePointer::inflate() const {
         auto v = m_data.load();
         if (is_inflated(v)) return;
 
+        auto& arena = UCTNodeArena::owner(this);
         auto v2 = reinterpret_cast<std::uint64_t>(
-            new UCTNode(read_vertex(v), read_policy(v))
+            arena.create<UCTNode>(read_vertex(v), read_policy(v))
         ) | POINTER;
         bool success = m_data.compare_exchange_strong(v, v2);
         if (success) {
-            increment_tree_size(sizeof(UCTNode));
             return;
-        } else {
-            // this means that somebody else also modified this instance.
-            // Try again next time
-            delete read_ptr(v2);
         }
+        // this means that somebody else also modified this instance.
+        // Try again next time, nobody saw the node we made.
+        arena.destroy(read_ptr(v2));
     }
 }
 
-bool UCTNodePointer::valid() const {
-    auto v = m_data.load();
-    if (is_inflated(v)) return read_ptr(v)->valid();
-    return true;
+UCTNode* UCTNodePointer::replace(UCTNode* expected, UCTNode* node) const {
+    auto v = reinterpret_cast<std::uint64_t>(expected) | POINTER;
+    const auto v2 = reinterpret_cast<std::uint64_t>(node) | POINTER;
+    if (m_data.compare_exchange_strong(v, v2)) {
+        return node;
+    }
+    return read_ptr(v);
 }
 
 int UCTNodePointer::get_visits() const {
@@ -143,12 +113,6 @@ float UCTNodePointer::get_eval_lcb(int color) const {
     return read_ptr(v)->get_eval_lcb(color);
 }
 
-bool UCTNodePointer::active() const {
-    auto v = m_data.load();
-    if (is_inflated(v)) return read_ptr(v)->active();
-    return true;
-}
-
 float UCTNodePointer::get_eval(int tomove) const {
     // this can only be called if it is an inflated pointer
     auto v = m_data.load();
@@ -161,3 +125,55 @@ int UCTNodePointer::get_move() const {
     if (is_inflated(v)) return read_ptr(v)->get_move();
     return read_vertex(v);
 }
+
+UCTNodeChildren::UCTNodeChildren(UCTNodeArena& arena, size_t capacity)
+    : m_capacity(static_cast<std::uint16_t>(capacity)) {
+    static_assert(sizeof(UCTNodePointer) + sizeof(std::atomic<float>)
+                  + sizeof(float) + sizeof(std::atomic<int>)
+                  + sizeof(std::atomic<std::int16_t>)
+                  + sizeof(std::atomic<std::uint8_t>) == ENTRY_SIZE,
+                  "UCTNodeChildren offsets assume these sizes");
+    assert(capacity <= std::numeric_limits<std::uint16_t>::max());
+    if (capacity == 0) {
+        return;
+    }
+    m_block = static_cast<char*>(arena.allocate(ENTRY_SIZE * m_capacity,
+                                                alignof(UCTNodePointer)));
+    for (auto i = size_t{0}; i < capacity; i++) {
+        new (&blackevals()[i]) std::atomic<float>(0.0f);
+        policy()[i] = 0.0f;
+        new (&visits()[i]) std::atomic<int>(0);
+        new (&virtual_loss()[i]) std::atomic<std::int16_t>(0);
+        new (&status()[i]) std::atomic<std::uint8_t>(UCTNode::ACTIVE);
+    }
+}
+
+void UCTNodeChildren::release() {
+    if (m_block != nullptr) {
+        // All trivial, but these are the objects that live in the block.
+        for (auto i = size_t{0}; i < m_size; i++) {
+            pointers()[i].~UCTNodePointer();
+        }
+        for (auto i = size_t{0}; i < m_capacity; i++) {
+            blackevals()[i].~atomic();
+            visits()[i].~atomic();
+            virtual_loss()[i].~atomic();
+            status()[i].~atomic();
+        }
+        UCTNodeArena::owner(m_block).deallocate(m_block,
+                                                ENTRY_SIZE * m_capacity);
+        m_block = nullptr;
+    }
+    m_size = 0;
+    m_capacity = 0;
+}
+
+void UCTNodeChildren::copy_stats(size_t i, const UCTNodeChildren& from,
+                                 size_t j) {
+    assert(i < m_capacity && j < from.size());
+    blackevals()[i] = from.blackevals()[j].load();
+    policy()[i] = from.policy()[j];
+    visits()[i] = from.visits()[j].load();
+    virtual_loss()[i] = from.virtual_loss()[j].load();
+    status()[i] = from.status()[j].load();
+}
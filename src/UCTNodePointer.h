@@ -35,23 +35,28 @@
 #include <atomic>
 #include <memory>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
+#include <new>
+#include <utility>
 
 #include "SMP.h"
 
 class UCTNode;
 
-// 'lazy-initializable' version of std::unique_ptr<UCTNode>.
+// 'lazy-initializable' pointer to a UCTNode.
 // When a UCTNodePointer is constructed, the constructor arguments
 // are stored instead of constructing the actual UCTNode instance.
 // Later when the UCTNode is needed, the external code calls inflate()
 // which actually constructs the UCTNode. Basically, this is a 'tagged union'
 // of:
-//  - std::unique_ptr<UCTNode> pointer;
+//  - UCTNode* pointer;
 //  - std::pair<float, std::int16_t> args;
+// The UCTNode is allocated in the UCTNodeArena the pointer itself lives
+// in and is released by the owner of the tree, not by the pointer.
 
-// All methods should be thread-safe except destructor and when
-// the instanced is 'moved from'.
+// All methods should be thread-safe except when the instance is
+// 'moved from'.
 
 class UCTNodePointer {
 private:
@@ -59,10 +64,6 @@ private:
     static constexpr std::uint64_t POINTER = 1;
     static constexpr std::uint64_t UNINFLATED = 0;
 
-    static std::atomic<size_t> m_tree_size;
-    static void increment_tree_size(size_t sz);
-    static void decrement_tree_size(size_t sz);
-
     // the raw storage used here.
     // if bit [1:0] is 1, m_data is the actual pointer.
     // if bit [1:0] is 0, bit [31:16] is the vertex value, bit [63:32] is the policy
@@ -96,11 +97,9 @@ private:
     }
 
 public:
-    static size_t get_tree_size();
-
-    ~UCTNodePointer();
     UCTNodePointer(UCTNodePointer&& n);
     UCTNodePointer(std::int16_t vertex, float policy);
+    explicit UCTNodePointer(UCTNode* node);
     UCTNodePointer(const UCTNodePointer&) = delete;
 
 
@@ -108,7 +107,8 @@ public:
         return is_inflated(m_data.load());
     }
 
-    // methods from std::unique_ptr<UCTNode>
+    // methods from std::unique_ptr<UCTNode>, except that the
+    // UCTNode is not owned
     typename std::add_lvalue_reference<UCTNode>::type operator*() const{
         return *read_ptr(m_data.load());
     }
@@ -119,21 +119,96 @@ public:
         return read_ptr(m_data.load());
     }
     UCTNodePointer& operator=(UCTNodePointer&& n);
-    UCTNode * release();
 
     // construct UCTNode instance from the vertex/policy pair
     void inflate() const;
+    // Point to node instead of expected, unless another thread changed
+    // the pointer first.  Returns the node pointed to after that.
+    UCTNode* replace(UCTNode* expected, UCTNode* node) const;
 
     // proxy of UCTNode methods which can be called without
     // constructing UCTNode
-    bool valid() const;
     int get_visits() const;
     float get_policy() const;
-    bool active() const;
     int get_move() const;
     // these can only be called if it is an inflated pointer
     float get_eval(int tomove) const;
     float get_eval_lcb(int color) const;
 };
 
+class UCTNodeArena;
+
+// The children of a UCTNode, in the arena of the node.  The parent also
+// keeps a copy of the child statistics that uct_select_child needs, one
+// array per statistic, so that scoring the children is a linear pass
+// that does not touch the child nodes.  UCTNode keeps the copies in sync
+// with the children.
+//
+// UCTNodeChildren owns its block: the constructor starts the lifetime
+// of the statistics and release() ends it.  It cannot be a destructor,
+// as UCTNodes must be trivially destructible for the arena.
+class UCTNodeChildren {
+public:
+    UCTNodeChildren() = default;
+    // Room for capacity children in arena, none there yet.
+    UCTNodeChildren(UCTNodeArena& arena, size_t capacity);
+
+    UCTNodePointer* begin() { return pointers(); }
+    UCTNodePointer* end() { return pointers() + m_size; }
+    const UCTNodePointer* begin() const { return pointers(); }
+    const UCTNodePointer* end() const { return pointers() + m_size; }
+    UCTNodePointer& operator[](size_t i) { return pointers()[i]; }
+    const UCTNodePointer& operator[](size_t i) const { return pointers()[i]; }
+    const UCTNodePointer& front() const { return pointers()[0]; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    // The statistics of the child start at zero, see
+    // UCTNode::sync_child_stats.
+    void push_back(UCTNodePointer&& child) {
+        assert(m_size < m_capacity);
+        new (&pointers()[m_size++]) UCTNodePointer(std::move(child));
+    }
+    // Give the block back to its arena.  The children themselves are
+    // not released.
+    void release();
+    // Set the statistics of child i to those of child j of from.  Not
+    // thread safe.
+    void copy_stats(size_t i, const UCTNodeChildren& from, size_t j);
+
+    // Per child copies of the UCTNode statistics of the same name.  The
+    // evals are summed in float, which is plenty for comparing children.
+    std::atomic<float>* blackevals() const {
+        return reinterpret_cast<std::atomic<float>*>(pointers() + m_capacity);
+    }
+    float* policy() const {
+        return reinterpret_cast<float*>(blackevals() + m_capacity);
+    }
+    std::atomic<int>* visits() const {
+        return reinterpret_cast<std::atomic<int>*>(policy() + m_capacity);
+    }
+    std::atomic<std::int16_t>* virtual_loss() const {
+        return reinterpret_cast<std::atomic<std::int16_t>*>(
+            visits() + m_capacity);
+    }
+    // UCTNode::Status
+    std::atomic<std::uint8_t>* status() const {
+        return reinterpret_cast<std::atomic<std::uint8_t>*>(
+            virtual_loss() + m_capacity);
+    }
+
+    // Bytes per child in the arena.
+    static constexpr size_t ENTRY_SIZE = 23;
+
+private:
+    UCTNodePointer* pointers() const {
+        return reinterpret_cast<UCTNodePointer*>(m_block);
+    }
+
+    // The arrays one after another, largest alignment first.
+    char* m_block{nullptr};
+    std::uint16_t m_size{0};
+    std::uint16_t m_capacity{0};
+};
+
 #endif
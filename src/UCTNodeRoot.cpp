@@ -32,6 +32,7 @@
 #include <algorithm>
 #include <cassert>
 #include <iterator>
+#include <new>
 #include <numeric>
 #include <random>
 #include <utility>
@@ -42,6 +43,7 @@
 #include "FastState.h"
 #include "KoState.h"
 #include "Random.h"
+#include "SearchState.h"
 #include "UCTNode.h"
 #include "Utils.h"
 #include "GTP.h"
@@ -60,40 +62,44 @@ UCTNode* UCTNode::get_first_child() const {
 }
 
 void UCTNode::kill_superkos(const GameState& state) {
-    UCTNodePointer *pass_child = nullptr;
+    auto pass_index = m_children.size();
     size_t valid_count = 0;
 
-    for (auto& child : m_children) {
-        auto move = child->get_move();
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        auto move = m_children[i].get_move();
         if (move != FastBoard::PASS) {
             KoState mystate = state;
             mystate.play_move(move);
 
             if (mystate.superko()) {
                 // Don't delete nodes for now, just mark them invalid.
-                child->invalidate();
+                child_invalidate(i);
             }
         } else {
-            pass_child = &child;
+            pass_index = i;
         }
-        if (child->valid()) {
+        if (child_valid(i)) {
             valid_count++;
         }
     }
 
-    if (valid_count > 1 && pass_child &&
+    if (valid_count > 1 && pass_index < m_children.size() &&
             !state.is_move_legal(state.get_to_move(), FastBoard::PASS)) {
         // Remove the PASS node according to "avoid" -- but only if there are
         // other valid nodes left.
-        (*pass_child)->invalidate();
+        child_invalidate(pass_index);
     }
 
     // Now do the actual deletion.
-    m_children.erase(
-        std::remove_if(begin(m_children), end(m_children),
-                       [](const auto &child) { return !child->valid(); }),
-        end(m_children)
-    );
+    auto valid_children = std::vector<size_t>{};
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        if (child_valid(i)) {
+            valid_children.emplace_back(i);
+        }
+    }
+    if (valid_children.size() < m_children.size()) {
+        reorder_children(valid_children);
+    }
 }
 
 void UCTNode::dirichlet_noise(float epsilon, float alpha) {
@@ -118,12 +124,13 @@ void UCTNode::dirichlet_noise(float epsilon, float alpha) {
         v /= sample_sum;
     }
 
-    child_cnt = 0;
-    for (auto& child : m_children) {
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        const auto& child = m_children[i];
         auto policy = child->get_policy();
-        auto eta_a = dirichlet_vector[child_cnt++];
+        auto eta_a = dirichlet_vector[i];
         policy = policy * (1 - epsilon) + epsilon * eta_a;
         child->set_policy(policy);
+        m_children.policy()[i] = policy;
     }
 }
 
@@ -132,8 +139,8 @@ void UCTNode::randomize_first_proportionally() {
     auto norm_factor = 0.0;
     auto accum_vector = std::vector<double>{};
 
-    for (const auto& child : m_children) {
-        auto visits = child->get_visits();
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        auto visits = get_move_visits(i);
         if (norm_factor == 0.0) {
             norm_factor = visits;
             // Nonsensical options? End of game?
@@ -166,7 +173,10 @@ void UCTNode::randomize_first_proportionally() {
     assert(m_children.size() > index);
 
     // Now swap the child at index with the first child
-    std::iter_swap(begin(m_children), begin(m_children) + index);
+    auto order = std::vector<size_t>(m_children.size());
+    std::iota(begin(order), end(order), size_t{0});
+    std::swap(order[0], order[index]);
+    reorder_children(order);
 }
 
 UCTNode* UCTNode::get_nopass_child(FastState& state) const {
@@ -184,12 +194,12 @@ UCTNode* UCTNode::get_nopass_child(FastState& state) const {
 }
 
 // Used to find new root in UCTSearch.
-std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
+UCTNode* UCTNode::find_child(const int move) {
     for (auto& child : m_children) {
         if (child.get_move() == move) {
              // no guarantee that this is a non-inflated node
             child.inflate();
-            return std::unique_ptr<UCTNode>(child.release());
+            return child.get();
         }
     }
 
@@ -197,6 +207,28 @@ std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
     return nullptr;
 }
 
+// Used by UCTSearch to give the part of the tree that is no longer in
+// use back to the arena, away from the main thread.  keep and the nodes
+// in kept stay, and so does everything below them.  With released,
+// nodes reached more than once are released once.
+void UCTNode::release_tree(UCTNode* const node, const UCTNode* const keep,
+        const std::unordered_set<const UCTNode*>* const kept,
+        std::unordered_set<const UCTNode*>* const released) {
+    if (node == keep || (kept && kept->count(node))) {
+        return;
+    }
+    if (released && !released->insert(node).second) {
+        return;
+    }
+    for (const auto& child : node->m_children) {
+        if (child.is_inflated()) {
+            release_tree(child.get(), keep, kept, released);
+        }
+    }
+    node->m_children.release();
+    UCTNodeArena::owner(node).destroy(node);
+}
+
 void UCTNode::inflate_all_children() {
     for (const auto& node : get_children()) {
         node.inflate();
@@ -209,7 +241,10 @@ void UCTNode::prepare_root_node(Network & network, int color,
     float root_eval;
     const auto had_children = has_children();
     if (expandable()) {
-        create_children(network, nodes, root_state, root_eval);
+        auto search_state = SearchState{root_state};
+        create_children(network, nodes, search_state, root_eval, 0.0f,
+                        cfg_root_average ? Network::Ensemble::AVERAGE
+                                         : Network::Ensemble::RANDOM_SYMMETRY);
     }
     if (had_children) {
         root_eval = get_net_eval(color);
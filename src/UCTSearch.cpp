@@ -38,6 +38,7 @@
 #include <limits>
 #include <memory>
 #include <type_traits>
+#include <unordered_set>
 #include <algorithm>
 
 #include "FastBoard.h"
@@ -45,6 +46,7 @@
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "SearchState.h"
 #include "TimeControl.h"
 #include "Timing.h"
 #include "Training.h"
@@ -110,8 +112,14 @@ UCTSearch::UCTSearch(GameState& g, Network& network)
     : m_rootstate(g), m_network(network) {
     set_playout_limit(cfg_max_playouts);
     set_visit_limit(cfg_max_visits);
+}
 
-    m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+UCTSearch::~UCTSearch() {
+    // The released nodes go back to m_arena.
+    while (!m_delete_futures.empty()) {
+        m_delete_futures.front().wait_all();
+        m_delete_futures.pop_front();
+    }
 }
 
 bool UCTSearch::advance_to_new_rootstate() {
@@ -142,31 +150,12 @@ bool UCTSearch::advance_to_new_rootstate() {
         return false;
     }
 
-    // Make sure that the nodes we destroyed the previous move are
-    // in fact destroyed.
-    while (!m_delete_futures.empty()) {
-        m_delete_futures.front().wait_all();
-        m_delete_futures.pop_front();
-    }
-
     // Try to replay moves advancing m_root
     for (auto i = 0; i < depth; i++) {
-        ThreadGroup tg(thread_pool);
-
         test->forward_move();
         const auto move = test->get_last_move();
 
-        auto oldroot = std::move(m_root);
-        m_root = oldroot->find_child(move);
-
-        // Lazy tree destruction.  Instead of calling the destructor of the
-        // old root node on the main thread, send the old root to a separate
-        // thread and destroy it from the child thread.  This will save a
-        // bit of time when dealing with large trees.
-        auto p = oldroot.release();
-        tg.add_task([p]() { delete p; });
-        m_delete_futures.push_back(std::move(tg));
-
+        m_root = m_root->find_child(move);
         if (!m_root) {
             // Tree hasn't been expanded this far
             return false;
@@ -190,17 +179,66 @@ void UCTSearch::update_root() {
     m_playouts = 0;
 
 #ifndef NDEBUG
-    auto start_nodes = m_root->count_nodes_and_clear_expand_state();
+    auto start_nodes =
+        m_root ? m_root->count_nodes_and_clear_expand_state() : 0;
 #endif
 
-    if (!advance_to_new_rootstate() || !m_root) {
-        m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    // Make sure that the nodes we released the previous move are
+    // in fact released.
+    while (!m_delete_futures.empty()) {
+        m_delete_futures.front().wait_all();
+        m_delete_futures.pop_front();
+    }
+
+    const auto old_root = m_root;
+    // A tree searched with the other setting of cfg_transpositions
+    // cannot be reused.
+    const auto same_mode = bool(m_transpositions) == cfg_transpositions;
+    if (!advance_to_new_rootstate() || !m_root || !same_mode) {
+        // Lazy tree destruction.  Instead of freeing the old tree on the
+        // main thread, send its arena to a separate thread and destroy
+        // it there.  This will save a bit of time when dealing with
+        // large trees.
+        if (m_arena) {
+            ThreadGroup tg(thread_pool);
+            auto arena = m_arena.release();
+            auto transpositions = m_transpositions.release();
+            tg.add_task([arena, transpositions]() {
+                delete transpositions;
+                delete arena;
+            });
+            m_delete_futures.push_back(std::move(tg));
+        }
+        m_arena = std::make_unique<UCTNodeArena>();
+        m_root = m_arena->create<UCTNode>(FastBoard::PASS, 0.0f);
+        m_transpositions.reset(cfg_transpositions ? new TranspositionTable
+                                                  : nullptr);
+    } else if (m_transpositions) {
+        // A node can be reachable both from the new root and from a
+        // discarded part of the tree, so find what we keep first and drop
+        // the rest from the table.  The nodes that child_link() replaced
+        // go as well, now that no thread can be searching them.
+        auto orphans = m_transpositions->take_orphans();
+        if (m_root != old_root || !orphans.empty()) {
+            auto kept = std::make_shared<std::unordered_set<const UCTNode*>>();
+            m_root->count_nodes_and_clear_expand_state(kept.get());
+            kept->insert(m_root);
+            m_transpositions->retain(*kept);
+            release_nodes(old_root, std::move(orphans), std::move(kept));
+        }
+    } else if (m_root != old_root) {
+        release_nodes(old_root, {}, nullptr);
     }
     // Clear last_rootstate to prevent accidental use.
     m_last_rootstate.reset(nullptr);
 
     // Check how big our search tree (reused or new) is.
-    m_nodes = m_root->count_nodes_and_clear_expand_state();
+    if (m_transpositions) {
+        auto seen = std::unordered_set<const UCTNode*>{};
+        m_nodes = m_root->count_nodes_and_clear_expand_state(&seen);
+    } else {
+        m_nodes = m_root->count_nodes_and_clear_expand_state();
+    }
 
 #ifndef NDEBUG
     if (m_nodes > 0) {
@@ -210,8 +248,31 @@ void UCTSearch::update_root() {
 #endif
 }
 
+void UCTSearch::release_nodes(
+    UCTNode* const old_root, std::vector<UCTNode*> orphans,
+    std::shared_ptr<const std::unordered_set<const UCTNode*>> kept) {
+    // Hand the nodes we no longer need back to the arena, also on a
+    // separate thread.
+    ThreadGroup tg(thread_pool);
+    const auto root = m_root;
+    tg.add_task([old_root, root, orphans, kept]() {
+        auto released = std::unordered_set<const UCTNode*>{};
+        const auto once = kept ? &released : nullptr;
+        UCTNode::release_tree(old_root, root, kept.get(), once);
+        for (const auto orphan : orphans) {
+            UCTNode::release_tree(orphan, root, kept.get(), once);
+        }
+    });
+    m_delete_futures.push_back(std::move(tg));
+}
+
+size_t UCTSearch::get_tree_size() {
+    return UCTNodeArena::get_tree_size()
+        + TranspositionTable::get_memory_used();
+}
+
 float UCTSearch::get_min_psa_ratio() const {
-    const auto mem_full = UCTNodePointer::get_tree_size() / static_cast<float>(cfg_max_tree_size);
+    const auto mem_full = get_tree_size() / static_cast<float>(cfg_max_tree_size);
     // If we are halfway through our memory budget, start trimming
     // moves with very low policy priors.
     if (mem_full > 0.5f) {
@@ -228,10 +289,11 @@ float UCTSearch::get_min_psa_ratio() const {
     return 0.0f;
 }
 
-SearchResult UCTSearch::play_simulation(GameState & currstate,
+SearchResult UCTSearch::play_simulation(SearchState & currstate,
                                         UCTNode* const node) {
     const auto color = currstate.get_to_move();
     auto result = SearchResult{};
+    auto updated = false;
 
     node->virtual_loss();
 
@@ -252,18 +314,40 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
     }
 
     if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(color, node == m_root.get());
+        auto index = size_t{0};
+        auto next = node->uct_select_child(color, node == m_root, index);
         auto move = next->get_move();
 
         currstate.play_move(move);
         if (move != FastBoard::PASS && currstate.superko()) {
-            next->invalidate();
+            node->child_invalidate(index);
         } else {
+            node->child_stats_virtual_loss(index);
+            const auto edge_visits = node->get_child_visits(index);
+            if (m_transpositions && edge_visits == 0) {
+                // First time through this edge, use the node of the
+                // position if it was reached by other moves before.
+                const auto child = next;
+                next = node->child_link(index, m_transpositions->insert(
+                    currstate.get_transposition_key(), child));
+                if (next != child) {
+                    m_transpositions->add_orphan(child);
+                }
+            }
             result = play_simulation(currstate, next);
+            if (result.valid() && m_transpositions) {
+                // Pass the result of the playout on as it is, the
+                // parent's variance is that of the playouts.
+                node->update_from_child(index, result.eval());
+                updated = true;
+            } else if (result.valid()) {
+                node->child_stats_update(index, result.eval());
+            }
+            node->child_stats_virtual_loss_undo(index);
         }
     }
 
-    if (result.valid()) {
+    if (result.valid() && !updated) {
         node->update(result.eval());
     }
     node->virtual_loss_undo();
@@ -279,8 +363,8 @@ void UCTSearch::dump_stats(FastState & state, UCTNode & parent) {
     const int color = state.get_to_move();
 
     auto max_visits = 0;
-    for (const auto& node : parent.get_children()) {
-        max_visits = std::max(max_visits, node->get_visits());
+    for (auto i = size_t{0}; i < parent.get_children().size(); i++) {
+        max_visits = std::max(max_visits, parent.get_move_visits(i));
     }
 
     // sort children, put best move on top
@@ -371,6 +455,9 @@ void UCTSearch::tree_stats(const UCTNode& node) {
     size_t depth_sum = 0;
     size_t max_depth = 0;
     size_t children_count = 0;
+    // With transpositions, shared nodes are only counted at the depth
+    // they are first found at.
+    std::unordered_set<const UCTNode*> seen;
 
     std::function<void(const UCTNode& node, size_t)> traverse =
           [&](const UCTNode& node, size_t depth) {
@@ -382,7 +469,9 @@ void UCTSearch::tree_stats(const UCTNode& node) {
         for (const auto& child : node.get_children()) {
             if (child.get_visits() > 0) {
                 children_count += 1;
-                traverse(*(child.get()), depth+1);
+                if (!m_transpositions || seen.insert(child.get()).second) {
+                    traverse(*(child.get()), depth+1);
+                }
             } else {
                 nodes += 1;
                 depth_sum += depth+1;
@@ -459,8 +548,8 @@ int UCTSearch::get_best_move(passflag_t passflag) {
     int color = m_rootstate.board.get_to_move();
 
     auto max_visits = 0;
-    for (const auto& node : m_root->get_children()) {
-        max_visits = std::max(max_visits, node->get_visits());
+    for (auto i = size_t{0}; i < m_root->get_children().size(); i++) {
+        max_visits = std::max(max_visits, m_root->get_move_visits(i));
     }
 
     // Make sure best is first
@@ -628,7 +717,7 @@ std::string UCTSearch::get_analysis(int playouts) {
 }
 
 bool UCTSearch::is_running() const {
-    return m_run && UCTNodePointer::get_tree_size() < cfg_max_tree_size;
+    return m_run && get_tree_size() < cfg_max_tree_size;
 }
 
 int UCTSearch::est_playouts_left(int elapsed_centis, int time_for_move) const {
@@ -654,9 +743,11 @@ size_t UCTSearch::prune_noncontenders(int color, int elapsed_centis, int time_fo
     // There are no cases where the root's children vector gets modified
     // during a multithreaded search, so it is safe to walk it here without
     // taking the (root) node lock.
-    for (const auto& node : m_root->get_children()) {
-        if (node->valid()) {
-            const auto visits = node->get_visits();
+    const auto& children = m_root->get_children();
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        const auto& node = children[i];
+        if (m_root->child_valid(i)) {
+            const auto visits = m_root->get_move_visits(i);
             if (visits > 0) {
                 lcb_max = std::max(lcb_max, node->get_eval_lcb(color));
             }
@@ -666,9 +757,10 @@ size_t UCTSearch::prune_noncontenders(int color, int elapsed_centis, int time_fo
     const auto min_required_visits =
         Nfirst - est_playouts_left(elapsed_centis, time_for_move);
     auto pruned_nodes = size_t{0};
-    for (const auto& node : m_root->get_children()) {
-        if (node->valid()) {
-            const auto visits = node->get_visits();
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        const auto& node = children[i];
+        if (m_root->child_valid(i)) {
+            const auto visits = m_root->get_move_visits(i);
             const auto has_enough_visits =
                 visits >= min_required_visits;
             // Avoid pruning moves that could have the best lower confidence
@@ -678,7 +770,7 @@ size_t UCTSearch::prune_noncontenders(int color, int elapsed_centis, int time_fo
             const auto prune_this_node = !(has_enough_visits || high_winrate);
 
             if (prune) {
-                node->set_active(!prune_this_node);
+                m_root->child_set_active(i, !prune_this_node);
             }
             if (prune_this_node) {
                 ++pruned_nodes;
@@ -732,8 +824,8 @@ bool UCTSearch::stop_thinking(int elapsed_centis, int time_for_move) const {
 
 void UCTWorker::operator()() {
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-        auto result = m_search->play_simulation(*currstate, m_root);
+        auto currstate = SearchState{m_rootstate};
+        auto result = m_search->play_simulation(currstate, m_root);
         if (result.valid()) {
             m_search->increment_playouts();
         }
@@ -770,16 +862,16 @@ int UCTSearch::think(int color, passflag_t passflag) {
     int cpus = cfg_num_threads;
     ThreadGroup tg(thread_pool);
     for (int i = 1; i < cpus; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
 
     auto keeprunning = true;
     auto last_update = 0;
     auto last_output = 0;
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
+        auto currstate = SearchState{m_rootstate};
 
-        auto result = play_simulation(*currstate, m_root.get());
+        auto result = play_simulation(currstate, m_root);
         if (result.valid()) {
             increment_playouts();
         }
@@ -814,8 +906,8 @@ int UCTSearch::think(int color, passflag_t passflag) {
     tg.wait_all();
 
     // Reactivate all pruned root children.
-    for (const auto& node : m_root->get_children()) {
-        node->set_active(true);
+    for (auto i = size_t{0}; i < m_root->get_children().size(); i++) {
+        m_root->child_set_active(i, true);
     }
 
     m_rootstate.stop_clock(color);
@@ -879,14 +971,14 @@ void UCTSearch::ponder() {
     m_run = true;
     ThreadGroup tg(thread_pool);
     for (auto i = size_t{1}; i < cfg_num_threads; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+        tg.add_task(UCTWorker(m_rootstate, this, m_root));
     }
     Time start;
     auto keeprunning = true;
     auto last_output = 0;
     do {
-        auto currstate = std::make_unique<GameState>(m_rootstate);
-        auto result = play_simulation(*currstate, m_root.get());
+        auto currstate = SearchState{m_rootstate};
+        auto result = play_simulation(currstate, m_root);
         if (result.valid()) {
             increment_playouts();
         }
@@ -30,11 +30,13 @@
 #ifndef UCTSEARCH_H_INCLUDED
 #define UCTSEARCH_H_INCLUDED
 
-#include <list>
 #include <atomic>
+#include <list>
 #include <memory>
 #include <string>
 #include <tuple>
+#include <unordered_set>
+#include <vector>
 #include <future>
 
 #include "ThreadPool.h"
@@ -42,7 +44,10 @@
 #include "FastState.h"
 #include "GameState.h"
 #include "UCTNode.h"
+#include "UCTNodeArena.h"
 #include "Network.h"
+#include "SearchState.h"
+#include "TranspositionTable.h"
 
 
 class SearchResult {
@@ -76,6 +81,8 @@ namespace TimeManagement {
 };
 
 class UCTSearch {
+    friend class LeelaTest;
+
 public:
     /*
         Depending on rule set and state of the game, we might
@@ -108,6 +115,7 @@ public:
         std::numeric_limits<int>::max() / 2;
 
     UCTSearch(GameState& g, Network & network);
+    ~UCTSearch();
     int think(int color, passflag_t passflag = NORMAL);
     void set_playout_limit(int playouts);
     void set_visit_limit(int visits);
@@ -115,7 +123,9 @@ public:
     bool is_running() const;
     void increment_playouts();
     std::string explain_last_think() const;
-    SearchResult play_simulation(GameState& currstate, UCTNode* const node);
+    SearchResult play_simulation(SearchState& currstate, UCTNode* const node);
+    // Bytes used by the search trees and their transposition tables.
+    static size_t get_tree_size();
 
 private:
     float get_min_psa_ratio() const;
@@ -131,12 +141,24 @@ private:
     bool stop_thinking(int elapsed_centis = 0, int time_for_move = 0) const;
     int get_best_move(passflag_t passflag);
     void update_root();
+    // Release what is below old_root and the orphans, except for the new
+    // root and, with transpositions, the kept nodes and what is below
+    // them.
+    void release_nodes(
+        UCTNode* old_root, std::vector<UCTNode*> orphans,
+        std::shared_ptr<const std::unordered_set<const UCTNode*>> kept);
     bool advance_to_new_rootstate();
     void output_analysis(FastState & state, UCTNode & parent);
 
     GameState & m_rootstate;
     std::unique_ptr<GameState> m_last_rootstate;
-    std::unique_ptr<UCTNode> m_root;
+    // The tree is allocated in m_arena.  update_root() gives the nodes
+    // it no longer needs back to it, or replaces it when nothing is kept.
+    std::unique_ptr<UCTNodeArena> m_arena;
+    UCTNode* m_root{nullptr};
+    // The nodes by position with --transpositions, null otherwise.
+    std::unique_ptr<TranspositionTable> m_transpositions;
+    std::list<Utils::ThreadGroup> m_delete_futures;
     std::atomic<int> m_nodes{0};
     std::atomic<int> m_playouts{0};
     std::atomic<bool> m_run{false};
@@ -144,8 +166,6 @@ private:
     int m_maxvisits;
     std::string m_think_output;
 
-    std::list<Utils::ThreadGroup> m_delete_futures;
-
     Network & m_network;
 };
 
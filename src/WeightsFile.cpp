@@ -0,0 +1,381 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <utility>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/spirit/home/x3.hpp>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define WEIGHTS_MMAP
+#endif
+
+#include "zlib.h"
+
+#include "WeightsFile.h"
+#include "Timing.h"
+#include "Utils.h"
+#include "WorkerTeam.h"
+
+namespace x3 = boost::spirit::x3;
+using namespace Utils;
+
+// Binary format, in native (little-endian) byte order:
+//
+//   char     magic[8]       "LZWEIGHT"
+//   uint32   format version BINARY_VERSION
+//   uint32   text version   1 or 2, see Tensors::version
+//   uint64   tensor count   n
+//   uint64   index[n][2]    byte offset and float count of every tensor
+//
+// followed by the tensors, each starting at a multiple of ALIGNMENT.
+namespace {
+    constexpr char BINARY_MAGIC[8] = {'L', 'Z', 'W', 'E', 'I', 'G', 'H', 'T'};
+    constexpr auto BINARY_VERSION = std::uint32_t{1};
+    constexpr auto ALIGNMENT = std::uint64_t{64};
+    constexpr auto HEADER_SIZE = sizeof(BINARY_MAGIC)
+                                 + 2 * sizeof(std::uint32_t)
+                                 + sizeof(std::uint64_t);
+
+    std::uint64_t align(const std::uint64_t offset) {
+        return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    // Read-only view of a whole file.  Memory mapped where we can,
+    // otherwise read into memory.
+    class FileView {
+    public:
+        explicit FileView(const std::string& filename);
+        ~FileView();
+        FileView(const FileView&) = delete;
+        FileView& operator=(const FileView&) = delete;
+
+        bool ok() const { return m_data != nullptr; }
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        const char* m_data{nullptr};
+        size_t m_size{0};
+#ifndef WEIGHTS_MMAP
+        std::vector<char> m_buffer;
+#endif
+    };
+
+#ifdef WEIGHTS_MMAP
+    FileView::FileView(const std::string& filename) {
+        const auto fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            const auto addr = mmap(nullptr, st.st_size, PROT_READ,
+                                   MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                // Every byte gets copied out once, front to back.
+                madvise(addr, st.st_size, MADV_SEQUENTIAL);
+                m_data = static_cast<const char*>(addr);
+                m_size = st.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    FileView::~FileView() {
+        if (m_data) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+#else
+    FileView::FileView(const std::string& filename) {
+        auto in = std::ifstream{filename, std::ios::binary | std::ios::ate};
+        if (!in) {
+            return;
+        }
+        m_buffer.resize(size_t(in.tellg()));
+        in.seekg(0);
+        if (!m_buffer.empty() && in.read(m_buffer.data(), m_buffer.size())) {
+            m_data = m_buffer.data();
+            m_size = m_buffer.size();
+        }
+    }
+
+    FileView::~FileView() = default;
+#endif
+
+    template <typename T>
+    T read_field(const char* const data, size_t& pos) {
+        auto value = T{};
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    template <typename T>
+    void write_field(std::ostream& out, const T value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    bool valid_version(const int version) {
+        return version == 1 || version == 2;
+    }
+
+    bool read_binary(const std::string& filename,
+                     WeightsFile::Tensors& weights,
+                     WeightsFile::ReadTimes& times) {
+        const Time start;
+        const FileView file{filename};
+        const Time mapped;
+        times.read = Time::timediff_seconds(start, mapped);
+        if (!file.ok() || file.size() < HEADER_SIZE
+            || std::memcmp(file.data(), BINARY_MAGIC,
+                           sizeof(BINARY_MAGIC)) != 0) {
+            myprintf("Could not read binary weights file: %s\n",
+                     filename.c_str());
+            return false;
+        }
+        auto pos = sizeof(BINARY_MAGIC);
+        const auto format = read_field<std::uint32_t>(file.data(), pos);
+        const auto version = read_field<std::uint32_t>(file.data(), pos);
+        const auto count = read_field<std::uint64_t>(file.data(), pos);
+        if (format != BINARY_VERSION || !valid_version(version)) {
+            myprintf("Binary weights file is the wrong version.\n");
+            return false;
+        }
+        if (count > (file.size() - pos) / (2 * sizeof(std::uint64_t))) {
+            myprintf("Binary weights file is truncated.\n");
+            return false;
+        }
+        weights.version = version;
+        weights.tensors.clear();
+        weights.tensors.reserve(count);
+        for (auto i = std::uint64_t{0}; i < count; i++) {
+            const auto offset = read_field<std::uint64_t>(file.data(), pos);
+            const auto size = read_field<std::uint64_t>(file.data(), pos);
+            if (offset % ALIGNMENT != 0 || offset > file.size()
+                || size > (file.size() - offset) / sizeof(float)) {
+                myprintf("Binary weights file is truncated.\n");
+                return false;
+            }
+            const auto data =
+                reinterpret_cast<const float*>(file.data() + offset);
+            weights.tensors.emplace_back(data, data + size);
+        }
+        times.parse = Time::timediff_seconds(mapped, Time{});
+        return true;
+    }
+
+    bool read_text(const std::string& filename,
+                   WeightsFile::Tensors& weights,
+                   const size_t threads,
+                   WeightsFile::ReadTimes& times) {
+        const Time start;
+        // gzopen supports both gz and non-gz files, will decompress
+        // or just read directly as needed.
+        auto gzhandle = gzopen(filename.c_str(), "rb");
+        if (gzhandle == nullptr) {
+            myprintf("Could not open weights file: %s\n", filename.c_str());
+            return false;
+        }
+        // Read the gz file in to a memory buffer.
+        auto buffer = std::string{};
+        constexpr auto chunkBufferSize = 64 * 1024;
+        std::vector<char> chunkBuffer(chunkBufferSize);
+        while (true) {
+            auto bytesRead = gzread(gzhandle, chunkBuffer.data(), chunkBufferSize);
+            if (bytesRead == 0) break;
+            if (bytesRead < 0) {
+                myprintf("Failed to decompress or read: %s\n", filename.c_str());
+                gzclose(gzhandle);
+                return false;
+            }
+            assert(bytesRead <= chunkBufferSize);
+            buffer.append(chunkBuffer.data(), bytesRead);
+        }
+        gzclose(gzhandle);
+        const Time decompressed;
+        times.read = Time::timediff_seconds(start, decompressed);
+
+        // [begin, end) of every line, without the newline.
+        auto lines = std::vector<std::pair<const char*, const char*>>{};
+        for (auto pos = buffer.data(), end = pos + buffer.size(); pos < end; ) {
+            auto eol = static_cast<const char*>(
+                std::memchr(pos, '\n', end - pos));
+            if (eol == nullptr) {
+                eol = end;
+            }
+            lines.emplace_back(pos, eol);
+            pos = eol + 1;
+        }
+        if (lines.empty()) {
+            return false;
+        }
+
+        // Read format version
+        auto format_version = -1;
+        auto iss = std::stringstream{std::string{lines[0].first,
+                                                 lines[0].second}};
+        // First line is the file format version id
+        iss >> format_version;
+        if (iss.fail() || !valid_version(format_version)) {
+            myprintf("Weights file is the wrong version.\n");
+            return false;
+        }
+        weights.version = format_version;
+
+        // Lines are handed out one at a time, so a thread that got a
+        // large convolution doesn't hold up the rest, and every tensor
+        // lands at the index of its line.
+        const auto count = lines.size() - 1;
+        weights.tensors.assign(count, {});
+        auto failed = std::vector<char>(count, false);
+        std::atomic<size_t> next{0};
+        auto parse = [&](size_t, size_t, size_t) {
+            for (auto i = next++; i < count; i = next++) {
+                auto it_line = lines[i + 1].first;
+                const auto end = lines[i + 1].second;
+                const auto ok = phrase_parse(it_line, end, *x3::float_,
+                                             x3::space, weights.tensors[i]);
+                failed[i] = !ok || it_line != end;
+            }
+        };
+        Utils::WorkerTeam team{std::max(threads, size_t{1})};
+        team.parallel_for(team.size(), 1, parse);
+        times.parse = Time::timediff_seconds(decompressed, Time{});
+
+        const auto error = std::find(begin(failed), end(failed), true);
+        if (error != end(failed)) {
+            myprintf("Failed to parse weight file. Error on line %d.\n",
+                     int(error - begin(failed)) + 2); //+1 from version line, +1 from 0-indexing
+            return false;
+        }
+        return true;
+    }
+}
+
+bool WeightsFile::is_binary(const std::string& filename) {
+    auto in = std::ifstream{filename, std::ios::binary};
+    char magic[sizeof(BINARY_MAGIC)];
+    return in.read(magic, sizeof(magic))
+           && std::memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0;
+}
+
+std::string WeightsFile::fingerprint(const std::string& filename) {
+    namespace fs = boost::filesystem;
+    auto ec = boost::system::error_code{};
+    const auto size = std::uint64_t{fs::file_size(filename, ec)};
+    if (ec) {
+        return {};
+    }
+    const auto mtime = fs::last_write_time(filename, ec);
+    if (ec) {
+        return {};
+    }
+    auto in = std::ifstream{filename, std::ios::binary};
+    if (!in) {
+        return {};
+    }
+    // Size and modification time catch any rewrite of the file, so only
+    // hash its ends to tell apart networks copied over with their times
+    // preserved, rather than reading hundreds of megabytes on every start.
+    constexpr auto SAMPLE = std::uint64_t{1024 * 1024};
+    auto crc = crc32(0L, Z_NULL, 0);
+    auto chunk = std::vector<char>(SAMPLE);
+    const auto hash_at = [&](const std::uint64_t offset,
+                             const std::uint64_t bytes) {
+        in.seekg(offset);
+        in.read(chunk.data(), bytes);
+        crc = crc32(crc, reinterpret_cast<const Bytef*>(chunk.data()),
+                    static_cast<uInt>(in.gcount()));
+        return in.gcount() == std::streamsize(bytes);
+    };
+    const auto ok = size <= 2 * SAMPLE
+        ? hash_at(0, size)
+        : hash_at(0, SAMPLE) && hash_at(size - SAMPLE, SAMPLE);
+    if (!ok) {
+        return {};
+    }
+    return boost::str(boost::format("%08x-%x-%x")
+                      % crc % size % std::int64_t{mtime});
+}
+
+bool WeightsFile::read(const std::string& filename, Tensors& weights,
+                       const size_t threads, ReadTimes* const times) {
+    auto unused = ReadTimes{};
+    auto& stage_times = times ? *times : unused;
+    if (is_binary(filename)) {
+        return read_binary(filename, weights, stage_times);
+    }
+    return read_text(filename, weights, threads, stage_times);
+}
+
+bool WeightsFile::write_binary(const std::string& filename,
+                               const Tensors& weights) {
+    assert(valid_version(weights.version));
+    auto out = std::ofstream{filename, std::ios::binary};
+    if (!out) {
+        return false;
+    }
+    const auto count = std::uint64_t(weights.tensors.size());
+    out.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    write_field(out, BINARY_VERSION);
+    write_field(out, std::uint32_t(weights.version));
+    write_field(out, count);
+
+    auto offset = align(HEADER_SIZE + count * 2 * sizeof(std::uint64_t));
+    auto offsets = std::vector<std::uint64_t>{};
+    for (const auto& tensor : weights.tensors) {
+        offsets.emplace_back(offset);
+        write_field(out, offset);
+        write_field(out, std::uint64_t(tensor.size()));
+        offset = align(offset + tensor.size() * sizeof(float));
+    }
+
+    const char padding[ALIGNMENT] = {};
+    for (auto i = size_t{0}; i < weights.tensors.size(); i++) {
+        const auto& tensor = weights.tensors[i];
+        out.write(padding, offsets[i] - std::uint64_t(out.tellp()));
+        out.write(reinterpret_cast<const char*>(tensor.data()),
+                  tensor.size() * sizeof(float));
+    }
+    return bool(out);
+}
@@ -0,0 +1,75 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef WEIGHTSFILE_H_INCLUDED
+#define WEIGHTSFILE_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Reading and writing network weights files.  Besides the (optionally
+// gzipped) v1/v2 text formats there is a binary format that stores the
+// same tensors as raw floats at 64 byte aligned offsets, so loading a
+// network is a memory map and a copy per tensor instead of parsing
+// hundreds of megabytes of decimal text.
+namespace WeightsFile {
+    struct Tensors {
+        // Version of the text format: 1, or 2 for networks whose value
+        // head returns the value for black instead of the side to move.
+        int version{0};
+        // One tensor per line of the text format, in file order.
+        std::vector<std::vector<float>> tensors;
+    };
+
+    // Wall clock seconds spent in the stages of read().
+    struct ReadTimes {
+        // Reading and decompressing, or mapping, the file
+        double read{0.0};
+        // Parsing, or copying out, the tensors
+        double parse{0.0};
+    };
+
+    // Reads any supported format, detected from the first bytes of the
+    // file.  Text files are parsed on up to threads threads.  Prints
+    // the reason and returns false on errors.
+    bool read(const std::string& filename, Tensors& weights,
+              const size_t threads = 1, ReadTimes* const times = nullptr);
+
+    bool is_binary(const std::string& filename);
+    // Size, modification time and a checksum of the ends of the file,
+    // for keying caches of data derived from it.  Empty if the file
+    // can't be read.
+    std::string fingerprint(const std::string& filename);
+    bool write_binary(const std::string& filename, const Tensors& weights);
+}
+
+#endif
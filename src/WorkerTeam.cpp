@@ -0,0 +1,120 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "WorkerTeam.h"
+
+using namespace Utils;
+
+// How long a spinning worker polls m_generation before it blocks on the
+// condition variable.  Long enough to cover the gap between the layers
+// of a forward pass, short enough not to matter between evals.
+static constexpr auto SPIN_TIME = std::chrono::microseconds{50};
+
+WorkerTeam::WorkerTeam(const size_t threads, const bool spin)
+    : m_spin(spin) {
+    for (auto slot = size_t{1}; slot < threads; slot++) {
+        m_threads.emplace_back([this, slot] { worker(slot); });
+    }
+}
+
+WorkerTeam::~WorkerTeam() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_exit = true;
+        m_generation++;
+    }
+    m_condvar.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void WorkerTeam::run_slot(const size_t slot) {
+    const auto begin = std::min(m_count, slot * m_chunk);
+    const auto end = std::min(m_count, begin + m_chunk);
+    if (begin < end) {
+        m_job(m_context, begin, end, slot);
+    }
+}
+
+void WorkerTeam::run(const size_t count, const size_t grain,
+                     const Job job, void* const context) {
+    const auto grains = (count + grain - 1) / grain;
+    std::unique_lock<std::mutex> busy(m_busy, std::try_to_lock);
+    if (m_threads.empty() || grains < 2 || !busy.owns_lock()) {
+        job(context, 0, count, 0);
+        return;
+    }
+
+    m_job = job;
+    m_context = context;
+    m_count = count;
+    m_chunk = grain * ((grains + size() - 1) / size());
+    m_pending = m_threads.size();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_generation++;
+    }
+    m_condvar.notify_all();
+
+    run_slot(0);
+    while (m_pending.load(std::memory_order_acquire) > 0) {
+        std::this_thread::yield();
+    }
+}
+
+void WorkerTeam::worker(const size_t slot) {
+    auto seen = size_t{0};
+    for (;;) {
+        if (m_spin) {
+            const auto deadline = std::chrono::steady_clock::now() + SPIN_TIME;
+            while (m_generation.load(std::memory_order_acquire) == seen
+                   && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::yield();
+            }
+        }
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condvar.wait(lock, [this, seen] {
+                return m_generation.load() != seen;
+            });
+            if (m_exit) {
+                return;
+            }
+            seen = m_generation.load();
+        }
+        run_slot(slot);
+        m_pending.fetch_sub(1, std::memory_order_release);
+    }
+}
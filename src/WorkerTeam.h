@@ -0,0 +1,111 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef WORKERTEAM_H_INCLUDED
+#define WORKERTEAM_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Utils {
+
+// A fixed team of threads that splits loops of one computation between
+// them, for intra-op parallelism.  Unlike ThreadPool there is no task
+// queue and nothing is allocated per call: the caller publishes a
+// function pointer, bumps a generation counter and works on the first
+// chunk itself while the workers pick up the others.
+class WorkerTeam {
+public:
+    // A team of threads in total, counting the calling thread.  With
+    // spin, idle workers poll for the next loop for a few microseconds
+    // before going to sleep.  That only pays off when every thread of
+    // the team has a core to itself, otherwise they take time from the
+    // threads that have work.
+    explicit WorkerTeam(size_t threads, bool spin = true);
+    ~WorkerTeam();
+
+    WorkerTeam(const WorkerTeam&) = delete;
+    WorkerTeam& operator=(const WorkerTeam&) = delete;
+
+    size_t size() const {
+        return m_threads.size() + 1;
+    }
+
+    // Calls f(begin, end, slot) on disjoint ranges covering [0, count)
+    // and returns when all of them are done.  Range sizes are multiples
+    // of grain, except for the last.  slot < size() identifies the
+    // thread, so f can index per-thread scratch space with it.  If the
+    // team is already busy with another caller's loop, the whole range
+    // runs on the calling thread as slot 0.
+    template <typename F>
+    void parallel_for(size_t count, size_t grain, F& f) {
+        run(count, grain,
+            [](void* context, size_t begin, size_t end, size_t slot) {
+                (*static_cast<F*>(context))(begin, end, slot);
+            },
+            &f);
+    }
+
+private:
+    using Job = void (*)(void* context, size_t begin, size_t end,
+                         size_t slot);
+
+    void run(size_t count, size_t grain, Job job, void* context);
+    void run_slot(size_t slot);
+    void worker(size_t slot);
+
+    std::vector<std::thread> m_threads;
+    const bool m_spin;
+
+    // Held by the caller for the duration of a loop
+    std::mutex m_busy;
+
+    // The current loop, written before m_generation is bumped
+    Job m_job{nullptr};
+    void* m_context{nullptr};
+    size_t m_count{0};
+    size_t m_chunk{0};
+
+    std::atomic<size_t> m_generation{0};
+    std::atomic<size_t> m_pending{0};
+
+    std::mutex m_mutex;
+    std::condition_variable m_condvar;
+    bool m_exit{false};
+};
+
+}
+
+#endif
@@ -0,0 +1,189 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <vector>
+
+#include "AlignedAllocator.h"
+#include "CPUPipe.h"
+#include "GTP.h"
+#include "Network.h"
+#include "WorkerTeam.h"
+
+using ForwardPipeWeights = ForwardPipe::ForwardPipeWeights;
+
+static std::vector<float> random_vector(const size_t size,
+                                        std::mt19937& rng) {
+    auto dist = std::uniform_real_distribution<float>{-0.1f, 0.1f};
+    auto data = std::vector<float>(size);
+    for (auto& x : data) {
+        x = dist(rng);
+    }
+    return data;
+}
+
+// A small network with random, already transformed weights.
+static std::shared_ptr<ForwardPipeWeights> random_weights(const int channels,
+                                                          const int blocks) {
+    auto rng = std::mt19937{1234};
+    auto weights = std::make_shared<ForwardPipeWeights>();
+    for (auto i = 0; i < 1 + 2 * blocks; i++) {
+        const auto inputs = i == 0 ? Network::INPUT_CHANNELS : channels;
+        weights->m_conv_weights.emplace_back(
+            random_vector(WINOGRAD_TILE * inputs * channels, rng));
+        weights->m_conv_biases.emplace_back(channels, 0.0f);
+        weights->m_batchnorm_means.emplace_back(channels, 0.0f);
+        weights->m_batchnorm_stddevs.emplace_back(channels, 1.0f);
+    }
+    weights->m_conv_pol_w = random_vector(Network::OUTPUTS_POLICY * channels, rng);
+    weights->m_conv_pol_b.resize(Network::OUTPUTS_POLICY);
+    weights->m_conv_val_w = random_vector(Network::OUTPUTS_VALUE * channels, rng);
+    weights->m_conv_val_b.resize(Network::OUTPUTS_VALUE);
+    return weights;
+}
+
+static std::atomic<size_t> s_heap_allocations{0};
+
+#ifdef __GLIBC__
+// operator new, Eigen temporaries and AlignedAllocator all end up in
+// malloc.
+extern "C" void* __libc_malloc(std::size_t size);
+
+extern "C" void* malloc(std::size_t size) {
+    s_heap_allocations++;
+    return __libc_malloc(size);
+}
+#else
+void* operator new(std::size_t size) {
+    s_heap_allocations++;
+    if (const auto p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+#endif
+
+TEST(CPUPipeTest, NoAllocationsOnceWarm) {
+    constexpr auto channels = 32;
+    auto pipe = CPUPipe{};
+    pipe.initialize(channels);
+    pipe.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, channels,
+                      random_weights(channels, 2));
+
+    for (const auto batch_size : {1, 3}) {
+        const auto input =
+            std::vector<float>(batch_size * Network::INPUT_CHANNELS
+                               * NUM_INTERSECTIONS, 1.0f);
+        auto output_pol = std::vector<float>(
+            batch_size * Network::OUTPUTS_POLICY * NUM_INTERSECTIONS);
+        auto output_val = std::vector<float>(
+            batch_size * Network::OUTPUTS_VALUE * NUM_INTERSECTIONS);
+
+        // The first eval of a larger batch grows the workspace once
+        pipe.forward_batch(input, output_pol, output_val, batch_size);
+        const auto allocations = CPUPipe::workspace_allocations();
+        const auto heap_allocations = s_heap_allocations.load();
+        for (auto i = 0; i < 5; i++) {
+            pipe.forward_batch(input, output_pol, output_val, batch_size);
+        }
+        EXPECT_EQ(allocations, CPUPipe::workspace_allocations());
+        EXPECT_EQ(heap_allocations, s_heap_allocations.load());
+    }
+}
+
+TEST(CPUPipeTest, EvalThreadsMatchSerial) {
+    constexpr auto channels = 48;
+    constexpr auto batch_size = 2;
+    const auto weights = random_weights(channels, 2);
+    auto rng = std::mt19937{5678};
+    const auto input = random_vector(
+        batch_size * Network::INPUT_CHANNELS * NUM_INTERSECTIONS, rng);
+
+    std::vector<float> output_pol[2];
+    std::vector<float> output_val[2];
+    const auto eval_threads = cfg_eval_threads;
+    for (auto i = 0; i < 2; i++) {
+        cfg_eval_threads = i == 0 ? 1 : 3;
+        auto pipe = CPUPipe{};
+        pipe.initialize(channels);
+        pipe.push_weights(WINOGRAD_ALPHA, Network::INPUT_CHANNELS, channels,
+                          weights);
+        output_pol[i].resize(
+            batch_size * Network::OUTPUTS_POLICY * NUM_INTERSECTIONS);
+        output_val[i].resize(
+            batch_size * Network::OUTPUTS_VALUE * NUM_INTERSECTIONS);
+        pipe.forward_batch(input, output_pol[i], output_val[i], batch_size);
+    }
+    cfg_eval_threads = eval_threads;
+
+    // Splitting only changes which thread computes what, not the order
+    // of any sum.
+    EXPECT_EQ(output_pol[0], output_pol[1]);
+    EXPECT_EQ(output_val[0], output_val[1]);
+}
+
+TEST(CPUPipeTest, WorkerTeamCoversRange) {
+    Utils::WorkerTeam team{4};
+    for (const auto count : {1, 5, 36, 100}) {
+        auto hits = std::vector<int>(count, 0);
+        std::atomic<int> misaligned{0};
+        auto f = [&](size_t begin, size_t end, size_t slot) {
+            if (begin % 4 != 0 || slot >= team.size()) {
+                misaligned++;
+            }
+            for (auto i = begin; i < end; i++) {
+                hits[i]++;
+            }
+        };
+        team.parallel_for(count, 4, f);
+        EXPECT_EQ(std::vector<int>(count, 1), hits);
+        EXPECT_EQ(0, misaligned.load());
+    }
+}
+
+TEST(CPUPipeTest, AlignedVector) {
+    for (const auto size : {1, 3, 1000}) {
+        const auto buffer = AlignedVector<float>(size);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(buffer.data())
+                  % CACHE_LINE_SIZE, 0u);
+    }
+}
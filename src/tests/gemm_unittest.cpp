@@ -0,0 +1,161 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "CPUGemm.h"
+#include "Network.h"
+
+static std::vector<float> random_vector(const size_t size, const int seed) {
+    auto rng = std::mt19937{static_cast<std::mt19937::result_type>(seed)};
+    auto dist = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+    auto data = std::vector<float>(size);
+    for (auto& x : data) {
+        x = dist(rng);
+    }
+    return data;
+}
+
+using CPUFeatures::Isa;
+
+class GemmTest : public ::testing::TestWithParam<Isa> {};
+
+TEST_P(GemmTest, MatchesReference) {
+    // 18 inputs like the input convolution, 66 outputs leave a partial
+    // panel, and 25 columns a partial vector.
+    constexpr auto C = 18;
+    constexpr auto K = 66;
+    for (const auto batch_size : {1, 3}) {
+        const auto Pb = WINOGRAD_P * batch_size;
+        const auto U = random_vector(WINOGRAD_TILE * C * K, 1);
+        const auto V = random_vector(WINOGRAD_TILE * C * Pb, 2);
+        const auto weights = CPUGemm::pack(GetParam(), U, C, K);
+
+        // Guard values after M catch stores past the last row.
+        auto M = std::vector<float>(WINOGRAD_TILE * K * Pb + 16, 42.0f);
+        CPUGemm::sgemm(weights, V.data(), M.data(), batch_size,
+                       0, WINOGRAD_TILE);
+
+        for (auto t = 0; t < WINOGRAD_TILE; t++) {
+            for (auto k = 0; k < K; k++) {
+                for (auto p = 0; p < Pb; p++) {
+                    auto ref = 0.0f;
+                    for (auto c = 0; c < C; c++) {
+                        ref += U[(t * C + c) * K + k] * V[(t * C + c) * Pb + p];
+                    }
+                    ASSERT_NEAR(ref, M[(t * K + k) * Pb + p], 1e-4f)
+                        << "at tile " << t << " output " << k
+                        << " column " << p;
+                }
+            }
+        }
+        for (auto i = WINOGRAD_TILE * K * Pb; i < int(M.size()); i++) {
+            ASSERT_EQ(42.0f, M[i]);
+        }
+    }
+}
+
+static std::vector<float> sgemm(const CPUGemm::Weights& weights,
+                                const std::vector<float>& V,
+                                const int batch_size) {
+    auto M = std::vector<float>(WINOGRAD_TILE * weights.outputs
+                                * WINOGRAD_P * batch_size);
+    CPUGemm::sgemm(weights, V.data(), M.data(), batch_size, 0, WINOGRAD_TILE);
+    return M;
+}
+
+TEST_P(GemmTest, SpecializedMatchesGeneric) {
+    constexpr auto C = 192;
+    ASSERT_TRUE(CPUGemm::is_specialized(C));
+    constexpr auto batch_size = 2;
+    const auto U = random_vector(WINOGRAD_TILE * C * C, 3);
+    const auto V = random_vector(WINOGRAD_TILE * C * WINOGRAD_P * batch_size, 4);
+    // Same operations in the same order
+    EXPECT_EQ(sgemm(CPUGemm::pack(GetParam(), U, C, C, false), V, batch_size),
+              sgemm(CPUGemm::pack(GetParam(), U, C, C, true), V, batch_size));
+}
+
+TEST_P(GemmTest, WrapMatchesPack) {
+    constexpr auto C = 24;
+    constexpr auto K = 20;
+    constexpr auto batch_size = 1;
+    const auto U = random_vector(WINOGRAD_TILE * C * K, 5);
+    const auto V = random_vector(WINOGRAD_TILE * C * WINOGRAD_P * batch_size, 6);
+    // Placed at an offset into a larger buffer, like the layers of a
+    // shared tower.
+    const auto offset = CACHE_LINE_SIZE / sizeof(float);
+    const auto size = CPUGemm::packed_size(GetParam(), C, K);
+    auto buffer = std::make_shared<AlignedVector<float>>(offset + size);
+    CPUGemm::pack_into(GetParam(), U, C, K, buffer->data() + offset);
+    const auto wrapped = CPUGemm::wrap(
+        GetParam(), C, K,
+        std::shared_ptr<const float>(buffer, buffer->data() + offset));
+    EXPECT_EQ(sgemm(CPUGemm::pack(GetParam(), U, C, K), V, batch_size),
+              sgemm(wrapped, V, batch_size));
+}
+
+// Run with --gtest_also_run_disabled_tests to compare the kernels
+// compiled for the common tower widths against the generic ones.  Widths
+// without their own kernel run the generic one twice.
+TEST_P(GemmTest, DISABLED_BenchmarkShapes) {
+    using Clock = std::chrono::steady_clock;
+    constexpr auto batch_size = 1;
+    for (const auto C : {128, 192, 256}) {
+        const auto U = random_vector(WINOGRAD_TILE * C * C, 5);
+        const auto V = random_vector(WINOGRAD_TILE * C * WINOGRAD_P * batch_size, 6);
+        auto M = std::vector<float>(WINOGRAD_TILE * C * WINOGRAD_P * batch_size);
+        double seconds[2];
+        for (const auto specialize : {false, true}) {
+            const auto weights = CPUGemm::pack(GetParam(), U, C, C, specialize);
+            const auto rounds = 20 * 256 * 256 / (C * C);
+            const auto start = Clock::now();
+            for (auto i = 0; i < rounds; i++) {
+                CPUGemm::sgemm(weights, V.data(), M.data(), batch_size,
+                               0, WINOGRAD_TILE);
+            }
+            const auto elapsed =
+                std::chrono::duration<double>(Clock::now() - start);
+            seconds[specialize] = elapsed.count() / rounds;
+        }
+        std::cout << CPUFeatures::isa_name(GetParam()) << " " << C
+                  << " channels: generic " << seconds[0] * 1e6
+                  << " us, specialized " << seconds[1] * 1e6
+                  << " us per convolution" << std::endl;
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Isas, GemmTest,
+                        ::testing::ValuesIn(CPUFeatures::supported_isas()));
@@ -37,13 +37,20 @@
 #include <regex>
 #include <string>
 #include <vector>
+#include <boost/filesystem.hpp>
 
 #include "GTP.h"
 #include "GameState.h"
 #include "NNCache.h"
+#include "Network.h"
 #include "Random.h"
+#include "SearchState.h"
 #include "ThreadPool.h"
+#include "UCTNode.h"
+#include "UCTNodeArena.h"
+#include "UCTSearch.h"
 #include "Utils.h"
+#include "WeightsFile.h"
 #include "Zobrist.h"
 
 using namespace Utils;
@@ -116,6 +123,7 @@ public:
     }
     void test_analyze_cmd(std::string cmd, bool valid, int who, int interval,
             int avoidlen, int avoidcolor, int avoiduntil);
+    void test_shared_transposition();
 
 private:
     std::unique_ptr<GameState> m_gamestate;
@@ -196,6 +204,438 @@ TEST_F(LeelaTest, KoPntNotSame) {
     EXPECT_NE(hash, maingame.board.get_hash());
 }
 
+TEST_F(LeelaTest, SymmetricCacheHit) {
+    // E6 F6 E5 F5 D4 E4 E3 G4 F4, capturing E4, F3 D3.
+    const auto moves = std::vector<std::pair<int, int>>{
+        {4, 5}, {5, 5}, {4, 4}, {5, 4}, {3, 3}, {4, 3},
+        {4, 2}, {6, 3}, {5, 3}, {5, 2}, {3, 2}};
+    constexpr auto symmetry = 5;
+    auto game = get_gamestate();
+    auto mirrored = get_gamestate();
+    auto color = int{FastBoard::BLACK};
+    for (const auto& move : moves) {
+        const auto sym = Network::get_symmetry(move, symmetry);
+        game.play_move(color, game.board.get_vertex(move.first, move.second));
+        mirrored.play_move(color, mirrored.board.get_vertex(sym.first,
+                                                            sym.second));
+        color = !color;
+    }
+
+    // The incremental hashes match hashing the whole board, through a
+    // capture and a ko that got resolved.
+    for (auto s = 0; s < FullBoard::NUM_SYMMETRIES; s++) {
+        EXPECT_EQ(game.board.get_symmetry_hash(s),
+                  game.board.calc_symmetry_hash(FastBoard::NO_VERTEX, s));
+    }
+    auto canonical = 0;
+    auto mirrored_canonical = 0;
+    EXPECT_NE(game.board.get_hash(), mirrored.board.get_hash());
+    EXPECT_EQ(game.board.get_canonical_hash(canonical),
+              mirrored.board.get_canonical_hash(mirrored_canonical));
+
+    // The mirrored position finds the cached result of the original,
+    // with the policy mirrored too.
+    const auto result = GTP::s_network->get_output(
+        &game, Network::Ensemble::DIRECT, 0, false, true);
+    const auto cached = GTP::s_network->get_output(
+        &mirrored, Network::Ensemble::DIRECT, 0, true, false);
+    EXPECT_EQ(result.winrate, cached.winrate);
+    EXPECT_EQ(result.policy_pass, cached.policy_pass);
+    for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
+        const auto sym = Network::get_symmetry(
+            {idx % BOARD_SIZE, idx / BOARD_SIZE}, symmetry);
+        EXPECT_EQ(result.policy[idx],
+                  cached.policy[sym.second * BOARD_SIZE + sym.first]);
+    }
+}
+
+TEST_F(LeelaTest, WeightsCacheRoundTrip) {
+    const auto weightsfile = std::string{"../src/tests/0k.txt"};
+    const auto fingerprint = WeightsFile::fingerprint(weightsfile);
+    ASSERT_FALSE(fingerprint.empty());
+    const auto cache_file = Network::weights_cache_file(fingerprint);
+    boost::filesystem::remove(cache_file);
+
+    cfg_weights_cache = true;
+    auto writer = std::make_unique<Network>();
+    writer->initialize(1, weightsfile);
+    ASSERT_TRUE(boost::filesystem::exists(cache_file));
+
+    testing::internal::CaptureStderr();
+    auto reader = std::make_unique<Network>();
+    reader->initialize(1, weightsfile);
+    const auto output = testing::internal::GetCapturedStderr();
+    boost::filesystem::remove(cache_file);
+    expect_regex(output, "Using transformed weights from");
+
+    // The cached transform gives the same outputs as the original one.
+    auto& game = get_gamestate();
+    game.play_textmove("b", "q16");
+    game.play_textmove("w", "d4");
+    const auto original = writer->get_output(
+        &game, Network::Ensemble::DIRECT, 0, false, false);
+    const auto cached = reader->get_output(
+        &game, Network::Ensemble::DIRECT, 0, false, false);
+    EXPECT_EQ(original.winrate, cached.winrate);
+    EXPECT_EQ(original.policy_pass, cached.policy_pass);
+    EXPECT_EQ(original.policy, cached.policy);
+}
+
+TEST_F(LeelaTest, FeaturePlanes) {
+    auto maingame = get_gamestate();
+
+    testing::internal::CaptureStdout();
+    GTP::execute(maingame, "play b E6");
+    GTP::execute(maingame, "play w F6");
+    GTP::execute(maingame, "play b E5");
+    GTP::execute(maingame, "play w F5");
+    GTP::execute(maingame, "play b D4");
+    GTP::execute(maingame, "play w E4");
+    GTP::execute(maingame, "play b E3");
+    GTP::execute(maingame, "play w G4");
+    GTP::execute(maingame, "play b F4"); // capture
+    GTP::execute(maingame, "play w F3");
+    GTP::execute(maingame, "play b D3");
+    GTP::execute(maingame, "play w pass");
+    testing::internal::GetCapturedStdout();
+
+    // The input planes unpacked from the bit planes of the boards
+    // must match the board contents.
+    const auto moves = Network::INPUT_MOVES;
+    for (auto s = 0; s < Network::NUM_SYMMETRIES; s++) {
+        const auto planes = Network::gather_features(&maingame, s);
+        for (auto h = 0; h < moves; h++) {
+            const auto& board = maingame.get_past_board(h);
+            for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
+                const auto xy = Network::get_symmetry(
+                    {idx % BOARD_SIZE, idx / BOARD_SIZE}, s);
+                const auto color = board.get_state(xy.first, xy.second);
+                // Black is to move, so its stones come first
+                EXPECT_EQ(planes[h * NUM_INTERSECTIONS + idx],
+                          float(color == FastBoard::BLACK));
+                EXPECT_EQ(planes[(moves + h) * NUM_INTERSECTIONS + idx],
+                          float(color == FastBoard::WHITE));
+            }
+        }
+    }
+}
+
+TEST_F(LeelaTest, AverageMatchesSymmetries) {
+    auto maingame = get_gamestate();
+
+    testing::internal::CaptureStdout();
+    GTP::execute(maingame, "play b Q16");
+    GTP::execute(maingame, "play w D4");
+    GTP::execute(maingame, "play b C16");
+    testing::internal::GetCapturedStdout();
+
+    // The batched average must match evaluating every symmetry alone.
+    auto expected = Network::Netresult{};
+    for (auto s = 0; s < Network::NUM_SYMMETRIES; s++) {
+        const auto result = GTP::s_network->get_output(
+            &maingame, Network::Ensemble::DIRECT, s, false, false);
+        expected.winrate += result.winrate / Network::NUM_SYMMETRIES;
+        expected.policy_pass += result.policy_pass / Network::NUM_SYMMETRIES;
+        for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
+            expected.policy[idx] += result.policy[idx] / Network::NUM_SYMMETRIES;
+        }
+    }
+    const auto average = GTP::s_network->get_output(
+        &maingame, Network::Ensemble::AVERAGE, -1, false, false);
+    EXPECT_NEAR(expected.winrate, average.winrate, 1e-5f);
+    EXPECT_NEAR(expected.policy_pass, average.policy_pass, 1e-5f);
+    for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
+        EXPECT_NEAR(expected.policy[idx], average.policy[idx], 1e-5f);
+    }
+}
+
+TEST_F(LeelaTest, SearchStateMatchesGameState) {
+    auto maingame = get_gamestate();
+
+    testing::internal::CaptureStdout();
+    GTP::execute(maingame, "play b D5");
+    GTP::execute(maingame, "play w F4");
+    GTP::execute(maingame, "play b E4");
+    GTP::execute(maingame, "play w F6");
+    GTP::execute(maingame, "play b E6");
+    GTP::execute(maingame, "play w G5");
+    GTP::execute(maingame, "play b A1");
+    GTP::execute(maingame, "play w E5");
+    testing::internal::GetCapturedStdout();
+
+    // A playout from maingame must see the same inputs and superkos
+    // as a full copy, also once the moves below the root exceed the
+    // input history.  The first recapture repeats the root position,
+    // the second one a position below the root.
+    auto search_state = SearchState{maingame};
+    auto game_state = maingame;
+    const auto moves = {"F5", "E5", "F5", "Q16", "D16", "Q4", "pass",
+                        "C3", "pass", "R10", "K10"};
+    auto superkos = 0;
+    for (const auto& move : moves) {
+        const auto vertex = game_state.board.text_to_move(move);
+        search_state.play_move(vertex);
+        game_state.play_move(vertex);
+        EXPECT_EQ(search_state.superko(), game_state.superko()) << move;
+        if (vertex != FastBoard::PASS) {
+            superkos += search_state.superko();
+        }
+        for (auto s = 0; s < Network::NUM_SYMMETRIES; s++) {
+            EXPECT_EQ(Network::gather_features(&search_state, s),
+                      Network::gather_features(&game_state, s)) << move;
+        }
+    }
+    EXPECT_EQ(superkos, 2);
+    EXPECT_EQ(search_state.board.get_hash(), game_state.board.get_hash());
+}
+
+TEST_F(LeelaTest, ChildStatsFollowChildren) {
+    auto& maingame = get_gamestate();
+    UCTNodeArena arena;
+    auto root = arena.create<UCTNode>(FastBoard::PASS, 0.0f);
+    std::atomic<int> nodecount{0};
+    auto state = SearchState{maingame};
+    auto eval = 0.0f;
+    ASSERT_TRUE(root->create_children(*GTP::s_network, nodecount,
+                                      state, eval));
+    root->update(eval);
+
+    // Visit children the way play_simulation does, with made up evals.
+    for (auto i = 0; i < 200; i++) {
+        auto index = size_t{0};
+        auto child = root->uct_select_child(FastBoard::BLACK, true, index);
+        ASSERT_EQ(child, root->get_children()[index].get());
+        root->virtual_loss();
+        root->child_stats_virtual_loss(index);
+        child->virtual_loss();
+        const auto child_eval = (i % 7) / 6.0f;
+        child->update(child_eval);
+        root->child_stats_update(index, child_eval);
+        child->virtual_loss_undo();
+        root->child_stats_virtual_loss_undo(index);
+        root->update(child_eval);
+        root->virtual_loss_undo();
+    }
+    // The status is the edge's, the nodes stay as they are.
+    const auto invalid_move = root->get_children()[3].get_move();
+    const auto pruned_move = root->get_children()[5].get_move();
+    root->child_invalidate(3);
+    root->child_set_active(5, false);
+
+    auto check = [=]() {
+        const auto& children = root->get_children();
+        for (auto i = size_t{0}; i < children.size(); i++) {
+            const auto& child = children[i];
+            EXPECT_EQ(children.policy()[i], child.get_policy()) << i;
+            EXPECT_EQ(children.virtual_loss()[i].load(), 0) << i;
+            if (child.is_inflated()) {
+                EXPECT_EQ(children.visits()[i].load(), child->get_visits()) << i;
+                // Kept in float, so with a little rounding.
+                if (child->get_visits() > 0) {
+                    EXPECT_NEAR(children.blackevals()[i]
+                                    / child->get_visits(),
+                                child->get_raw_eval(FastBoard::BLACK), 1e-5)
+                        << i;
+                }
+            } else {
+                EXPECT_EQ(children.visits()[i].load(), 0) << i;
+            }
+        }
+        for (auto i = size_t{0}; i < children.size(); i++) {
+            const auto move = children[i].get_move();
+            EXPECT_EQ(root->child_valid(i), move != invalid_move) << i;
+            EXPECT_EQ(root->child_active(i),
+                      move != invalid_move && move != pruned_move) << i;
+        }
+    };
+    check();
+    root->sort_children(FastBoard::BLACK, 0.0f);
+    check();
+}
+
+TEST_F(LeelaTest, TranspositionKey) {
+    // The same four stones in two orders ending with the same move, then
+    // the same moves.
+    auto state_a = SearchState{get_gamestate()};
+    auto state_b = SearchState{get_gamestate()};
+    for (const auto& move : {"D4", "Q16", "Q4", "D16"}) {
+        state_a.play_move(state_a.board.text_to_move(move));
+    }
+    for (const auto& move : {"Q4", "Q16", "D4", "D16"}) {
+        state_b.play_move(state_b.board.text_to_move(move));
+    }
+    // The same stones reached by another last move.
+    auto state_e = SearchState{get_gamestate()};
+    for (const auto& move : {"Q4", "D16", "D4", "Q16"}) {
+        state_e.play_move(state_e.board.text_to_move(move));
+    }
+    EXPECT_EQ(state_a.board.get_hash(), state_e.board.get_hash());
+    EXPECT_NE(state_a.get_transposition_key(),
+              state_e.get_transposition_key());
+    // Equal from the first common position on, whatever the previous
+    // positions were.
+    for (const auto& move : {"C3", "R17", "C17", "R3"}) {
+        EXPECT_EQ(state_a.get_transposition_key(),
+                  state_b.get_transposition_key()) << move;
+        state_a.play_move(state_a.board.text_to_move(move));
+        state_b.play_move(state_b.board.text_to_move(move));
+    }
+    EXPECT_EQ(state_a.get_transposition_key(),
+              state_b.get_transposition_key());
+    // Different stones reached by the same last move.
+    auto state_c = SearchState{get_gamestate()};
+    auto state_d = SearchState{get_gamestate()};
+    for (const auto& move : {"D4", "Q16", "Q4"}) {
+        state_c.play_move(state_c.board.text_to_move(move));
+    }
+    for (const auto& move : {"D4", "D16", "Q4"}) {
+        state_d.play_move(state_d.board.text_to_move(move));
+    }
+    EXPECT_NE(state_c.get_transposition_key(),
+              state_d.get_transposition_key());
+    // Positions with the same stones differ by the side to move.
+    state_a.play_move(FastBoard::PASS);
+    EXPECT_NE(state_a.get_transposition_key(),
+              state_b.get_transposition_key());
+}
+
+TEST_F(LeelaTest, SharedNodeBackup) {
+    UCTNodeArena arena;
+    auto root = arena.create<UCTNode>(FastBoard::PASS, 0.0f);
+    std::atomic<int> nodecount{0};
+    auto state = SearchState{get_gamestate()};
+    auto net_eval = 0.0f;
+    ASSERT_TRUE(root->create_children(*GTP::s_network, nodecount,
+                                      state, net_eval));
+    root->update(net_eval);
+    const auto& children = root->get_children();
+
+    children[0].inflate();
+    children[0]->update(0.7f);
+    root->update_from_child(0, 0.7f);
+
+    // The position of the second child, already searched through
+    // another parent.
+    auto shared = arena.create<UCTNode>(children[1].get_move(), 0.1f);
+    for (const auto eval : {0.2f, 0.4f, 0.9f}) {
+        shared->update(eval);
+    }
+    children[1].inflate();
+    EXPECT_EQ(root->child_link(1, shared), shared);
+    EXPECT_EQ(root->child_link(1, shared), shared);
+    EXPECT_EQ(children[1].get(), shared);
+
+    // The edge holds the eval of the shared node, whatever came back.
+    root->update_from_child(1, 0.6f);
+    EXPECT_FLOAT_EQ(root->get_raw_eval(FastBoard::BLACK),
+                    (net_eval + 0.7f + 0.5f) / 3.0f);
+    EXPECT_EQ(root->get_visits(), 3);
+    EXPECT_FLOAT_EQ(children.blackevals()[1].load(), 0.5f);
+
+    // Searches through the other parent show up in the next backup.
+    shared->update(1.0f);
+    root->update_from_child(1, 0.625f);
+    EXPECT_FLOAT_EQ(root->get_raw_eval(FastBoard::BLACK),
+                    (net_eval + 0.7f + 2 * 0.625f) / 4.0f);
+    EXPECT_EQ(root->get_visits(), 4);
+
+    // The moves go by the visits of the edges, the shared node also
+    // has those of the other parent.
+    const auto first = children[0].get();
+    for (const auto eval : {0.3f, 0.3f}) {
+        first->update(eval);
+        root->update_from_child(0, eval);
+    }
+    cfg_transpositions = true;
+    root->sort_children(FastBoard::BLACK, 0.0f);
+    EXPECT_EQ(children[0].get(), first);
+    EXPECT_EQ(&root->get_best_root_child(FastBoard::BLACK), first);
+    cfg_transpositions = false;
+    root->sort_children(FastBoard::BLACK, 0.0f);
+    EXPECT_EQ(children[0].get(), shared);
+}
+
+TEST_F(LeelaTest, TranspositionSearch) {
+    cfg_transpositions = true;
+    cfg_max_playouts = 1000;
+    cfg_max_visits = 1000;
+
+    // clear_board to force GTP to make a new UCTSearch, searching a
+    // graph.  The second genmove reuses it.
+    auto result = gtp_execute("clear_board");
+    expect_regex(result.first, "^=\\s*$");
+    result = gtp_execute("genmove b");
+    expect_regex(result.first, "^= [A-T][0-9]+\\s*$");
+    result = gtp_execute("genmove w");
+    expect_regex(result.first, "^= [A-T][0-9]+\\s*$");
+    result = gtp_execute("clear_board");
+    expect_regex(result.first, "^=\\s*$");
+}
+
+void LeelaTest::test_shared_transposition() {
+    auto& maingame = get_gamestate();
+    UCTSearch search{maingame, *GTP::s_network};
+    search.update_root();
+    ASSERT_TRUE(search.m_transpositions);
+
+    // Play the moves with one playout each, which expands the node it
+    // reaches.  The other children are pruned to steer it.
+    auto play = [&](const std::vector<std::string>& moves) {
+        auto state = SearchState{maingame};
+        auto node = search.m_root;
+        {
+            auto playout_state = state;
+            search.play_simulation(playout_state, node);
+        }
+        for (const auto& text : moves) {
+            const auto move = state.board.text_to_move(text);
+            const auto& children = node->get_children();
+            auto index = children.size();
+            for (auto i = size_t{0}; i < children.size(); i++) {
+                if (children[i].get_move() == move) {
+                    index = i;
+                }
+                node->child_set_active(i, children[i].get_move() == move);
+            }
+            EXPECT_LT(index, children.size()) << text;
+            if (index == children.size()) {
+                return node;
+            }
+            auto playout_state = state;
+            search.play_simulation(playout_state, node);
+            node = children[index].get();
+            state.play_move(move);
+        }
+        return node;
+    };
+    // The same four stones in two orders.
+    const auto moves_a = std::vector<std::string>{"D4", "Q16", "Q4", "D16"};
+    const auto moves_b = std::vector<std::string>{"Q4", "Q16", "D4", "D16"};
+    const auto node_a = play(moves_a);
+    const auto node_b = play(moves_b);
+    EXPECT_EQ(node_a, node_b);
+    ASSERT_TRUE(node_a->has_children());
+
+    // The node counts once, and the node of the second order that it
+    // replaced goes back to the arena when the root is updated.
+    const auto tree_size = UCTNodeArena::get_tree_size();
+    const auto nodes = search.m_root->count_nodes_and_clear_expand_state();
+    search.m_last_rootstate = std::make_unique<GameState>(maingame);
+    search.update_root();
+    const auto shared_nodes = node_a->count_nodes_and_clear_expand_state();
+    EXPECT_EQ(size_t(search.m_nodes), nodes - shared_nodes);
+    while (!search.m_delete_futures.empty()) {
+        search.m_delete_futures.front().wait_all();
+        search.m_delete_futures.pop_front();
+    }
+    EXPECT_LT(UCTNodeArena::get_tree_size(), tree_size);
+}
+
+TEST_F(LeelaTest, TranspositionSharesNodes) {
+    cfg_transpositions = true;
+    test_shared_transposition();
+}
+
 TEST_F(LeelaTest, MoveOnOccupiedPnt) {
     auto maingame = get_gamestate();
     std::string output;
@@ -0,0 +1,155 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CPUInt8.h"
+#include "Network.h"
+
+static std::vector<float> random_vector(const size_t size, const int seed) {
+    auto rng = std::mt19937{static_cast<std::mt19937::result_type>(seed)};
+    auto dist = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+    auto data = std::vector<float>(size);
+    for (auto& x : data) {
+        x = dist(rng);
+    }
+    return data;
+}
+
+using CPUFeatures::Isa;
+
+// 66 outputs exercise the leftover rows of the kernels, a batch of 3 the
+// padding of the last column block.
+constexpr auto C = 32;
+constexpr auto K = 66;
+constexpr auto BATCH_SIZE = 3;
+constexpr auto Pb = WINOGRAD_P * BATCH_SIZE;
+
+static std::vector<float> int8_sgemm(const Isa isa,
+                                     const std::vector<float>& U,
+                                     const std::vector<float>& V) {
+    auto table = CPUInt8::Table{2};
+    table.record(1, V.data(), C, BATCH_SIZE);
+    const auto layer = CPUInt8::quantize(U, C, K, table, 1);
+
+    auto Vq = std::vector<std::uint32_t>(CPUInt8::scratch_size(C, BATCH_SIZE));
+    auto M = std::vector<float>(WINOGRAD_TILE * K * Pb);
+    CPUInt8::sgemm(isa, layer, V.data(), Vq.data(), M.data(), BATCH_SIZE,
+                   0, WINOGRAD_TILE);
+    return M;
+}
+
+TEST(Int8Test, SgemmMatchesFloat) {
+    const auto U = random_vector(WINOGRAD_TILE * C * K, 1);
+    const auto V = random_vector(WINOGRAD_TILE * C * Pb, 2);
+    const auto M = int8_sgemm(Isa::SCALAR, U, V);
+
+    for (auto t = 0; t < WINOGRAD_TILE; t++) {
+        for (auto k = 0; k < K; k++) {
+            for (auto p = 0; p < Pb; p++) {
+                auto ref = 0.0f;
+                for (auto c = 0; c < C; c++) {
+                    ref += U[(t * C + c) * K + k] * V[(t * C + c) * Pb + p];
+                }
+                // Weights are rounded to 1/126th, inputs to 1/254th of
+                // their range.
+                ASSERT_NEAR(ref, M[(t * K + k) * Pb + p],
+                            C * (1.0f / 126.0f + 1.0f / 254.0f))
+                    << "at tile " << t << " output " << k << " column " << p;
+            }
+        }
+    }
+}
+
+class Int8KernelTest : public ::testing::TestWithParam<Isa> {};
+
+TEST_P(Int8KernelTest, MatchesScalar) {
+    const auto U = random_vector(WINOGRAD_TILE * C * K, 3);
+    const auto V = random_vector(WINOGRAD_TILE * C * Pb, 4);
+    // All kernels compute the same integer sums.
+    EXPECT_EQ(int8_sgemm(Isa::SCALAR, U, V), int8_sgemm(GetParam(), U, V));
+}
+
+INSTANTIATE_TEST_CASE_P(Isas, Int8KernelTest,
+                        ::testing::ValuesIn(CPUFeatures::supported_isas()));
+
+TEST(Int8Test, TableSaveLoad) {
+    const auto V = random_vector(WINOGRAD_TILE * 4 * WINOGRAD_P, 3);
+    auto table = CPUInt8::Table{3};
+    table.record(2, V.data(), 4, 1);
+
+    const auto filename = std::string{"int8_unittest.int8"};
+    ASSERT_TRUE(table.save(filename));
+    const auto loaded = CPUInt8::Table::load(filename);
+    std::remove(filename.c_str());
+
+    ASSERT_NE(loaded, nullptr);
+    ASSERT_EQ(loaded->layers(), size_t{3});
+    EXPECT_EQ(loaded->channels(0), 0);
+    EXPECT_EQ(loaded->channels(2), 4);
+    for (auto layer = size_t{0}; layer < 3; layer++) {
+        for (auto t = 0; t < WINOGRAD_TILE; t++) {
+            EXPECT_FLOAT_EQ(table.range(layer, t), loaded->range(layer, t));
+        }
+    }
+    EXPECT_GT(loaded->range(2, 0), 0.0f);
+    EXPECT_EQ(CPUInt8::Table::load("does-not-exist.int8"), nullptr);
+}
+
+TEST(Int8Test, TableFitsShapes) {
+    constexpr auto outputs = 8;
+    auto table = CPUInt8::Table{2};
+    const auto V0 = random_vector(WINOGRAD_TILE * 4 * WINOGRAD_P, 5);
+    const auto V1 = random_vector(WINOGRAD_TILE * outputs * WINOGRAD_P, 6);
+    table.record(0, V0.data(), 4, 1);
+    table.record(1, V1.data(), outputs, 1);
+
+    auto weights = std::vector<std::vector<float>>{
+        std::vector<float>(WINOGRAD_TILE * 4 * outputs),
+        std::vector<float>(WINOGRAD_TILE * outputs * outputs)};
+    EXPECT_TRUE(table.fits(weights, outputs));
+    // Other tower width
+    EXPECT_FALSE(table.fits(weights, outputs / 2));
+    // Other input planes
+    weights[0].resize(WINOGRAD_TILE * 5 * outputs);
+    EXPECT_FALSE(table.fits(weights, outputs));
+    // More layers
+    weights[0].resize(WINOGRAD_TILE * 4 * outputs);
+    weights.emplace_back(WINOGRAD_TILE * outputs * outputs);
+    EXPECT_FALSE(table.fits(weights, outputs));
+}
@@ -0,0 +1,289 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "NNCache.h"
+
+static NNCache::Netresult make_result(const std::uint64_t hash) {
+    auto result = NNCache::Netresult{};
+    result.winrate = float(hash % 1000) / 1000.0f;
+    result.policy[hash % NUM_INTERSECTIONS] = 1.0f;
+    return result;
+}
+
+static std::uint64_t test_hash(const int i) {
+    // Spread like Zobrist hashes.
+    return (i + 1) * 0x9E3779B97F4A7C15ULL;
+}
+
+TEST(NNCacheTest, LookupAfterInsert) {
+    NNCache cache{NNCache::MIN_CACHE_COUNT};
+    auto result = NNCache::Netresult{};
+    EXPECT_FALSE(cache.lookup(test_hash(0), result));
+
+    for (auto i = 0; i < 1000; i++) {
+        cache.insert(test_hash(i), make_result(test_hash(i)));
+    }
+    for (auto i = 0; i < 1000; i++) {
+        ASSERT_TRUE(cache.lookup(test_hash(i), result));
+        EXPECT_EQ(result.winrate, make_result(test_hash(i)).winrate);
+        EXPECT_EQ(result.policy[test_hash(i) % NUM_INTERSECTIONS], 1.0f);
+    }
+    EXPECT_EQ(cache.hit_rate().first, 1000);
+    EXPECT_EQ(cache.get_estimated_size(),
+              NNCache::MIN_CACHE_COUNT * NNCache::entry_size(NNCache::Storage::FLOAT));
+}
+
+TEST(NNCacheTest, ReplacesOldestWhenFull) {
+    constexpr auto size = 1000;
+    NNCache cache{size};
+    for (auto i = 0; i < 10 * size; i++) {
+        cache.insert(test_hash(i), make_result(test_hash(i)));
+    }
+    EXPECT_EQ(cache.get_estimated_size(), size * NNCache::entry_size(NNCache::Storage::FLOAT));
+
+    // The newest entries survive far more often than the oldest.
+    auto result = NNCache::Netresult{};
+    auto newest = 0;
+    auto oldest = 0;
+    for (auto i = 0; i < size / 2; i++) {
+        newest += cache.lookup(test_hash(10 * size - 1 - i), result);
+        oldest += cache.lookup(test_hash(i), result);
+    }
+    EXPECT_GT(newest, size / 2 * 9 / 10);
+    EXPECT_EQ(oldest, 0);
+}
+
+TEST(NNCacheTest, ResizeKeepsNewest) {
+    NNCache cache{4000};
+    for (auto i = 0; i < 4000; i++) {
+        cache.insert(test_hash(i), make_result(test_hash(i)));
+    }
+    cache.resize(1000);
+    EXPECT_EQ(cache.get_estimated_size(), 1000 * NNCache::entry_size(NNCache::Storage::FLOAT));
+
+    auto result = NNCache::Netresult{};
+    auto newest = 0;
+    for (auto i = 0; i < 500; i++) {
+        newest += cache.lookup(test_hash(3999 - i), result);
+    }
+    EXPECT_GT(newest, 450);
+    ASSERT_TRUE(cache.lookup(test_hash(3999), result));
+    EXPECT_EQ(result.winrate, make_result(test_hash(3999)).winrate);
+}
+
+TEST(NNCacheTest, CompactStorage) {
+    // A peaked policy like a trained network's.
+    auto netresult = NNCache::Netresult{};
+    auto total = 0.0f;
+    for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
+        netresult.policy[i] = std::exp(-0.05f * i);
+        total += netresult.policy[i];
+    }
+    netresult.policy_pass = 0.01f;
+    total += netresult.policy_pass;
+    for (auto& p : netresult.policy) {
+        p /= total;
+    }
+    netresult.policy_pass /= total;
+    netresult.winrate = 0.123456789f;
+
+    for (const auto storage : {NNCache::Storage::HALF,
+                               NNCache::Storage::TOP_K}) {
+        NNCache cache{1000};
+        cache.set_storage(storage);
+        EXPECT_EQ(cache.get_estimated_size(),
+                  1000 * NNCache::entry_size(storage));
+        EXPECT_LT(NNCache::entry_size(storage),
+                  NNCache::entry_size(NNCache::Storage::FLOAT) / 2 + 64);
+
+        cache.insert(test_hash(0), netresult);
+        auto result = NNCache::Netresult{};
+        ASSERT_TRUE(cache.lookup(test_hash(0), result));
+        EXPECT_EQ(result.winrate, netresult.winrate);
+        auto sum = result.policy_pass;
+        for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
+            sum += result.policy[i];
+        }
+        EXPECT_NEAR(sum, 1.0f, 1e-3f);
+        // The likely moves, and the pass, are close to exact.
+        for (auto i = 0; i < 50; i++) {
+            EXPECT_NEAR(result.policy[i], netresult.policy[i],
+                        netresult.policy[i] * 1e-3f + 2e-5f);
+        }
+        EXPECT_NEAR(result.policy_pass, netresult.policy_pass, 2e-5f);
+    }
+    EXPECT_LT(NNCache::entry_size(NNCache::Storage::TOP_K) * 5,
+              NNCache::entry_size(NNCache::Storage::FLOAT));
+}
+
+TEST(NNCacheTest, SnapshotRoundTrip) {
+    const auto filename = std::string{"nncache_unittest.snapshot"};
+    NNCache cache{1000};
+    for (auto i = 0; i < 500; i++) {
+        cache.insert(test_hash(i), make_result(test_hash(i)));
+    }
+    ASSERT_TRUE(cache.save(filename, "net-a"));
+
+    NNCache loaded{1000};
+    EXPECT_FALSE(loaded.load(filename, "net-b"));
+    ASSERT_TRUE(loaded.load(filename, "net-a"));
+    NNCache mapped{1000};
+    EXPECT_FALSE(mapped.map(filename, "net-b"));
+    ASSERT_TRUE(mapped.map(filename, "net-a"));
+    std::remove(filename.c_str());
+
+    auto result = NNCache::Netresult{};
+    for (auto i = 0; i < 500; i++) {
+        for (auto target : {&loaded, &mapped}) {
+            ASSERT_TRUE(target->lookup(test_hash(i), result));
+            EXPECT_EQ(result.winrate, make_result(test_hash(i)).winrate);
+            EXPECT_EQ(result.policy[test_hash(i) % NUM_INTERSECTIONS], 1.0f);
+        }
+    }
+    EXPECT_FALSE(mapped.lookup(test_hash(500), result));
+    EXPECT_EQ(mapped.hit_rate().first, 500);
+}
+
+TEST(NNCacheTest, SnapshotWithBadCount) {
+    const auto filename = std::string{"nncache_unittest.snapshot"};
+    NNCache cache{1000};
+    for (auto i = 0; i < 500; i++) {
+        cache.insert(test_hash(i), make_result(test_hash(i)));
+    }
+    ASSERT_TRUE(cache.save(filename, "net-a"));
+    auto contents = std::string{};
+    {
+        auto in = std::ifstream{filename, std::ios::binary};
+        contents.assign(std::istreambuf_iterator<char>(in),
+                        std::istreambuf_iterator<char>());
+    }
+    const auto count = std::uint64_t{500};
+    const auto pos = contents.find(
+        std::string(reinterpret_cast<const char*>(&count), sizeof(count)));
+    ASSERT_NE(pos, std::string::npos);
+
+    // Counts whose sizes overflow or don't fit the file are rejected
+    // rather than read past the end.
+    for (const auto bad : {std::uint64_t{501},
+                           (std::uint64_t{1} << 61) + 500,
+                           ~std::uint64_t{0}}) {
+        std::memcpy(&contents[pos], &bad, sizeof(bad));
+        {
+            auto out = std::ofstream{filename, std::ios::binary};
+            out << contents;
+        }
+        NNCache loaded{1000};
+        EXPECT_FALSE(loaded.load(filename, "net-a"));
+        EXPECT_FALSE(loaded.map(filename, "net-a"));
+    }
+    std::remove(filename.c_str());
+}
+
+TEST(NNCacheTest, ConcurrentInsertLookup) {
+    constexpr auto threads = 8;
+    constexpr auto per_thread = 2000;
+    NNCache cache{threads * per_thread * 2};
+
+    auto workers = std::vector<std::thread>{};
+    for (auto t = 0; t < threads; t++) {
+        workers.emplace_back([&cache, t]() {
+            auto result = NNCache::Netresult{};
+            for (auto i = t * per_thread; i < (t + 1) * per_thread; i++) {
+                cache.insert(test_hash(i), make_result(test_hash(i)));
+                cache.lookup(test_hash(i - t * per_thread), result);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    auto result = NNCache::Netresult{};
+    auto found = 0;
+    for (auto i = 0; i < threads * per_thread; i++) {
+        if (cache.lookup(test_hash(i), result)) {
+            found++;
+            EXPECT_EQ(result.winrate, make_result(test_hash(i)).winrate);
+        }
+    }
+    EXPECT_GT(found, threads * per_thread * 9 / 10);
+}
+
+// Lookups and inserts from many threads, as when search threads expand
+// nodes. Run with --gtest_also_run_disabled_tests.
+TEST(NNCacheTest, DISABLED_ContentionBenchmark) {
+    constexpr auto ops_per_thread = 200'000;
+    NNCache cache{NNCache::MAX_CACHE_COUNT};
+    for (const auto threads : {1, 2, 4, 8, 16, 32}) {
+        auto workers = std::vector<std::thread>{};
+        std::atomic<int> hits{0};
+        const auto start = std::chrono::steady_clock::now();
+        for (auto t = 0; t < threads; t++) {
+            workers.emplace_back([&cache, &hits, t]() {
+                auto result = NNCache::Netresult{};
+                auto thread_hits = 0;
+                for (auto i = 0; i < ops_per_thread; i++) {
+                    // Mostly lookups, as probe_cache tries several
+                    // symmetries before the one insert of an expansion.
+                    const auto key = test_hash((i * 31 + t) % 300'000);
+                    if (cache.lookup(key, result)) {
+                        thread_hits++;
+                    } else if (i % 4 == 0) {
+                        cache.insert(key, result);
+                    }
+                }
+                hits += thread_hits;
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        const auto elapsed = std::chrono::duration<double, std::nano>(
+            std::chrono::steady_clock::now() - start).count();
+        printf("%2d threads: %6.1f ns per operation, %.1f Mops/s total\n",
+               threads, elapsed / ops_per_thread,
+               threads * ops_per_thread / elapsed * 1000.0);
+    }
+}
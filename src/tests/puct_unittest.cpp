@@ -0,0 +1,247 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "FastBoard.h"
+#include "PUCT.h"
+#include "UCTNodeArena.h"
+#include "UCTNodePointer.h"
+
+using CPUFeatures::Isa;
+
+namespace {
+    constexpr auto ACTIVE = std::uint8_t{2};
+
+    // Children of a node with root_visits visits spread over the first
+    // visited of them.  A few are pruned or invalid and with threads some
+    // have virtual losses.  The others have not been searched yet.  The
+    // policy goes down from the first child.
+    UCTNodeChildren random_children(UCTNodeArena& arena, const size_t size,
+                                    const size_t visited,
+                                    const int root_visits,
+                                    const unsigned int seed) {
+        auto rng = std::mt19937{seed};
+        auto uniform = std::uniform_real_distribution<float>{0.0f, 1.0f};
+        auto children = UCTNodeChildren{arena, size};
+        auto policy = std::vector<float>(size);
+        auto policy_sum = 0.0f;
+        for (auto& p : policy) {
+            p = std::pow(uniform(rng), 8.0f);
+            policy_sum += p;
+        }
+        // Best to worst, as link_nodelist puts them.
+        std::sort(policy.rbegin(), policy.rend());
+        for (auto i = size_t{0}; i < size; i++) {
+            const auto p = policy[i] / policy_sum;
+            children.push_back(UCTNodePointer(FastBoard::PASS, p));
+            children.policy()[i] = p;
+            if (i >= visited) {
+                continue;
+            }
+            const auto visits = int(root_visits * p * uniform(rng) * 2.0f);
+            const auto eval = uniform(rng);
+            children.visits()[i] = visits;
+            children.blackevals()[i] = visits * eval;
+            children.virtual_loss()[i] = rng() % 8 == 0 ? 3 : 0;
+            children.status()[i] = rng() % 16 == 0 ? rng() % 2 : ACTIVE;
+        }
+        return children;
+    }
+
+    PUCT::Params params_for(const int color, const int root_visits) {
+        auto params = PUCT::Params{};
+        params.color = color;
+        params.active_status = ACTIVE;
+        params.fpu_eval = 0.35f;
+        params.busy_eval = -1.2f;
+        params.puct_scale = 0.8f * std::sqrt(float(root_visits));
+        return params;
+    }
+
+    bool busy(const size_t i) {
+        return i % 3 == 0;
+    }
+
+    // The scores of uct_select_child before the kernel, one child at a
+    // time in double precision, lowest() for children that can't be
+    // selected.  busy is only asked about children with a virtual loss,
+    // like the kernel does.
+    std::vector<double> double_scores(const UCTNodeChildren& children,
+                                      const PUCT::Params& params,
+                                      const double puct_scale) {
+        auto scores = std::vector<double>(
+            children.size(), std::numeric_limits<double>::lowest());
+        for (auto i = size_t{0}; i < children.size(); i++) {
+            if (children.status()[i] != params.active_status) {
+                continue;
+            }
+            const auto visits = children.visits()[i].load();
+            const auto virtual_loss = children.virtual_loss()[i].load();
+            auto blackevals = double(children.blackevals()[i]);
+            const auto policy = double(children.policy()[i]);
+            auto winrate = double(params.fpu_eval);
+            if (virtual_loss > 0 && busy(i)) {
+                winrate = params.busy_eval;
+            } else if (visits > 0) {
+                if (params.color == FastBoard::WHITE) {
+                    blackevals += virtual_loss;
+                }
+                winrate = blackevals / (visits + virtual_loss);
+                if (params.color == FastBoard::WHITE) {
+                    winrate = 1.0 - winrate;
+                }
+            }
+            scores[i] = winrate + puct_scale * policy / (1.0 + visits);
+        }
+        return scores;
+    }
+}
+
+class PUCTTest : public ::testing::TestWithParam<Isa> {};
+
+TEST_P(PUCTTest, MatchesScalar) {
+    UCTNodeArena arena;
+    auto seed = 0u;
+    // Sizes around the vector width and realistic root sizes.
+    for (const auto size : {1, 7, 8, 9, 31, 250, 362}) {
+        // Every child searched, or only the first ones as usual.
+        for (const auto visited : {size_t(size), size_t{32}}) {
+            for (const auto root_visits : {1, 100, 10000}) {
+                for (const auto color : {FastBoard::BLACK,
+                                         FastBoard::WHITE}) {
+                    const auto children = random_children(
+                        arena, size, visited, root_visits, seed++);
+                    const auto params = params_for(color, root_visits);
+                    EXPECT_EQ(
+                        PUCT::select(Isa::SCALAR, children, params, busy),
+                        PUCT::select(GetParam(), children, params, busy))
+                        << size << " children, " << visited << " visited, "
+                        << root_visits << " visits";
+                }
+            }
+        }
+    }
+}
+
+TEST_P(PUCTTest, MatchesDoublePrecision) {
+    UCTNodeArena arena;
+    auto seed = 1000u;
+    for (const auto size : {1, 9, 250, 362}) {
+        for (const auto visited : {size_t(size), size_t{32}}) {
+            for (const auto root_visits : {1, 100, 10000}) {
+                for (const auto color : {FastBoard::BLACK,
+                                         FastBoard::WHITE}) {
+                    const auto children = random_children(
+                        arena, size, visited, root_visits, seed++);
+                    const auto puct_scale = 0.8 * std::sqrt(root_visits);
+                    auto params = params_for(color, root_visits);
+                    params.puct_scale = float(puct_scale);
+
+                    const auto scores =
+                        double_scores(children, params, puct_scale);
+                    const auto expected = size_t(std::distance(
+                        begin(scores),
+                        std::max_element(begin(scores), end(scores))));
+                    const auto best =
+                        PUCT::select(GetParam(), children, params, busy);
+                    if (scores[expected]
+                        == std::numeric_limits<double>::lowest()) {
+                        EXPECT_EQ(best, children.size());
+                        continue;
+                    }
+                    // Float can only pick another child when the two
+                    // are within rounding of each other.
+                    ASSERT_LT(best, children.size());
+                    if (best != expected) {
+                        EXPECT_NEAR(scores[best], scores[expected],
+                                    1e-6 * std::abs(scores[expected]))
+                            << size << " children, " << root_visits
+                            << " visits";
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST_P(PUCTTest, FirstOfEqualScores) {
+    UCTNodeArena arena;
+    auto children = UCTNodeChildren{arena, 20};
+    for (auto i = size_t{0}; i < 20; i++) {
+        children.push_back(UCTNodePointer(FastBoard::PASS, 0.05f));
+        children.policy()[i] = 0.05f;
+        children.status()[i] = i < 10 ? 0 : ACTIVE;
+    }
+    const auto params = params_for(FastBoard::BLACK, 1);
+    EXPECT_EQ(PUCT::select(GetParam(), children, params, busy), 10u);
+
+    for (auto i = size_t{0}; i < 20; i++) {
+        children.status()[i] = 0;
+    }
+    EXPECT_EQ(PUCT::select(GetParam(), children, params, busy), 20u);
+}
+
+TEST_P(PUCTTest, DISABLED_Benchmark250Children) {
+    using Clock = std::chrono::steady_clock;
+    UCTNodeArena arena;
+    // A root early in a move, with the visits on the best 32 children.
+    auto children = random_children(arena, 250, 32, 10000, 1);
+    // One search thread, so no virtual losses.
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        children.virtual_loss()[i] = 0;
+    }
+    const auto params = params_for(FastBoard::BLACK, 10000);
+    constexpr auto rounds = 1000000;
+    auto best = size_t{0};
+    const auto start = Clock::now();
+    for (auto i = 0; i < rounds; i++) {
+        best = PUCT::select(GetParam(), children, params, busy);
+    }
+    const auto elapsed = std::chrono::duration<double>(Clock::now() - start);
+    EXPECT_LT(best, children.size());
+    std::cout << CPUFeatures::isa_name(GetParam()) << " 250 children: "
+              << elapsed.count() / rounds * 1e9 << " ns per selection"
+              << std::endl;
+}
+
+INSTANTIATE_TEST_CASE_P(Isas, PUCTTest,
+                        ::testing::ValuesIn(CPUFeatures::supported_isas()));
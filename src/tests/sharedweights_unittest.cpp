@@ -0,0 +1,140 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <boost/filesystem.hpp>
+
+#include "SharedWeights.h"
+#include "Utils.h"
+
+#ifndef _WIN32
+namespace {
+    // Starts and ends with a clean data directory entry for name.
+    class SharedWeightsTest : public ::testing::Test {
+    protected:
+        SharedWeightsTest() {
+            boost::filesystem::remove(m_filename);
+        }
+        ~SharedWeightsTest() {
+            boost::filesystem::remove(m_filename);
+        }
+
+        // Maps the blob, counting how often it had to be written.
+        std::shared_ptr<const char> map(const size_t size, const char byte) {
+            return SharedWeights::map(m_name, size, [&](char* const out) {
+                m_fills++;
+                std::memset(out, byte, size);
+            });
+        }
+
+        // Whether the data directory holds anything but the blob itself,
+        // such as a leftover temporary file.
+        bool has_leftovers() const {
+            const auto dir = boost::filesystem::path(m_filename).parent_path();
+            for (const auto& entry : boost::filesystem::directory_iterator(dir)) {
+                const auto file = entry.path().filename().string();
+                if (file != m_name && file.compare(0, m_name.size(), m_name) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        const std::string m_name{"sharedweights-unittest"};
+        const std::string m_filename{Utils::leelaz_file(m_name)};
+        int m_fills{0};
+    };
+
+    bool all_equal(const char* const data, const size_t size, const char byte) {
+        for (auto i = size_t{0}; i < size; i++) {
+            if (data[i] != byte) {
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+TEST_F(SharedWeightsTest, WritesOnceThenMaps) {
+    constexpr auto size = size_t{1000};
+    const auto first = map(size, 'a');
+    ASSERT_NE(first, nullptr);
+    EXPECT_EQ(m_fills, 1);
+    EXPECT_TRUE(all_equal(first.get(), size, 'a'));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(first.get()) % 64, 0u);
+    // Written through a temporary file that got renamed into place.
+    EXPECT_TRUE(boost::filesystem::exists(m_filename));
+    EXPECT_FALSE(has_leftovers());
+
+    const auto second = map(size, 'b');
+    ASSERT_NE(second, nullptr);
+    EXPECT_EQ(m_fills, 1);
+    EXPECT_TRUE(all_equal(second.get(), size, 'a'));
+}
+
+TEST_F(SharedWeightsTest, RewritesWrongSize) {
+    ASSERT_NE(map(1000, 'a'), nullptr);
+    const auto data = map(2000, 'b');
+    ASSERT_NE(data, nullptr);
+    EXPECT_EQ(m_fills, 2);
+    EXPECT_TRUE(all_equal(data.get(), 2000, 'b'));
+    EXPECT_FALSE(has_leftovers());
+}
+
+TEST_F(SharedWeightsTest, RewritesDamagedFile) {
+    constexpr auto size = size_t{1000};
+    ASSERT_NE(map(size, 'a'), nullptr);
+    {
+        // Same size, one payload byte changed.
+        auto file = std::fstream{m_filename,
+                                 std::ios::in | std::ios::out | std::ios::binary};
+        file.seekp(-1, std::ios::end);
+        file.put('x');
+    }
+    const auto data = map(size, 'b');
+    ASSERT_NE(data, nullptr);
+    EXPECT_EQ(m_fills, 2);
+    EXPECT_TRUE(all_equal(data.get(), size, 'b'));
+}
+
+TEST_F(SharedWeightsTest, FailsWithoutDirectory) {
+    // Callers fall back to private weights on nullptr.
+    const auto data = SharedWeights::map(
+        "sharedweights-unittest-missing/blob", 1000, [](char*) {});
+    EXPECT_EQ(data, nullptr);
+}
+#endif
@@ -0,0 +1,100 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <array>
+#include <random>
+
+#include "FastBoard.h"
+#include "Network.h"
+#include "Symmetry.h"
+
+using Plane = std::array<float, NUM_INTERSECTIONS>;
+
+static Plane random_plane(const unsigned int seed) {
+    auto rng = std::mt19937{seed};
+    auto dist = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+    auto plane = Plane{};
+    for (auto& x : plane) {
+        x = dist(rng);
+    }
+    return plane;
+}
+
+// The point-by-point definition, out[idx] = in[s(idx)]
+static Plane reference_transform(const int symmetry, const Plane& in) {
+    auto out = Plane{};
+    for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
+        const auto xy = Network::get_symmetry(
+            {idx % BOARD_SIZE, idx / BOARD_SIZE}, symmetry);
+        out[idx] = in[xy.second * BOARD_SIZE + xy.first];
+    }
+    return out;
+}
+
+TEST(SymmetryTest, FloatMatchesReference) {
+    const auto in = random_plane(1);
+    for (auto s = 0; s < Network::NUM_SYMMETRIES; s++) {
+        auto out = Plane{};
+        Symmetry::transform(s, in.data(), out.data());
+        EXPECT_EQ(reference_transform(s, in), out) << "symmetry " << s;
+    }
+}
+
+TEST(SymmetryTest, InverseUndoes) {
+    const auto in = random_plane(2);
+    for (auto s = 0; s < Network::NUM_SYMMETRIES; s++) {
+        auto out = Plane{};
+        auto back = Plane{};
+        Symmetry::transform(s, in.data(), out.data());
+        Symmetry::transform(Symmetry::inverse(s), out.data(), back.data());
+        EXPECT_EQ(in, back) << "symmetry " << s;
+    }
+}
+
+TEST(SymmetryTest, BitsMatchFloat) {
+    auto rng = std::mt19937{3};
+    auto bits = FastBoard::plane_t{};
+    auto floats = Plane{};
+    for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
+        if (rng() % 3 == 0) {
+            bits[idx / 64] |= std::uint64_t{1} << (idx % 64);
+            floats[idx] = 1.0f;
+        }
+    }
+    for (auto s = 0; s < Network::NUM_SYMMETRIES; s++) {
+        auto unpacked = Plane{};
+        Symmetry::unpack(s, bits, unpacked.data());
+        EXPECT_EQ(reference_transform(s, floats), unpacked)
+            << "symmetry " << s;
+    }
+}
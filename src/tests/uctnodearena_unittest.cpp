@@ -0,0 +1,151 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "FastBoard.h"
+#include "UCTNode.h"
+#include "UCTNodeArena.h"
+#include "UCTNodePointer.h"
+
+TEST(UCTNodeArenaTest, OwnerOfAllocations) {
+    const auto before = UCTNodeArena::get_tree_size();
+    {
+        UCTNodeArena arena;
+        UCTNodeArena other;
+        auto node = arena.create<UCTNode>(FastBoard::PASS, 0.5f);
+        auto other_node = other.create<UCTNode>(FastBoard::PASS, 0.5f);
+        EXPECT_EQ(&UCTNodeArena::owner(node), &arena);
+        EXPECT_EQ(&UCTNodeArena::owner(other_node), &other);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(node) % alignof(UCTNode),
+                  0u);
+
+        // Enough to fill more than one slab.
+        const auto count = 2 * UCTNodeArena::SLAB_SIZE / sizeof(UCTNode);
+        for (auto i = size_t{0}; i < count; i++) {
+            auto p = arena.create<UCTNode>(FastBoard::PASS, 0.0f);
+            ASSERT_EQ(&UCTNodeArena::owner(p), &arena);
+        }
+        EXPECT_GE(UCTNodeArena::get_tree_size(),
+                  before + (count + 2) * sizeof(UCTNode));
+    }
+    EXPECT_EQ(UCTNodeArena::get_tree_size(), before);
+}
+
+TEST(UCTNodeArenaTest, ReusesReleasedBlocks) {
+    const auto before = UCTNodeArena::get_tree_size();
+    UCTNodeArena arena;
+    auto node = arena.create<UCTNode>(FastBoard::PASS, 0.5f);
+    auto block = arena.allocate(1000, 8);
+    const auto used = UCTNodeArena::get_tree_size();
+    EXPECT_GE(used, before + sizeof(UCTNode) + 1000);
+
+    arena.destroy(node);
+    arena.deallocate(block, 1000);
+    EXPECT_EQ(UCTNodeArena::get_tree_size(), before);
+
+    // Blocks of the same size class come back, in any order.
+    EXPECT_EQ(arena.allocate(990, 8), block);
+    EXPECT_EQ(arena.create<UCTNode>(FastBoard::PASS, 0.0f), node);
+    EXPECT_EQ(UCTNodeArena::get_tree_size(), used);
+}
+
+TEST(UCTNodeArenaTest, ReturnsFreeSlabs) {
+    const auto before = UCTNodeArena::get_reserved_size();
+    const auto tree_size = UCTNodeArena::get_tree_size();
+    {
+        UCTNodeArena arena;
+        const auto count = 3 * UCTNodeArena::SLAB_SIZE / sizeof(UCTNode);
+        auto nodes = std::vector<UCTNode*>{};
+        for (auto i = size_t{0}; i < count; i++) {
+            nodes.push_back(arena.create<UCTNode>(FastBoard::PASS, 0.0f));
+        }
+        const auto peak = UCTNodeArena::get_reserved_size();
+        EXPECT_GE(peak, before + 3 * UCTNodeArena::SLAB_SIZE);
+
+        // The free lists stop growing once they hold as much as is still
+        // allocated, so the slabs that empty out after that go back to
+        // the system.
+        for (auto i = count; i > 0; i--) {
+            arena.destroy(nodes[i - 1]);
+        }
+        EXPECT_EQ(UCTNodeArena::get_tree_size(), tree_size);
+        EXPECT_LE(UCTNodeArena::get_reserved_size(),
+                  peak - UCTNodeArena::SLAB_SIZE);
+    }
+    EXPECT_EQ(UCTNodeArena::get_reserved_size(), before);
+}
+
+TEST(UCTNodeArenaTest, SizeClassesCoverAllBlocks) {
+    UCTNodeArena arena;
+    auto previous = UCTNodeArena::get_tree_size();
+    for (auto bytes = size_t{1}; bytes <= UCTNodeArena::MAX_BLOCK;
+         bytes += 1 + bytes / 8) {
+        auto block = arena.allocate(bytes, 16);
+        EXPECT_EQ(reinterpret_cast<std::uintptr_t>(block) % 16, 0u);
+        const auto size = UCTNodeArena::get_tree_size() - previous;
+        // At most a quarter of the block is rounding.
+        EXPECT_GE(size, bytes);
+        EXPECT_LE(size, std::max(size_t{16}, bytes + bytes / 4 + 15));
+        previous += size;
+    }
+}
+
+TEST(UCTNodeArenaTest, ThreadsUseOwnSlabs) {
+    UCTNodeArena arena;
+    auto first = arena.create<UCTNodePointer>(FastBoard::PASS, 0.0f);
+    auto second = static_cast<UCTNodePointer*>(nullptr);
+    std::thread([&arena, &second]() {
+        second = arena.create<UCTNodePointer>(FastBoard::PASS, 0.0f);
+    }).join();
+    EXPECT_EQ(&UCTNodeArena::owner(second), &arena);
+    EXPECT_NE(reinterpret_cast<std::uintptr_t>(first)
+                  / UCTNodeArena::SLAB_SIZE,
+              reinterpret_cast<std::uintptr_t>(second)
+                  / UCTNodeArena::SLAB_SIZE);
+}
+
+TEST(UCTNodeArenaTest, InflateInOwnerArena) {
+    UCTNodeArena arena;
+    auto pointer = arena.create<UCTNodePointer>(FastBoard::PASS, 0.25f);
+    EXPECT_FALSE(pointer->is_inflated());
+    pointer->inflate();
+    ASSERT_TRUE(pointer->is_inflated());
+    EXPECT_EQ(&UCTNodeArena::owner(pointer->get()), &arena);
+    EXPECT_EQ(pointer->get_move(), FastBoard::PASS);
+    EXPECT_FLOAT_EQ(pointer->get_policy(), 0.25f);
+}
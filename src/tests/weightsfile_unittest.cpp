@@ -0,0 +1,124 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "WeightsFile.h"
+
+static const auto TEXT_WEIGHTS = std::string{"../src/tests/0k.txt"};
+
+TEST(WeightsFileTest, BinaryRoundTrip) {
+    auto text = WeightsFile::Tensors{};
+    ASSERT_TRUE(WeightsFile::read(TEXT_WEIGHTS, text));
+    EXPECT_EQ(text.version, 1);
+    EXPECT_FALSE(WeightsFile::is_binary(TEXT_WEIGHTS));
+
+    const auto filename = std::string{"weightsfile_unittest.bin"};
+    ASSERT_TRUE(WeightsFile::write_binary(filename, text));
+    EXPECT_TRUE(WeightsFile::is_binary(filename));
+    auto binary = WeightsFile::Tensors{};
+    const auto ok = WeightsFile::read(filename, binary);
+    std::remove(filename.c_str());
+
+    ASSERT_TRUE(ok);
+    EXPECT_EQ(text.version, binary.version);
+    // Bit exact, not just close.
+    EXPECT_EQ(text.tensors, binary.tensors);
+}
+
+TEST(WeightsFileTest, ThreadedParseMatches) {
+    auto serial = WeightsFile::Tensors{};
+    auto threaded = WeightsFile::Tensors{};
+    ASSERT_TRUE(WeightsFile::read(TEXT_WEIGHTS, serial, 1));
+    ASSERT_TRUE(WeightsFile::read(TEXT_WEIGHTS, threaded, 4));
+    EXPECT_EQ(serial.tensors, threaded.tensors);
+
+    const auto filename = std::string{"weightsfile_unittest.txt"};
+    {
+        auto out = std::ofstream{filename};
+        out << "1\n1 2 3\n4 5\n6 x\n7\n";
+    }
+    auto broken = WeightsFile::Tensors{};
+    EXPECT_FALSE(WeightsFile::read(filename, broken, 4));
+    std::remove(filename.c_str());
+}
+
+TEST(WeightsFileTest, TruncatedBinaryFails) {
+    auto weights = WeightsFile::Tensors{};
+    weights.version = 2;
+    weights.tensors = {{1.0f, 2.0f}, {}, {3.0f}};
+
+    const auto filename = std::string{"weightsfile_unittest.bin"};
+    ASSERT_TRUE(WeightsFile::write_binary(filename, weights));
+    auto contents = std::string{};
+    {
+        auto in = std::ifstream{filename, std::ios::binary};
+        contents.assign(std::istreambuf_iterator<char>(in),
+                        std::istreambuf_iterator<char>());
+    }
+    auto loaded = WeightsFile::Tensors{};
+    EXPECT_TRUE(WeightsFile::read(filename, loaded));
+    EXPECT_EQ(weights.tensors, loaded.tensors);
+    EXPECT_EQ(loaded.version, 2);
+
+    contents.resize(contents.size() - 1);
+    {
+        auto out = std::ofstream{filename, std::ios::binary};
+        out << contents;
+    }
+    EXPECT_FALSE(WeightsFile::read(filename, loaded));
+    std::remove(filename.c_str());
+}
+
+TEST(WeightsFileTest, FingerprintFollowsContents) {
+    EXPECT_TRUE(WeightsFile::fingerprint("weightsfile_unittest.none").empty());
+
+    const auto filename = std::string{"weightsfile_unittest.txt"};
+    {
+        auto out = std::ofstream{filename};
+        out << "1\n1 2 3\n";
+    }
+    const auto first = WeightsFile::fingerprint(filename);
+    EXPECT_FALSE(first.empty());
+    EXPECT_EQ(first, WeightsFile::fingerprint(filename));
+    {
+        auto out = std::ofstream{filename};
+        out << "1\n1 2 4\n";
+    }
+    const auto second = WeightsFile::fingerprint(filename);
+    std::remove(filename.c_str());
+    EXPECT_NE(first, second);
+}
@@ -0,0 +1,240 @@
+/*
+    This file is part of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+
+    Leela Zero is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Leela Zero is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Leela Zero.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include <gtest/gtest.h>
+
+#include "config.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "CPUWinograd.h"
+#include "Network.h"
+
+using CPUFeatures::Isa;
+
+// The SIMD kernels may contract into FMAs and associate differently,
+// so allow for a few ulps of difference on values of order one.
+constexpr auto TOLERANCE = 1e-5f;
+
+static std::vector<float> random_vector(const size_t size) {
+    auto rng = std::mt19937{1234};
+    auto dist = std::uniform_real_distribution<float>{-1.0f, 1.0f};
+    auto data = std::vector<float>(size);
+    for (auto& x : data) {
+        x = dist(rng);
+    }
+    return data;
+}
+
+static void expect_near(const std::vector<float>& ref,
+                        const std::vector<float>& data) {
+    ASSERT_EQ(ref.size(), data.size());
+    for (auto i = size_t{0}; i < ref.size(); i++) {
+        ASSERT_NEAR(ref[i], data[i], TOLERANCE * (1.0f + std::abs(ref[i])))
+            << "at index " << i;
+    }
+}
+
+class WinogradTest : public ::testing::TestWithParam<Isa> {};
+
+TEST_P(WinogradTest, TransformInMatchesScalar) {
+    // 18 input planes are not a multiple of any vector width.
+    for (const auto channels : {Network::INPUT_CHANNELS, 64}) {
+        for (const auto batch_size : {1, 3}) {
+            const auto in = random_vector(batch_size * channels * NUM_INTERSECTIONS);
+            const auto v_size = WINOGRAD_TILE * channels * WINOGRAD_P * batch_size;
+            auto ref = std::vector<float>(v_size);
+            auto V = std::vector<float>(v_size);
+
+            CPUWinograd::transform_in(Isa::SCALAR, in.data(), ref.data(),
+                                      channels, batch_size, 0, channels);
+            // Split like an intra-op parallel eval would, off the vector
+            // boundaries.
+            const auto split = channels / 2 + 1;
+            CPUWinograd::transform_in(GetParam(), in.data(), V.data(),
+                                      channels, batch_size, 0, split);
+            CPUWinograd::transform_in(GetParam(), in.data(), V.data(),
+                                      channels, batch_size, split, channels);
+            expect_near(ref, V);
+        }
+    }
+}
+
+TEST_P(WinogradTest, TransformOutMatchesScalar) {
+    const auto outputs = 32;
+    const auto means = random_vector(outputs);
+    auto stddevs = random_vector(outputs);
+    for (auto& x : stddevs) {
+        x += 2.0f;
+    }
+    // 25 tiles per position leave a partial vector at the end.
+    for (const auto batch_size : {1, 3}) {
+        const auto M = random_vector(WINOGRAD_TILE * outputs * WINOGRAD_P * batch_size);
+        const auto y_size = batch_size * outputs * NUM_INTERSECTIONS;
+        const auto res = random_vector(y_size);
+        auto ref = std::vector<float>(y_size);
+        auto Y = std::vector<float>(y_size);
+
+        // Without and with the residual add
+        for (const auto eltwise : {static_cast<const float*>(nullptr), res.data()}) {
+            CPUWinograd::transform_out(Isa::SCALAR, M.data(), ref.data(),
+                                       outputs, batch_size, 0, outputs,
+                                       means.data(), stddevs.data(), eltwise);
+            for (const auto& range : {std::make_pair(0, 13),
+                                     std::make_pair(13, outputs)}) {
+                CPUWinograd::transform_out(GetParam(), M.data(), Y.data(),
+                                           outputs, batch_size,
+                                           range.first, range.second,
+                                           means.data(), stddevs.data(),
+                                           eltwise);
+            }
+            expect_near(ref, Y);
+        }
+    }
+}
+
+// The output transform of one board, followed by batchnorm, the
+// residual add and ReLU as separate passes, like CPUPipe did before
+// they were fused.
+static void unfused_transform_out(const std::vector<float>& M,
+                                  std::vector<float>& Y,
+                                  const int K, const int batch_size,
+                                  const int batch,
+                                  const std::vector<float>& means,
+                                  const std::vector<float>& stddevs,
+                                  const float* const eltwise) {
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto WTILES = WINOGRAD_WTILES;
+    const auto Pb = WINOGRAD_P * batch_size;
+
+    auto multiply_at = [](
+        float & o0, float & o1, float & o2, float & o3,
+        float i0, float i1, float i2, float i3, float i4, float i5
+    ) {
+        auto t1p2 = (i1 + i2) * (1.0f / 2.0f);
+        auto t1m2 = (i1 - i2) * (SQ2/4.0f);
+        auto t3p4 = i3 + i4;
+        auto t3m4 = (i3 - i4) * (SQ2);
+
+        o0 = i0 + t1p2 + t1p2 + t3p4;
+        o1 = t1m2 + t1m2 + t3m4;
+        o2 = t1p2 + t3p4 + t3p4;
+        o3 = t1m2 + t3m4 + t3m4 + i5;
+    };
+
+    const auto out = &Y[batch * K * NUM_INTERSECTIONS];
+    for (auto k = 0; k < K; k++) {
+        for (auto block_x = 0; block_x < WTILES; block_x++) {
+            const auto x = WINOGRAD_M * block_x;
+            for (auto block_y = 0; block_y < WTILES; block_y++) {
+                const auto y = WINOGRAD_M * block_y;
+
+                const auto b = batch * WINOGRAD_P + block_y * WTILES + block_x;
+                float temp_m[WINOGRAD_ALPHA][WINOGRAD_ALPHA];
+                for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++) {
+                    for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++) {
+                        temp_m[xi][nu] =
+                            M[(xi*WINOGRAD_ALPHA + nu)*K*Pb + k*Pb + b];
+                    }
+                }
+                float temp[WINOGRAD_M][WINOGRAD_ALPHA];
+                float o[WINOGRAD_M][WINOGRAD_M];
+                for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                    multiply_at(
+                        temp[0][j], temp[1][j], temp[2][j], temp[3][j],
+                        temp_m[0][j], temp_m[1][j], temp_m[2][j], temp_m[3][j], temp_m[4][j], temp_m[5][j]
+                    );
+                }
+                for (auto i = 0; i < WINOGRAD_M; i++) {
+                    multiply_at(
+                        o[i][0], o[i][1], o[i][2], o[i][3],
+                        temp[i][0], temp[i][1], temp[i][2], temp[i][3], temp[i][4], temp[i][5]
+                    );
+                }
+                for (auto i = 0; i < WINOGRAD_M; i++) {
+                    for (auto j = 0; j < WINOGRAD_M; j++) {
+                        if (y + i < W && x + j < W) {
+                            out[k * NUM_INTERSECTIONS + (y + i) * W + x + j] = o[i][j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    for (auto k = 0; k < K; k++) {
+        const auto arr = &out[k * NUM_INTERSECTIONS];
+        for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
+            arr[i] = stddevs[k] * (arr[i] - means[k]);
+        }
+        if (eltwise) {
+            const auto res = &eltwise[(batch * K + k) * NUM_INTERSECTIONS];
+            for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
+                arr[i] += res[i];
+            }
+        }
+        for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
+            arr[i] = std::max(arr[i], 0.0f);
+        }
+    }
+}
+
+TEST_P(WinogradTest, TransformOutMatchesUnfused) {
+    const auto outputs = 32;
+    const auto means = random_vector(outputs);
+    auto stddevs = random_vector(outputs);
+    for (auto& x : stddevs) {
+        x += 2.0f;
+    }
+    for (const auto batch_size : {1, 3}) {
+        const auto M = random_vector(WINOGRAD_TILE * outputs * WINOGRAD_P * batch_size);
+        const auto y_size = batch_size * outputs * NUM_INTERSECTIONS;
+        const auto res = random_vector(y_size);
+        auto ref = std::vector<float>(y_size);
+        auto Y = std::vector<float>(y_size);
+
+        for (const auto eltwise : {static_cast<const float*>(nullptr), res.data()}) {
+            for (auto batch = 0; batch < batch_size; batch++) {
+                unfused_transform_out(M, ref, outputs, batch_size, batch,
+                                      means, stddevs, eltwise);
+            }
+            CPUWinograd::transform_out(GetParam(), M.data(), Y.data(),
+                                       outputs, batch_size, 0, outputs,
+                                       means.data(), stddevs.data(), eltwise);
+            expect_near(ref, Y);
+        }
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Isas, WinogradTest,
+                        ::testing::ValuesIn(CPUFeatures::supported_isas()));